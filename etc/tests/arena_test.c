@@ -0,0 +1,258 @@
+/*
+ * Benchmark for the path arena
+ * Created by LoRd_MuldeR <mulder2@gmx.de>.
+ *
+ * This work is licensed under the CC0 1.0 Universal License.
+ * To view a copy of the license, visit:
+ * https://creativecommons.org/publicdomain/zero/1.0/legalcode
+ *
+ * Resolves a batch of paths (one million, by default) with getLexicalPath(),
+ * so that the numbers reflect the allocator rather than the file system, and
+ * reports the allocator calls per resolved path, the peak heap usage and the
+ * time per path for these strategies:
+ *
+ *  - heap, kept:    one malloc() per result, nothing released (the former realpath loop)
+ *  - heap, freed:   one malloc() and one free() per result
+ *  - arena, path:   arena reset after every path (realpath, one path at a time)
+ *  - arena, batch:  arena reset after every batch (realpath, batched input)
+ *
+ * The results of all strategies must be identical.
+ *
+ * Usage: arena_test.exe [<paths> [<batch size>]]
+ */
+
+/* everything that "common.c" includes comes first, so that the macros below only affect its code */
+#define WIN32_LEAN_AND_MEAN 1
+#include <Windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <malloc.h>
+#include <string.h>
+#include <wchar.h>
+#include <limits.h>
+#include <locale.h>
+#include <errno.h>
+#include <io.h>
+#include <fcntl.h>
+#include <Shlwapi.h>
+#if defined(_M_IX86) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+/* ======================================================================= */
+/* ALLOCATOR COUNTERS                                                      */
+/* ======================================================================= */
+
+typedef union
+{
+	size_t size;
+	double align; /*keep the payload aligned*/
+}
+alloc_header;
+
+static unsigned long long countAlloc = 0ULL, countFree = 0ULL;
+static size_t heapCurrent = 0U, heapPeak = 0U;
+
+static void *countedMalloc(const size_t size)
+{
+	alloc_header *const header = (alloc_header*) malloc(sizeof(alloc_header) + size);
+	++countAlloc;
+	if (!header)
+	{
+		return NULL;
+	}
+	header->size = size;
+	if ((heapCurrent += size) > heapPeak)
+	{
+		heapPeak = heapCurrent;
+	}
+	return header + 1U;
+}
+
+static void countedFree(void *const ptr)
+{
+	if (ptr)
+	{
+		alloc_header *const header = ((alloc_header*)ptr) - 1U;
+		++countFree;
+		heapCurrent -= header->size;
+		free(header);
+	}
+}
+
+static void *countedCalloc(const size_t count, const size_t size)
+{
+	void *const ptr = countedMalloc(count * size);
+	if (ptr)
+	{
+		memset(ptr, 0, count * size);
+	}
+	return ptr;
+}
+
+static void *countedRealloc(void *const ptr, const size_t size)
+{
+	void *next;
+	if (!ptr)
+	{
+		return countedMalloc(size);
+	}
+	if (next = countedMalloc(size))
+	{
+		const size_t previous = (((alloc_header*)ptr) - 1U)->size;
+		memcpy(next, ptr, (previous < size) ? previous : size);
+		countedFree(ptr);
+	}
+	return next;
+}
+
+static wchar_t *countedWcsdup(const wchar_t *const str)
+{
+	const size_t length = wcslen(str) + 1U;
+	wchar_t *const copy = (wchar_t*) countedMalloc(sizeof(wchar_t) * length);
+	if (copy)
+	{
+		wmemcpy(copy, str, length);
+	}
+	return copy;
+}
+
+/* the functions in "common.c" call the counting wrappers */
+#define malloc countedMalloc
+#define calloc countedCalloc
+#define realloc countedRealloc
+#define free countedFree
+#define _wcsdup countedWcsdup
+
+#include "test_common.h"
+
+#define DEFAULT_PATHS 1000000UL
+#define DEFAULT_BATCH 1024UL
+
+/* ======================================================================= */
+/* STRATEGIES                                                              */
+/* ======================================================================= */
+
+typedef enum
+{
+	HEAP_KEPT,
+	HEAP_FREED,
+	ARENA_PATH,
+	ARENA_BATCH
+}
+strategy_t;
+
+static const wchar_t *const STRATEGY_NAMES[] = { L"heap, kept", L"heap, freed", L"arena, path", L"arena, batch" };
+
+static void makeInput(wchar_t *const buffer, const unsigned long index)
+{
+	_snwprintf(buffer, 128U, L"C:\\Users\\Example\\Projects\\Repository_%03lu\\source\\..\\include\\module_%05lu\\.\\header_file_%07lu.h", index % 997UL, index % 65521UL, index);
+	buffer[127U] = L'\0';
+}
+
+static unsigned long long checksum(const wchar_t *str)
+{
+	unsigned long long hash = 14695981039346656037ULL;
+	for (; *str; ++str)
+	{
+		hash = (hash ^ (*str)) * 1099511628211ULL;
+	}
+	return hash;
+}
+
+static unsigned long long runStrategy(const strategy_t strategy, const unsigned long paths, const unsigned long batchSize)
+{
+	const wchar_t **kept = NULL;
+	unsigned long long hash = 0ULL;
+	wchar_t input[128U];
+	path_arena arena;
+	unsigned long idx;
+	double start, elapsed;
+
+	arenaInit(&arena);
+	countAlloc = countFree = 0ULL;
+	heapCurrent = heapPeak = 0U;
+
+	if ((strategy == HEAP_KEPT) && (!(kept = (const wchar_t**) calloc(paths, sizeof(const wchar_t*)))))
+	{
+		fwprintf(stderr, L"%-13s: out of memory!\n", STRATEGY_NAMES[strategy]);
+		return 0ULL;
+	}
+	countAlloc = 0ULL; /*the table of kept results is not counted*/
+	heapCurrent = heapPeak = 0U;
+
+	start = testSeconds();
+	for (idx = 0UL; idx < paths; ++idx)
+	{
+		const wchar_t *fullPath;
+		makeInput(input, idx);
+		if (!(fullPath = getLexicalPath(input, ((strategy == ARENA_PATH) || (strategy == ARENA_BATCH)) ? &arena : NULL)))
+		{
+			testCheck(FALSE, L"Path could not be resolved", input);
+			continue;
+		}
+		hash += checksum(fullPath);
+		switch (strategy)
+		{
+		case HEAP_KEPT:
+			kept[idx] = fullPath;
+			break;
+		case HEAP_FREED:
+			freePath(NULL, fullPath);
+			break;
+		case ARENA_PATH:
+			arenaReset(&arena);
+			break;
+		case ARENA_BATCH:
+			if (!((idx + 1UL) % batchSize))
+			{
+				arenaReset(&arena);
+			}
+			break;
+		}
+	}
+	elapsed = testSeconds() - start;
+
+	fwprintf(stderr, L"%-13s: %6.3f allocator calls/path, peak heap %10.1f KiB (%8.1f bytes/path), %6.3f us/path\n", STRATEGY_NAMES[strategy],
+		((double)(countAlloc + countFree)) / paths, heapPeak / 1024.0, ((double)heapPeak) / paths, (elapsed * 1.0e6) / paths);
+
+	if (kept)
+	{
+		for (idx = 0UL; idx < paths; ++idx)
+		{
+			freePath(NULL, kept[idx]);
+		}
+		free((void*)kept);
+	}
+	arenaFree(&arena);
+	return hash;
+}
+
+/* ======================================================================= */
+/* MAIN                                                                    */
+/* ======================================================================= */
+
+int wmain(int argc, wchar_t *argv[])
+{
+	const unsigned long paths = (argc > 1) ? wcstoul(argv[1U], NULL, 10) : DEFAULT_PATHS;
+	const unsigned long batchSize = (argc > 2) ? wcstoul(argv[2U], NULL, 10) : DEFAULT_BATCH;
+	unsigned long long hash[4U];
+	int strategy;
+
+	setlocale(LC_ALL, "C");
+	if ((paths < 1UL) || (batchSize < 1UL))
+	{
+		fwprintf(stderr, L"Invalid number of paths or batch size!\n");
+		return EXIT_FAILURE;
+	}
+
+	fwprintf(stderr, L"Resolving %lu paths, batch size %lu\n\n", paths, batchSize);
+	for (strategy = HEAP_KEPT; strategy <= ARENA_BATCH; ++strategy)
+	{
+		hash[strategy] = runStrategy((strategy_t)strategy, paths, batchSize);
+	}
+	testCheck((hash[HEAP_FREED] == hash[HEAP_KEPT]) && (hash[ARENA_PATH] == hash[HEAP_KEPT]) && (hash[ARENA_BATCH] == hash[HEAP_KEPT]), L"Strategies produced different results", NULL);
+
+	fwprintf(stderr, L"\n");
+	return testSummary(L"arena_test");
+}
@@ -0,0 +1,224 @@
+/*
+ * Test and benchmark for getAttributes()
+ * Created by LoRd_MuldeR <mulder2@gmx.de>.
+ *
+ * This work is licensed under the CC0 1.0 Universal License.
+ * To view a copy of the license, visit:
+ * https://creativecommons.org/publicdomain/zero/1.0/legalcode
+ *
+ * Checks that permanent errors fail fast and keep their error code, that
+ * the negative cache is off by default, and that its entries expire. Then
+ * the per-call latency is measured for an existing file, a missing file and
+ * a missing directory, with the former retry loop and the current code
+ * (with and without the negative cache).
+ *
+ * Usage: attrib_test.exe
+ */
+
+#include "test_common.h"
+
+#define CACHE_TIME 200U /*negative cache time for the tests, in milliseconds*/
+#define BENCH_CALLS 20000U /*number of calls per benchmark*/
+#define BENCH_CALLS_SLOW 40U /*number of calls per benchmark, for the former retry loop*/
+
+/* ======================================================================= */
+/* REFERENCE IMPLEMENTATION                                                */
+/* ======================================================================= */
+
+/* the retry loop, as it was before the error classification */
+static DWORD getAttributesRetry(const wchar_t *const filePath, unsigned long long *const timeStamp)
+{
+	DWORD loop;
+	WIN32_FILE_ATTRIBUTE_DATA attribs;
+
+	for (loop = 0U; loop <= 7U; ++loop)
+	{
+		if (loop > 0U)
+		{
+			Sleep(loop);
+		}
+		if (GetFileAttributesExW(filePath, GetFileExInfoStandard, &attribs))
+		{
+			if(timeStamp)
+			{
+				*timeStamp = fileTimeToMSec(&attribs.ftLastWriteTime);
+			}
+			return attribs.dwFileAttributes;
+		}
+	}
+
+	if(timeStamp)
+	{
+		*timeStamp = 0ULL;
+	}
+
+	return INVALID_FILE_ATTRIBUTES;
+}
+
+/* ======================================================================= */
+/* HELPERS                                                                 */
+/* ======================================================================= */
+
+static BOOL createFile(const wchar_t *const path)
+{
+	const HANDLE handle = CreateFileW(path, GENERIC_WRITE, 0U, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (handle == INVALID_HANDLE_VALUE)
+	{
+		return FALSE;
+	}
+	CloseHandle(handle);
+	return TRUE;
+}
+
+static BOOL isCached(const wchar_t *const path)
+{
+	const ULONG idx = hashPathKey(path) & (NEGATIVE_CACHE_SIZE - 1U);
+	return (negativeCache[idx].path != NULL) && (!_wcsicmp(negativeCache[idx].path, path));
+}
+
+/* ======================================================================= */
+/* TESTS                                                                   */
+/* ======================================================================= */
+
+static void testErrors(const wchar_t *const existing, const wchar_t *const missingFile, const wchar_t *const missingDir)
+{
+	unsigned long long timeStamp = 1ULL;
+	DWORD start;
+
+	testCheck(getAttributes(existing, &timeStamp) != INVALID_FILE_ATTRIBUTES, L"Existing file not found", existing);
+	testCheck(timeStamp != 0ULL, L"Existing file has no time stamp", existing);
+
+	start = GetTickCount();
+	testCheck(getAttributes(missingFile, &timeStamp) == INVALID_FILE_ATTRIBUTES, L"Missing file found", missingFile);
+	testCheck(GetLastError() == ERROR_FILE_NOT_FOUND, L"Missing file has the wrong error code", missingFile);
+	testCheck(timeStamp == 0ULL, L"Missing file has a time stamp", missingFile);
+	testCheck(getAttributes(missingDir, NULL) == INVALID_FILE_ATTRIBUTES, L"Missing directory found", missingDir);
+	testCheck(GetLastError() == ERROR_PATH_NOT_FOUND, L"Missing directory has the wrong error code", missingDir);
+	testCheck((GetTickCount() - start) < attribRetryBudget, L"Permanent errors did not fail fast", missingFile);
+}
+
+static void testCacheDisabled(const wchar_t *const path)
+{
+	DeleteFileW(path);
+	testCheck(negativeCacheTime == 0U, L"Negative cache is enabled by default", NULL);
+	testCheck(getAttributes(path, NULL) == INVALID_FILE_ATTRIBUTES, L"Missing file found", path);
+	testCheck(!isCached(path), L"Missing file was cached, although the cache is off", path);
+	testCheck(createFile(path), L"Failed to create the file", path);
+	testCheck(getAttributes(path, NULL) != INVALID_FILE_ATTRIBUTES, L"New file not seen immediately, with the cache off", path);
+	DeleteFileW(path);
+}
+
+static void testCacheExpiry(const wchar_t *const path)
+{
+	DWORD start;
+
+	DeleteFileW(path);
+	setAttributeOptions(attribRetryBudget, CACHE_TIME);
+	start = GetTickCount();
+
+	//The failure is cached, even though the file appears
+	testCheck(getAttributes(path, NULL) == INVALID_FILE_ATTRIBUTES, L"Missing file found", path);
+	testCheck(isCached(path), L"Missing file was not cached", path);
+	testCheck(createFile(path), L"Failed to create the file", path);
+	if ((GetTickCount() - start) < (CACHE_TIME / 2U))
+	{
+		testCheck(getAttributes(path, NULL) == INVALID_FILE_ATTRIBUTES, L"Cached failure was not used", path);
+		testCheck(GetLastError() == ERROR_FILE_NOT_FOUND, L"Cached failure has the wrong error code", path);
+	}
+
+	//After the cache time, the entry has expired and is released
+	Sleep(CACHE_TIME + 50U);
+	testCheck(getAttributes(path, NULL) != INVALID_FILE_ATTRIBUTES, L"Cached failure did not expire", path);
+	testCheck(!isCached(path), L"Expired entry was not released", path);
+
+	//Clean-up releases the remaining entries
+	DeleteFileW(path);
+	testCheck(getAttributes(path, NULL) == INVALID_FILE_ATTRIBUTES, L"Deleted file found", path);
+	releaseAttributeCache();
+	testCheck((negativeCacheInit == 0L) && (!isCached(path)), L"Cache was not released", path);
+
+	setAttributeOptions(attribRetryBudget, 0U);
+	DeleteFileW(path);
+}
+
+/* ======================================================================= */
+/* BENCHMARK                                                               */
+/* ======================================================================= */
+
+typedef DWORD (*attrib_function)(const wchar_t *const filePath, unsigned long long *const timeStamp);
+
+static double benchmark(const attrib_function function, const wchar_t *const path, const ULONG calls)
+{
+	unsigned long long timeStamp;
+	double start;
+	ULONG idx;
+
+	start = testSeconds();
+	for (idx = 0U; idx < calls; ++idx)
+	{
+		function(path, &timeStamp);
+	}
+	return ((testSeconds() - start) * 1.0e6) / calls;
+}
+
+static void runBenchmark(const wchar_t *const existing, const wchar_t *const missingFile, const wchar_t *const missingDir)
+{
+	static const wchar_t *const LABELS[] = { L"existing file", L"missing file", L"missing directory" };
+	const wchar_t *const paths[3U] = { existing, missingFile, missingDir };
+	double timeRetry, timeNew, timeCached;
+	ULONG idx;
+
+	fwprintf(stderr, L"                   | former retry | current (no cache) | current (cache)\n");
+	for (idx = 0U; idx < 3U; ++idx)
+	{
+		timeRetry = benchmark(getAttributesRetry, paths[idx], idx ? BENCH_CALLS_SLOW : BENCH_CALLS);
+		setAttributeOptions(attribRetryBudget, 0U);
+		timeNew = benchmark(getAttributes, paths[idx], BENCH_CALLS);
+		setAttributeOptions(attribRetryBudget, 60000U);
+		timeCached = benchmark(getAttributes, paths[idx], BENCH_CALLS);
+		setAttributeOptions(attribRetryBudget, 0U);
+		fwprintf(stderr, L"%-18s | %9.1f us | %15.1f us | %12.1f us\n", LABELS[idx], timeRetry, timeNew, timeCached);
+	}
+	releaseAttributeCache();
+}
+
+/* ======================================================================= */
+/* MAIN                                                                    */
+/* ======================================================================= */
+
+int wmain(int argc, wchar_t *argv[])
+{
+	wchar_t tempPath[MAX_PATH], root[MAX_PATH], existing[MAX_PATH], missingFile[MAX_PATH], missingDir[MAX_PATH], created[MAX_PATH];
+	int result = EXIT_FAILURE;
+
+	setlocale(LC_ALL, "C");
+	if (!GetTempPathW(MAX_PATH, tempPath))
+	{
+		fwprintf(stderr, L"Failed to get the TEMP directory!\n");
+		return EXIT_FAILURE;
+	}
+	_snwprintf(root, MAX_PATH, L"%sAttrib_Test_%08lX", tempPath, GetCurrentProcessId());
+	_snwprintf(existing, MAX_PATH, L"%s\\Existing.txt", root);
+	_snwprintf(missingFile, MAX_PATH, L"%s\\Missing.txt", root);
+	_snwprintf(missingDir, MAX_PATH, L"%s\\Missing\\File.txt", root);
+	_snwprintf(created, MAX_PATH, L"%s\\Created.txt", root);
+	if ((!CreateDirectoryW(root, NULL)) || (!createFile(existing)))
+	{
+		fwprintf(stderr, L"Failed to create the test files in \"%s\"!\n", root);
+		return EXIT_FAILURE;
+	}
+
+	testErrors(existing, missingFile, missingDir);
+	testCacheDisabled(created);
+	testCacheExpiry(created);
+	if (!testFailures)
+	{
+		runBenchmark(existing, missingFile, missingDir);
+	}
+	result = testSummary(L"attrib_test");
+
+	DeleteFileW(existing);
+	DeleteFileW(created);
+	RemoveDirectoryW(root);
+	return result;
+}
@@ -0,0 +1,298 @@
+/*
+ * Test and benchmark for getCanonicalPathCached()
+ * Created by LoRd_MuldeR <mulder2@gmx.de>.
+ *
+ * This work is licensed under the CC0 1.0 Universal License.
+ * To view a copy of the license, visit:
+ * https://creativecommons.org/publicdomain/zero/1.0/legalcode
+ *
+ * Builds a deep directory tree in the TEMP directory, with a junction into
+ * the tree and a junction that loops back to one of its own ancestors, then
+ * resolves every path (in random case, directly and through the junctions)
+ * with and without the cache. The results must be identical. The number of
+ * file system calls and the time per path are reported for both.
+ *
+ * Usage: cache_test.exe [<rounds>]
+ */
+
+#define WIN32_LEAN_AND_MEAN 1
+#include <Windows.h>
+
+/* ======================================================================= */
+/* SYSTEM CALL COUNTERS                                                    */
+/* ======================================================================= */
+
+static ULONG countCreateFile = 0U, countFindFirstFile = 0U, countLongPathName = 0U;
+
+static HANDLE WINAPI countedCreateFileW(LPCWSTR fileName, DWORD access, DWORD shareMode, LPSECURITY_ATTRIBUTES security, DWORD disposition, DWORD flags, HANDLE templateFile)
+{
+	++countCreateFile;
+	return CreateFileW(fileName, access, shareMode, security, disposition, flags, templateFile);
+}
+
+static HANDLE WINAPI countedFindFirstFileW(LPCWSTR fileName, LPWIN32_FIND_DATAW findData)
+{
+	++countFindFirstFile;
+	return FindFirstFileW(fileName, findData);
+}
+
+static DWORD WINAPI countedGetLongPathNameW(LPCWSTR shortPath, LPWSTR longPath, DWORD length)
+{
+	++countLongPathName;
+	return GetLongPathNameW(shortPath, longPath, length);
+}
+
+/* the functions in "common.c" call the counting wrappers */
+#define CreateFileW countedCreateFileW
+#define FindFirstFileW countedFindFirstFileW
+#define GetLongPathNameW countedGetLongPathNameW
+
+#include "test_common.h"
+
+#undef CreateFileW
+#undef FindFirstFileW
+#undef GetLongPathNameW
+
+#define TREE_DEPTH 10U /*number of nested directory levels*/
+#define TREE_FANOUT 2U /*number of sub-directories per level*/
+#define TREE_FILES 3U /*number of files per directory*/
+#define MAXIMUM_PATHS 16384U
+#define DEFAULT_ROUNDS 20U
+
+/* ======================================================================= */
+/* TEST TREE                                                               */
+/* ======================================================================= */
+
+static wchar_t *testPaths[MAXIMUM_PATHS];
+static ULONG testPathCount = 0U;
+
+static void addPath(const wchar_t *const path)
+{
+	if (testPathCount < MAXIMUM_PATHS)
+	{
+		testPaths[testPathCount++] = _wcsdup(path);
+	}
+}
+
+static BOOL createTree(const wchar_t *const path, const ULONG depth)
+{
+	wchar_t child[MAX_PATH];
+	ULONG idx;
+
+	if (!CreateDirectoryW(path, NULL))
+	{
+		return FALSE;
+	}
+	addPath(path);
+
+	for (idx = 0U; idx < TREE_FILES; ++idx)
+	{
+		HANDLE handle;
+		_snwprintf(child, MAX_PATH, L"%s\\File_%lu.Txt", path, idx);
+		child[MAX_PATH - 1U] = L'\0';
+		if ((handle = CreateFileW(child, GENERIC_WRITE, 0U, NULL, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, NULL)) == INVALID_HANDLE_VALUE)
+		{
+			return FALSE;
+		}
+		CloseHandle(handle);
+		addPath(child);
+	}
+
+	if (depth < TREE_DEPTH)
+	{
+		for (idx = 0U; idx < TREE_FANOUT; ++idx)
+		{
+			_snwprintf(child, MAX_PATH, L"%s\\Dir%c", path, L'A' + idx);
+			child[MAX_PATH - 1U] = L'\0';
+			if (!createTree(child, depth + 1U))
+			{
+				return FALSE;
+			}
+		}
+	}
+
+	return TRUE;
+}
+
+static BOOL createJunction(const wchar_t *const link, const wchar_t *const target)
+{
+	wchar_t command[3U * MAX_PATH];
+	_snwprintf(command, 3U * MAX_PATH, L"mklink /J \"%s\" \"%s\" >nul", link, target);
+	command[(3U * MAX_PATH) - 1U] = L'\0';
+	return (_wsystem(command) == 0) && (GetFileAttributesW(link) != INVALID_FILE_ATTRIBUTES);
+}
+
+static void removeTree(const wchar_t *const root)
+{
+	wchar_t command[2U * MAX_PATH];
+	_snwprintf(command, 2U * MAX_PATH, L"rmdir /s /q \"%s\"", root); /*does not follow the junctions*/
+	command[(2U * MAX_PATH) - 1U] = L'\0';
+	_wsystem(command);
+}
+
+/* same path, in random case, with some of the separators as slashes */
+static void scramblePath(wchar_t *const buffer, const wchar_t *const path)
+{
+	size_t idx;
+	for (idx = 0U; path[idx]; ++idx)
+	{
+		switch (testRandom(3U))
+		{
+		case 0U:
+			buffer[idx] = towupper(path[idx]);
+			break;
+		case 1U:
+			buffer[idx] = towlower(path[idx]);
+			break;
+		default:
+			buffer[idx] = ((path[idx] == L'\\') && (idx > 2U)) ? L'/' : path[idx];
+		}
+	}
+	buffer[idx] = L'\0';
+}
+
+/* ======================================================================= */
+/* TESTS                                                                   */
+/* ======================================================================= */
+
+static ULONG takeSyscalls(void)
+{
+	const ULONG total = countCreateFile + countFindFirstFile + countLongPathName;
+	countCreateFile = countFindFirstFile = countLongPathName = 0U;
+	return total;
+}
+
+static void compareResults(const ULONG rounds)
+{
+	wchar_t input[2U * MAX_PATH];
+	path_cache cache;
+	path_arena arena;
+	ULONG round, idx, syscallsPlain = 0U, syscallsCached = 0U;
+	double timePlain = 0.0, timeCached = 0.0, start;
+
+	pathCacheInit(&cache);
+	arenaInit(&arena);
+
+	for (round = 0U; round < rounds; ++round)
+	{
+		for (idx = 0U; idx < testPathCount; ++idx)
+		{
+			const wchar_t *expected, *actual;
+			scramblePath(input, testPaths[idx]);
+
+			takeSyscalls();
+			start = testSeconds();
+			expected = getCanonicalPath(input);
+			timePlain += testSeconds() - start;
+			syscallsPlain += takeSyscalls();
+
+			start = testSeconds();
+			actual = getCanonicalPathCached(&cache, input, &arena);
+			timeCached += testSeconds() - start;
+			syscallsCached += takeSyscalls();
+
+			testCheck((expected == NULL) == (actual == NULL), L"Cached and uncached result differ in success", input);
+			if (expected && actual)
+			{
+				testCheck(!wcscmp(expected, actual), L"Cached and uncached result differ", input);
+			}
+			FREE(expected);
+		}
+		arenaReset(&arena);
+	}
+
+	fwprintf(stderr, L"Paths resolved     : %lu x %lu\n", testPathCount, rounds);
+	fwprintf(stderr, L"Uncached           : %7.2f us/path, %5.2f file system calls/path\n", (timePlain * 1.0e6) / (testPathCount * rounds), ((double)syscallsPlain) / (testPathCount * rounds));
+	fwprintf(stderr, L"Cached             : %7.2f us/path, %5.2f file system calls/path\n", (timeCached * 1.0e6) / (testPathCount * rounds), ((double)syscallsCached) / (testPathCount * rounds));
+	if (syscallsCached)
+	{
+		fwprintf(stderr, L"File system calls  : %.1fx fewer\n", ((double)syscallsPlain) / ((double)syscallsCached));
+	}
+
+	arenaFree(&arena);
+	pathCacheFree(&cache);
+}
+
+/* ======================================================================= */
+/* MAIN                                                                    */
+/* ======================================================================= */
+
+int wmain(int argc, wchar_t *argv[])
+{
+	const ULONG rounds = (argc > 1) ? wcstoul(argv[1U], NULL, 10) : DEFAULT_ROUNDS;
+	wchar_t tempPath[MAX_PATH], root[MAX_PATH], deep[MAX_PATH], link[MAX_PATH], loop[MAX_PATH], path[2U * MAX_PATH];
+	ULONG idx, count;
+	int result = EXIT_FAILURE;
+
+	setlocale(LC_ALL, "C");
+	if (!GetTempPathW(MAX_PATH, tempPath))
+	{
+		fwprintf(stderr, L"Failed to get the TEMP directory!\n");
+		return EXIT_FAILURE;
+	}
+	_snwprintf(root, MAX_PATH, L"%sCache_Test_%08lX", tempPath, GetCurrentProcessId());
+	root[MAX_PATH - 1U] = L'\0';
+	link[0U] = loop[0U] = L'\0';
+
+	//Build the tree, with a junction into the depth and a junction that loops back to the root
+	if (!createTree(root, 0U))
+	{
+		fwprintf(stderr, L"Failed to create the test tree in \"%s\"!\n", root);
+		goto cleanup;
+	}
+	_snwprintf(deep, MAX_PATH, L"%s\\DirB\\DirA\\DirB\\DirA", root);
+	_snwprintf(link, MAX_PATH, L"%s\\Junction", root);
+	if (!createJunction(link, deep))
+	{
+		fwprintf(stderr, L"Failed to create the junction \"%s\"!\n", link);
+		goto cleanup;
+	}
+	_snwprintf(loop, MAX_PATH, L"%s\\DirA\\DirA\\Loop", root);
+	if (!createJunction(loop, root))
+	{
+		fwprintf(stderr, L"Failed to create the loop \"%s\"!\n", loop);
+		goto cleanup;
+	}
+
+	//Paths through the junction, through the loop (several times), and paths that do not exist
+	for (count = testPathCount, idx = 1U; idx < count; ++idx)
+	{
+		if (!_wcsnicmp(testPaths[idx], deep, wcslen(deep)))
+		{
+			_snwprintf(path, 2U * MAX_PATH, L"%s%s", link, testPaths[idx] + wcslen(deep));
+			path[(2U * MAX_PATH) - 1U] = L'\0';
+			addPath(path);
+		}
+		if (!(idx % 7U))
+		{
+			_snwprintf(path, 2U * MAX_PATH, L"%s\\DirA\\DirA\\Loop%s", loop, testPaths[idx] + wcslen(root));
+			path[(2U * MAX_PATH) - 1U] = L'\0';
+			addPath(path);
+		}
+		if (!(idx % 11U))
+		{
+			_snwprintf(path, 2U * MAX_PATH, L"%s\\Missing\\Name.txt", testPaths[idx]);
+			path[(2U * MAX_PATH) - 1U] = L'\0';
+			addPath(path);
+		}
+	}
+
+	compareResults(rounds ? rounds : 1U);
+	result = testSummary(L"cache_test");
+
+cleanup:
+	if (link[0U])
+	{
+		RemoveDirectoryW(link); /*removes the junction itself, not the target*/
+	}
+	if (loop[0U])
+	{
+		RemoveDirectoryW(loop);
+	}
+	removeTree(root);
+	for (idx = 0U; idx < testPathCount; ++idx)
+	{
+		FREE(testPaths[idx]);
+	}
+	return result;
+}
@@ -0,0 +1,125 @@
+# ---------------------------------------------------------------------------
+# notifywait hot directory benchmark
+#
+# Watches many files in a single directory and then touches *other* files in
+# the same directory, so that every change notification has to be filtered,
+# before one of the watched files is finally modified. For each given build
+# of notifywait, the CPU time spent during the burst and the latency from the
+# final modification to the report are measured.
+#
+# Pass the build before and the build after the per-event filtering, to
+# compare them. Builds before that change accept at most 32 files, so use
+# "-Files 32" when one of those is included.
+#
+# Usage: powershell -ExecutionPolicy Bypass -File hot_directory.ps1 <notifywait.exe> [<notifywait.exe> ...] [-Files <n>] [-Touches <n>] [-Rounds <n>]
+# ---------------------------------------------------------------------------
+
+param(
+	[Parameter(Mandatory = $true)][string[]]$NotifyWait,
+	[int]$Files = 4000,
+	[int]$Touches = 5000,
+	[int]$Rounds = 3,
+	[int]$SettleTime = 2000
+)
+
+$ErrorActionPreference = "Stop"
+$failed = 0
+$results = @()
+
+foreach ($exe in $NotifyWait)
+{
+	$cpuTotal = 0.0
+	$latencyTotal = 0.0
+	$burstTotal = 0.0
+
+	for ($round = 1; $round -le $Rounds; ++$round)
+	{
+		$dir = Join-Path ([IO.Path]::GetTempPath()) ("notifywait_hot_" + [Guid]::NewGuid().ToString("N"))
+		New-Item -ItemType Directory -Path $dir | Out-Null
+
+		# Watched files have short names, to stay within the 32K command line
+		$names = New-Object Collections.Generic.List[string]
+		for ($i = 1; $i -le $Files; ++$i)
+		{
+			[IO.File]::WriteAllText((Join-Path $dir "$i"), "w")
+			$names.Add("$i")
+		}
+		$noise = @()
+		for ($i = 0; $i -lt 256; ++$i)
+		{
+			$noise += Join-Path $dir ("noise_{0}.tmp" -f $i)
+			[IO.File]::WriteAllText($noise[$i], "n")
+		}
+		$target = Join-Path $dir "1"
+
+		# Start watching (in the directory itself, relative names keep the command line short)
+		$psi = New-Object Diagnostics.ProcessStartInfo
+		$psi.FileName = $exe
+		$psi.Arguments = "--clear " + ($names -join " ")
+		$psi.WorkingDirectory = $dir
+		$psi.UseShellExecute = $false
+		$psi.RedirectStandardOutput = $true
+		$psi.RedirectStandardError = $true
+		$proc = [Diagnostics.Process]::Start($psi)
+		$stdout = $proc.StandardOutput.ReadToEndAsync()
+		$stderr = $proc.StandardError.ReadToEndAsync()
+		Start-Sleep -Milliseconds $SettleTime
+		$proc.Refresh()
+		$cpuBefore = $proc.TotalProcessorTime.TotalMilliseconds
+
+		# Touch the unwatched files, then modify a watched one
+		$watch = [Diagnostics.Stopwatch]::StartNew()
+		for ($i = 0; $i -lt $Touches; ++$i)
+		{
+			[IO.File]::AppendAllText($noise[$i % 256], "x")
+		}
+		$burst = $watch.Elapsed.TotalMilliseconds
+		[IO.File]::AppendAllText($target, "changed")
+
+		$exited = $proc.WaitForExit(60000)
+		$latency = $watch.Elapsed.TotalMilliseconds - $burst
+		if (-not $exited)
+		{
+			$proc.Kill()
+			$proc.WaitForExit()
+		}
+		$proc.Refresh()
+		$cpu = $proc.TotalProcessorTime.TotalMilliseconds - $cpuBefore
+
+		if ($exited -and ($proc.ExitCode -eq 0) -and ($stdout.Result -match "(?m)\\1\r?$"))
+		{
+			Write-Host ("{0} round {1}: burst {2,8:N1} ms, CPU {3,8:N1} ms, latency {4,8:N1} ms" -f (Split-Path -Leaf $exe), $round, $burst, $cpu, $latency)
+			$cpuTotal += $cpu
+			$latencyTotal += $latency
+			$burstTotal += $burst
+		}
+		else
+		{
+			Write-Host ("{0} round {1}: FAILED - the change was not reported (exit code: {2})" -f (Split-Path -Leaf $exe), $round, $proc.ExitCode)
+			Write-Host $stderr.Result
+			++$failed
+		}
+
+		Remove-Item -Recurse -Force $dir
+	}
+
+	$results += New-Object PSObject -Property @{ Build = $exe; CPU = $cpuTotal / $Rounds; Latency = $latencyTotal / $Rounds; Burst = $burstTotal / $Rounds }
+}
+
+Write-Host ""
+Write-Host ("{0} watched files, {1} touches of unwatched files per round, {2} round(s)" -f $Files, $Touches, $Rounds)
+foreach ($result in $results)
+{
+	Write-Host ("{0,-40} CPU {1,8:N1} ms, latency {2,8:N1} ms, burst {3,8:N1} ms" -f $result.Build, $result.CPU, $result.Latency, $result.Burst)
+}
+if ($results.Count -ge 2)
+{
+	Write-Host ("CPU time, first vs. last build: {0:N1}x" -f ($results[0].CPU / [Math]::Max($results[-1].CPU, 0.001)))
+}
+
+if ($failed -gt 0)
+{
+	Write-Host "$failed round(s) failed!"
+	exit 1
+}
+exit 0
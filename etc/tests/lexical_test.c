@@ -0,0 +1,254 @@
+/*
+ * Test and benchmark for getLexicalPath()
+ * Created by LoRd_MuldeR <mulder2@gmx.de>.
+ *
+ * This work is licensed under the CC0 1.0 Universal License.
+ * To view a copy of the license, visit:
+ * https://creativecommons.org/publicdomain/zero/1.0/legalcode
+ *
+ * Every input is resolved with the SSE2 separator search and with the scalar
+ * one, and the results must be identical. The inputs are random paths with
+ * drive, UNC, "\\?\" and "\\.\" roots, "." and ".." components, empty
+ * components and mixed separators, with component lengths around the 8
+ * character SSE2 block size. Afterwards, the throughput of both variants is
+ * measured in GB/s of input.
+ *
+ * Usage: lexical_test.exe [<iterations> [<seed>]]
+ */
+
+#include "test_common.h"
+
+#if !(defined(_M_IX86) || defined(_M_X64))
+#error This test requires an x86 or x64 build!
+#endif
+
+#define TEST_ITERATIONS 500000UL /*default number of random inputs*/
+#define BENCH_INPUTS 4096U /*number of distinct inputs in the benchmark*/
+#define BENCH_ROUNDS 200U /*number of passes over the inputs in the benchmark*/
+
+/* ======================================================================= */
+/* VARIANTS                                                                */
+/* ======================================================================= */
+
+static BOOL sse2Available = FALSE;
+
+static const wchar_t *lexicalPath(const wchar_t *const fileName, path_arena *const arena, const BOOL useSSE2)
+{
+	InterlockedExchange(&sse2Support, useSSE2 ? 1L : 0L);
+	return getLexicalPath(fileName, arena);
+}
+
+/* ======================================================================= */
+/* INPUT GENERATOR                                                         */
+/* ======================================================================= */
+
+static const wchar_t *const TEST_ROOTS[] =
+{
+	L"C:\\", L"c:/", L"D:\\",
+	L"\\\\server\\share\\", L"//server/share/", L"\\/Server0123456789\\Share_With_A_Long_Name/",
+	L"\\\\?\\C:\\", L"\\\\?\\c:/", L"//?/C:/",
+	L"\\\\?\\UNC\\server\\share\\", L"\\\\?\\unc/server/share/", L"\\\\.\\UNC\\server\\share\\",
+	L"\\\\.\\C:\\",
+	L"\\\\server\\", L"\\\\server", L"\\\\?\\UNC\\server",
+	L"\\", L"/", L"C:", L"",
+	NULL
+};
+
+static const wchar_t NAME_CHARS[] = L"abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_- .~";
+
+static void generatePath(wchar_t *const buffer, const size_t size, const BOOL absolute)
+{
+	const ULONG rootCount = (sizeof(TEST_ROOTS) / sizeof(TEST_ROOTS[0U])) - 1U;
+	const wchar_t *root;
+	ULONG components = testRandom(12U), idx, length;
+	size_t pos = 0U;
+
+	root = TEST_ROOTS[absolute ? testRandom(13U) : testRandom(rootCount)];
+	for (; *root && (pos < size - 1U); ++root)
+	{
+		buffer[pos++] = *root;
+	}
+
+	for (; components && (pos < size - 40U); --components)
+	{
+		switch (testRandom(8U))
+		{
+		case 0U:
+			buffer[pos++] = L'.';
+			break;
+		case 1U:
+			buffer[pos++] = L'.';
+			buffer[pos++] = L'.';
+			break;
+		case 2U:
+			break; /*empty component*/
+		default:
+			for (length = 1U + testRandom(testRandom(2U) ? 9U : 33U), idx = 0U; idx < length; ++idx)
+			{
+				buffer[pos++] = NAME_CHARS[testRandom((sizeof(NAME_CHARS) / sizeof(NAME_CHARS[0U])) - 1U)];
+			}
+		}
+		if ((components > 1U) || testRandom(2U))
+		{
+			buffer[pos++] = testRandom(2U) ? L'\\' : L'/';
+		}
+	}
+
+	buffer[pos] = L'\0';
+}
+
+/* ======================================================================= */
+/* TESTS                                                                   */
+/* ======================================================================= */
+
+static void testRandomPaths(const unsigned long iterations)
+{
+	wchar_t input[512U];
+	path_arena arena;
+	unsigned long iter;
+
+	arenaInit(&arena);
+	for (iter = 0UL; iter < iterations; ++iter)
+	{
+		const wchar_t *scalar, *simd;
+		generatePath(input, 512U, FALSE);
+		scalar = lexicalPath(input, &arena, FALSE);
+		simd = lexicalPath(input, &arena, TRUE);
+		testCheck((scalar == NULL) == (simd == NULL), L"SSE2 and scalar result differ in success", input);
+		if (scalar && simd)
+		{
+			testCheck(!wcscmp(scalar, simd), L"SSE2 and scalar result differ", input);
+		}
+		if (!(iter & 0x3FFUL))
+		{
+			arenaReset(&arena);
+		}
+	}
+	arenaFree(&arena);
+}
+
+static const struct
+{
+	const wchar_t *input, *expected;
+}
+FIXED_CASES[] =
+{
+	{ L"C:\\a\\b\\..\\c",                                     L"C:\\a\\c" },
+	{ L"c:/a/./b//c/",                                        L"C:\\a\\b\\c" },
+	{ L"C:\\..\\..\\x",                                       L"C:\\x" },
+	{ L"C:\\abcdefghijklmnop\\qrstuvwxyz0123456789\\..\\x",   L"C:\\abcdefghijklmnop\\x" },
+	{ L"C:\\a/b\\c/d\\e/f\\g/h\\i/j\\k/l\\..\\..\\m",         L"C:\\a\\b\\c\\d\\e\\f\\g\\h\\i\\j\\m" },
+	{ L"\\\\server\\share\\dir\\..\\x",                       L"\\\\server\\share\\x" },
+	{ L"//server/share/a/../../b",                            L"\\\\server\\share\\b" },
+	{ L"\\\\Server0123456789/Share0123456789\\a\\..\\b",      L"\\\\Server0123456789\\Share0123456789\\b" },
+	{ L"\\\\?\\C:\\a\\..\\b",                                 L"C:\\b" },
+	{ L"\\\\?\\UNC\\server\\share\\a\\..\\b",                 L"\\\\server\\share\\b" },
+	{ L"//?/unc/server/share/a/./b",                          L"\\\\?\\unc\\server\\share\\a\\b" },
+	{ NULL, NULL }
+};
+
+static void testFixedCases(void)
+{
+	path_arena arena;
+	size_t idx;
+	int variant;
+
+	arenaInit(&arena);
+	for (idx = 0U; FIXED_CASES[idx].input; ++idx)
+	{
+		for (variant = sse2Available ? 1 : 0; variant >= 0; --variant)
+		{
+			const wchar_t *const result = lexicalPath(FIXED_CASES[idx].input, &arena, (variant > 0));
+			testCheck(result && (!wcscmp(result, FIXED_CASES[idx].expected)), variant ? L"SSE2 fixed case" : L"scalar fixed case", FIXED_CASES[idx].input);
+		}
+	}
+	arenaFree(&arena);
+}
+
+/* ======================================================================= */
+/* BENCHMARK                                                               */
+/* ======================================================================= */
+
+static double benchmark(wchar_t **const inputs, const double bytes, const BOOL useSSE2)
+{
+	path_arena arena;
+	double start, elapsed;
+	ULONG round, idx;
+
+	arenaInit(&arena);
+	InterlockedExchange(&sse2Support, useSSE2 ? 1L : 0L);
+	start = testSeconds();
+	for (round = 0U; round < BENCH_ROUNDS; ++round)
+	{
+		for (idx = 0U; idx < BENCH_INPUTS; ++idx)
+		{
+			getLexicalPath(inputs[idx], &arena);
+		}
+		arenaReset(&arena);
+	}
+	elapsed = testSeconds() - start;
+	arenaFree(&arena);
+
+	return (bytes * BENCH_ROUNDS) / (elapsed * 1.0e9);
+}
+
+static void runBenchmark(void)
+{
+	static wchar_t *inputs[BENCH_INPUTS];
+	wchar_t buffer[512U];
+	double bytes = 0.0, scalar, simd;
+	ULONG idx;
+
+	for (idx = 0U; idx < BENCH_INPUTS; ++idx)
+	{
+		do
+		{
+			generatePath(buffer, 512U, TRUE);
+		}
+		while (wcslen(buffer) < 64U);
+		inputs[idx] = _wcsdup(buffer);
+		bytes += (double)(wcslen(buffer) * sizeof(wchar_t));
+	}
+
+	scalar = benchmark(inputs, bytes, FALSE);
+	fwprintf(stderr, L"Scalar : %6.3f GB/s\n", scalar);
+	if (sse2Available)
+	{
+		simd = benchmark(inputs, bytes, TRUE);
+		fwprintf(stderr, L"SSE2   : %6.3f GB/s (%.2fx)\n", simd, simd / scalar);
+	}
+
+	for (idx = 0U; idx < BENCH_INPUTS; ++idx)
+	{
+		FREE(inputs[idx]);
+	}
+}
+
+/* ======================================================================= */
+/* MAIN                                                                    */
+/* ======================================================================= */
+
+int wmain(int argc, wchar_t *argv[])
+{
+	const unsigned long iterations = (argc > 1) ? wcstoul(argv[1U], NULL, 10) : TEST_ITERATIONS;
+	testRandomSeed((argc > 2) ? _wcstoui64(argv[2U], NULL, 10) : 0ULL);
+	setlocale(LC_ALL, "C");
+
+	if (!(sse2Available = haveSSE2()))
+	{
+		fwprintf(stderr, L"Warning: SSE2 is not available, only the scalar variant is tested!\n");
+	}
+
+	testFixedCases();
+	if (sse2Available)
+	{
+		testRandomPaths(iterations);
+	}
+	if (testFailures)
+	{
+		return testSummary(L"lexical_test");
+	}
+
+	runBenchmark();
+	return testSummary(L"lexical_test");
+}
@@ -0,0 +1,216 @@
+/*
+ * Benchmark for the buffered UTF-8 output
+ * Created by LoRd_MuldeR <mulder2@gmx.de>.
+ *
+ * This work is licensed under the CC0 1.0 Universal License.
+ * To view a copy of the license, visit:
+ * https://creativecommons.org/publicdomain/zero/1.0/legalcode
+ *
+ * Writes path-like lines (with non-ASCII characters) to a file and to a pipe,
+ * and reports the throughput in lines per second:
+ *
+ *  - fwprintf:      fwprintf() on a stream in _O_U8TEXT mode (the former way)
+ *  - output, line:  outputLine() with OUTPUT_FLUSH_LINE
+ *  - output, block: outputLine() with OUTPUT_FLUSH_BLOCK
+ *
+ * The files written by all variants must be identical.
+ *
+ * Usage: output_test.exe [<lines>]
+ */
+
+#include "test_common.h"
+
+#define DEFAULT_LINES 1000000UL
+#define OUTPUT_SIZE 65536U
+
+/* ======================================================================= */
+/* INPUT                                                                   */
+/* ======================================================================= */
+
+static void makeLine(wchar_t *const buffer, const unsigned long index)
+{
+	_snwprintf(buffer, 128U, L"C:\\Users\\J\x00F6rg\\Documents\\\x20AC_Reports\\%04lu\\report_%07lu.txt", index % 1000UL, index);
+	buffer[127U] = L'\0';
+}
+
+/* ======================================================================= */
+/* PIPE READER                                                             */
+/* ======================================================================= */
+
+static DWORD WINAPI pipeReader(LPVOID param)
+{
+	static char buffer[65536U];
+	DWORD count;
+	while (ReadFile((HANDLE)param, buffer, sizeof(buffer), &count, NULL) && (count > 0U));
+	return 0U;
+}
+
+/* ======================================================================= */
+/* VARIANTS                                                                */
+/* ======================================================================= */
+
+typedef enum
+{
+	VARIANT_FWPRINTF,
+	VARIANT_LINE,
+	VARIANT_BLOCK
+}
+variant_t;
+
+static const wchar_t *const VARIANT_NAMES[] = { L"fwprintf", L"output, line", L"output, block" };
+
+/* takes ownership of the handle */
+static double writeLines(const variant_t variant, const HANDLE handle, const unsigned long lines)
+{
+	wchar_t line[128U];
+	unsigned long idx;
+	double start, elapsed = -1.0;
+
+	if (variant == VARIANT_FWPRINTF)
+	{
+		const int fd = _open_osfhandle((intptr_t)handle, _O_WRONLY);
+		FILE *const stream = (fd >= 0) ? _fdopen(fd, "w") : NULL;
+		if (!stream)
+		{
+			CloseHandle(handle);
+			return -1.0;
+		}
+		_setmode(_fileno(stream), _O_U8TEXT);
+		start = testSeconds();
+		for (idx = 0UL; idx < lines; ++idx)
+		{
+			makeLine(line, idx);
+			fwprintf(stream, L"%s\n", line);
+		}
+		fflush(stream);
+		elapsed = testSeconds() - start;
+		fclose(stream);
+	}
+	else
+	{
+		output_buffer output;
+		if (outputOpen(&output, handle, OUTPUT_SIZE))
+		{
+			output.flushMode = (variant == VARIANT_LINE) ? OUTPUT_FLUSH_LINE : OUTPUT_FLUSH_BLOCK;
+			start = testSeconds();
+			for (idx = 0UL; idx < lines; ++idx)
+			{
+				makeLine(line, idx);
+				if (!outputLine(&output, line))
+				{
+					break;
+				}
+			}
+			outputFlush(&output);
+			elapsed = testSeconds() - start;
+			testCheck(!output.failed, L"Output has failed", VARIANT_NAMES[variant]);
+		}
+		outputClose(&output);
+		CloseHandle(handle);
+	}
+
+	return elapsed;
+}
+
+static double writeFile(const variant_t variant, const wchar_t *const path, const unsigned long lines)
+{
+	const HANDLE handle = CreateFileW(path, GENERIC_WRITE, 0U, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (handle == INVALID_HANDLE_VALUE)
+	{
+		return -1.0;
+	}
+	return writeLines(variant, handle, lines);
+}
+
+static double writePipe(const variant_t variant, const unsigned long lines)
+{
+	HANDLE readHandle, writeHandle, thread;
+	double elapsed;
+
+	if (!CreatePipe(&readHandle, &writeHandle, NULL, 65536U))
+	{
+		return -1.0;
+	}
+	if (!(thread = CreateThread(NULL, 0U, pipeReader, readHandle, 0U, NULL)))
+	{
+		CloseHandle(readHandle);
+		CloseHandle(writeHandle);
+		return -1.0;
+	}
+	elapsed = writeLines(variant, writeHandle, lines);
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+	CloseHandle(readHandle);
+	return elapsed;
+}
+
+static BOOL sameContent(const wchar_t *const pathA, const wchar_t *const pathB)
+{
+	static char bufferA[65536U], bufferB[65536U];
+	FILE *const fileA = _wfopen(pathA, L"rb"), *const fileB = _wfopen(pathB, L"rb");
+	size_t countA, countB;
+	BOOL same = (fileA != NULL) && (fileB != NULL);
+
+	while (same)
+	{
+		countA = fread(bufferA, 1U, sizeof(bufferA), fileA);
+		countB = fread(bufferB, 1U, sizeof(bufferB), fileB);
+		same = (countA == countB) && (!memcmp(bufferA, bufferB, countA));
+		if (countA < 1U)
+		{
+			break;
+		}
+	}
+
+	if (fileA)
+	{
+		fclose(fileA);
+	}
+	if (fileB)
+	{
+		fclose(fileB);
+	}
+	return same;
+}
+
+/* ======================================================================= */
+/* MAIN                                                                    */
+/* ======================================================================= */
+
+int wmain(int argc, wchar_t *argv[])
+{
+	const unsigned long lines = (argc > 1) ? wcstoul(argv[1U], NULL, 10) : DEFAULT_LINES;
+	wchar_t tempPath[MAX_PATH], files[3U][MAX_PATH];
+	double elapsedFile, elapsedPipe;
+	int variant;
+
+	setlocale(LC_ALL, "C");
+	if ((lines < 1UL) || (!GetTempPathW(MAX_PATH, tempPath)))
+	{
+		fwprintf(stderr, L"Invalid number of lines, or failed to get the TEMP directory!\n");
+		return EXIT_FAILURE;
+	}
+
+	fwprintf(stderr, L"Writing %lu lines\n\n", lines);
+	for (variant = VARIANT_FWPRINTF; variant <= VARIANT_BLOCK; ++variant)
+	{
+		_snwprintf(files[variant], MAX_PATH, L"%sOutput_Test_%08lX_%d.txt", tempPath, GetCurrentProcessId(), variant);
+		files[variant][MAX_PATH - 1U] = L'\0';
+		elapsedFile = writeFile((variant_t)variant, files[variant], lines);
+		elapsedPipe = writePipe((variant_t)variant, lines);
+		if (testCheck((elapsedFile > 0.0) && (elapsedPipe > 0.0), L"Failed to write the lines", VARIANT_NAMES[variant]))
+		{
+			fwprintf(stderr, L"%-13s: file %10.0f lines/s, pipe %10.0f lines/s\n", VARIANT_NAMES[variant], lines / elapsedFile, lines / elapsedPipe);
+		}
+	}
+
+	testCheck(sameContent(files[VARIANT_FWPRINTF], files[VARIANT_LINE]), L"Line mode output differs from fwprintf()", files[VARIANT_LINE]);
+	testCheck(sameContent(files[VARIANT_FWPRINTF], files[VARIANT_BLOCK]), L"Block mode output differs from fwprintf()", files[VARIANT_BLOCK]);
+	for (variant = VARIANT_FWPRINTF; variant <= VARIANT_BLOCK; ++variant)
+	{
+		DeleteFileW(files[variant]);
+	}
+
+	fwprintf(stderr, L"\n");
+	return testSummary(L"output_test");
+}
@@ -0,0 +1,106 @@
+# ---------------------------------------------------------------------------
+# notifywait overflow reproducer
+#
+# Floods a directory with changes, so that the (deliberately tiny) change
+# notification buffer overflows, and atomically replaces a watched file by
+# a file with the *same* size and last write time in the middle of it. The
+# replacement must still be reported, via the resync after the overflow.
+#
+# A round only counts, if the overflow actually happened. Rounds without an
+# overflow are retried (up to <retries> times), then counted as failed.
+#
+# Usage: powershell -ExecutionPolicy Bypass -File overflow_replace.ps1 <path\to\notifywait.exe> [<rounds>] [<retries>]
+# ---------------------------------------------------------------------------
+
+param(
+	[Parameter(Mandatory = $true)][string]$NotifyWait,
+	[int]$Rounds = 10,
+	[int]$Retries = 5
+)
+
+$ErrorActionPreference = "Stop"
+$failed = 0
+$attempt = 0
+
+for ($round = 1; $round -le $Rounds; ++$round)
+{
+	$dir = Join-Path ([IO.Path]::GetTempPath()) ("notifywait_overflow_" + [Guid]::NewGuid().ToString("N"))
+	New-Item -ItemType Directory -Path $dir | Out-Null
+	$target = Join-Path $dir "target.txt"
+	$replacement = Join-Path $dir "replacement.tmp"
+	Set-Content -Path $target -Value "AAAAAAAA" -NoNewline
+	Set-Content -Path $replacement -Value "BBBBBBBB" -NoNewline
+	(Get-Item $replacement).LastWriteTimeUtc = (Get-Item $target).LastWriteTimeUtc
+	(Get-Item $replacement).Attributes = "Normal" # the "archive" bit must not give the change away
+
+	# Start watching, with the smallest possible buffer
+	$env:NOTIFYWAIT_BUFFER_SIZE = "4"
+	$psi = New-Object Diagnostics.ProcessStartInfo
+	$psi.FileName = $NotifyWait
+	$psi.Arguments = "--clear --debug `"$target`""
+	$psi.UseShellExecute = $false
+	$psi.RedirectStandardOutput = $true
+	$psi.RedirectStandardError = $true
+	$proc = [Diagnostics.Process]::Start($psi)
+	$stderr = $proc.StandardError.ReadToEndAsync()
+	Start-Sleep -Milliseconds 500
+
+	# Flood the directory, then replace the target in the middle of the burst
+	for ($i = 0; $i -lt 20000; ++$i)
+	{
+		[IO.File]::WriteAllText((Join-Path $dir ("flood_{0}.tmp" -f $i)), "x")
+		if ($i -eq 10000)
+		{
+			Move-Item -Force -Path $replacement -Destination $target
+		}
+	}
+
+	# The change must be reported
+	$exited = $proc.WaitForExit(10000)
+	if (-not $exited)
+	{
+		$proc.Kill()
+		$proc.WaitForExit()
+	}
+	$stdout = $proc.StandardOutput.ReadToEnd()
+	$overflow = ($stderr.Result -match "overflows: [1-9]")
+	$reported = ($exited -and ($proc.ExitCode -eq 0) -and ($stdout -match "target\.txt"))
+	Remove-Item -Recurse -Force $dir
+
+	# Without an overflow, the round did not test anything
+	if (-not $overflow)
+	{
+		if (++$attempt -le $Retries)
+		{
+			Write-Host ("Round {0}: no overflow, retrying ({1}/{2})" -f $round, $attempt, $Retries)
+			--$round
+		}
+		else
+		{
+			Write-Host ("Round {0}: FAILED - the buffer did not overflow" -f $round)
+			++$failed
+			$attempt = 0
+		}
+		continue
+	}
+	$attempt = 0
+
+	if ($reported)
+	{
+		Write-Host ("Round {0}: OK" -f $round)
+	}
+	else
+	{
+		Write-Host ("Round {0}: FAILED - change was lost after the overflow" -f $round)
+		++$failed
+	}
+}
+
+if ($failed -gt 0)
+{
+	Write-Host "$failed of $Rounds round(s) failed!"
+	exit 1
+}
+
+Write-Host "All $Rounds round(s) passed."
+exit 0
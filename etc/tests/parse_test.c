@@ -0,0 +1,345 @@
+/*
+ * Property test and microbenchmark for parseULong() and parseDuration()
+ * Created by LoRd_MuldeR <mulder2@gmx.de>.
+ *
+ * This work is licensed under the CC0 1.0 Universal License.
+ * To view a copy of the license, visit:
+ * https://creativecommons.org/publicdomain/zero/1.0/legalcode
+ *
+ * Usage: parse_test.exe [<iterations> [<seed>]]
+ */
+
+#include "test_common.h"
+#include <ctype.h>
+
+#define TEST_ITERATIONS 2000000UL /*default number of random inputs*/
+#define BENCH_INPUTS 1024U /*number of distinct inputs in the benchmark*/
+#define BENCH_ROUNDS 2000U /*number of passes over the inputs in the benchmark*/
+
+/* ======================================================================= */
+/* REFERENCE IMPLEMENTATION                                                */
+/* ======================================================================= */
+
+/* the swscanf() based parser, as it was before the hand-written one */
+static int parseULongSwscanf(const wchar_t *str, ULONG *const out)
+{
+	unsigned long long value;
+	char c;
+	while(isspace(*str))
+	{
+		str++;
+	}
+	if(swscanf(str, _wcsnicmp(str, L"0x", 2) ? L"%I64u %c" : L"%I64x %c", &value, &c) != 1)
+	{
+		return EINVAL;
+	}
+	if(value > ULONG_MAX)
+	{
+		return ERANGE;
+	}
+	*out = (unsigned long) value;
+	return 0;
+}
+
+/* ======================================================================= */
+/* INPUT GENERATORS                                                        */
+/* ======================================================================= */
+
+static const wchar_t DIGITS_LOWER[] = L"0123456789abcdef";
+static const wchar_t DIGITS_UPPER[] = L"0123456789ABCDEF";
+
+static wchar_t *appendSpaces(wchar_t *pos)
+{
+	ULONG count = testRandom(4U) ? 0U : (1U + testRandom(2U));
+	while (count--)
+	{
+		*pos++ = testRandom(2U) ? L' ' : L'\t';
+	}
+	return pos;
+}
+
+static wchar_t *appendDigits(wchar_t *pos, const ULONG base, const ULONG count)
+{
+	const wchar_t *const digits = testRandom(2U) ? DIGITS_LOWER : DIGITS_UPPER;
+	ULONG idx;
+	for (idx = 0U; idx < count; ++idx)
+	{
+		*pos++ = digits[((!idx) && (count > 1U)) ? (1U + testRandom(base - 1U)) : testRandom(base)];
+	}
+	return pos;
+}
+
+/*
+ * Random plain number, including malformed ones. The magnitude never exceeds 64 bits, because
+ * swscanf() silently wraps around in that case. The inputs on which the hand-written parser
+ * deliberately differs (leading minus, bare "0x", "+0x") are not generated, they are covered
+ * by the fixed cases below.
+ */
+static void generateNumber(wchar_t *const buffer)
+{
+	static const wchar_t GARBAGE[] = L"g.-+z";
+	const BOOL hex = !testRandom(4U);
+	ULONG zeros = testRandom(4U) ? 0U : (1U + testRandom(3U));
+	ULONG digits = hex ? testRandom(17U) : testRandom(20U);
+	wchar_t *pos = appendSpaces(buffer);
+
+	if ((!hex) && (!testRandom(8U)))
+	{
+		*pos++ = L'+';
+	}
+	if (hex)
+	{
+		*pos++ = L'0';
+		*pos++ = testRandom(2U) ? L'x' : L'X';
+		if (!(zeros + digits))
+		{
+			digits = 1U; /*a bare "0x" is not comparable*/
+		}
+	}
+	while (zeros--)
+	{
+		*pos++ = L'0';
+	}
+	pos = appendDigits(pos, hex ? 16U : 10U, digits);
+	switch (testRandom(8U))
+	{
+	case 0U:
+		*pos++ = GARBAGE[testRandom(5U)];
+		break;
+	case 1U:
+		*pos++ = L' ';
+		*pos++ = DIGITS_LOWER[1U + testRandom(9U)];
+		break;
+	}
+	pos = appendSpaces(pos);
+	*pos = L'\0';
+}
+
+static const struct
+{
+	const wchar_t *suffix;
+	unsigned long long scale;
+}
+TEST_UNITS[] =
+{
+	{ L"h",  3600000000ULL },
+	{ L"m",  60000000ULL },
+	{ L"s",  1000000ULL },
+	{ L"ms", 1000ULL },
+	{ L"us", 1ULL }
+};
+
+/* random duration with units, the expected result is computed alongside */
+static int generateDuration(wchar_t *const buffer, ULONG *const expected)
+{
+	unsigned long long total = 0ULL;
+	BOOL overflow = FALSE;
+	ULONG unit = testRandom(5U), components = 1U + testRandom(4U);
+	wchar_t *pos = appendSpaces(buffer);
+
+	for (; components && (unit < 5U); --components, unit += 1U + testRandom(2U))
+	{
+		const unsigned long long scale = TEST_UNITS[unit].scale;
+		const unsigned long long value = testRandom(16U) ? testRandom(testRandom(2U) ? 100U : 10000000U) : ((((unsigned long long)testRandom(0U)) << 16) | testRandom(0x10000U));
+		unsigned long long part, fraction = 0ULL, divisor = 1ULL;
+		const wchar_t *suffix;
+
+		pos += _snwprintf(pos, 24U, L"%I64u", value);
+		if (!testRandom(3U))
+		{
+			const ULONG fractionDigits = 1U + testRandom(6U); /*at most 6 digits, so that the expected value is exact*/
+			ULONG idx;
+			*pos++ = L'.';
+			for (idx = 0U; idx < fractionDigits; ++idx)
+			{
+				const ULONG digit = testRandom(10U);
+				*pos++ = DIGITS_LOWER[digit];
+				fraction = (fraction * 10U) + digit;
+				divisor *= 10U;
+			}
+		}
+		for (suffix = TEST_UNITS[unit].suffix; *suffix; ++suffix)
+		{
+			*pos++ = testRandom(4U) ? *suffix : towupper(*suffix);
+		}
+		if (overflow || (value > (DURATION_LIMIT / scale)))
+		{
+			overflow = TRUE;
+			continue;
+		}
+		part = (value * scale) + ((fraction * scale) / divisor);
+		if (part > (DURATION_LIMIT - total))
+		{
+			overflow = TRUE;
+			continue;
+		}
+		total += part;
+	}
+
+	pos = appendSpaces(pos);
+	*pos = L'\0';
+	*expected = (ULONG)(total / 1000U);
+	return overflow ? ERANGE : 0;
+}
+
+/* ======================================================================= */
+/* PROPERTY TESTS                                                          */
+/* ======================================================================= */
+
+#define SENTINEL 0xDEADBEEFUL
+
+static void testPlainNumbers(const unsigned long iterations)
+{
+	wchar_t input[96U];
+	unsigned long iter;
+
+	for (iter = 0UL; iter < iterations; ++iter)
+	{
+		ULONG expected = SENTINEL, value = SENTINEL, duration = SENTINEL;
+		int expectedError, error, durationError;
+		generateNumber(input);
+		expectedError = parseULongSwscanf(input, &expected);
+		error = parseULong(input, &value);
+		durationError = parseDuration(input, &duration);
+		testCheck((error == expectedError) && (value == expected), L"parseULong() differs from swscanf()", input);
+		testCheck((durationError == expectedError) && (duration == expected), L"parseDuration() differs from swscanf() on a plain number", input);
+	}
+}
+
+static void testDurations(const unsigned long iterations)
+{
+	wchar_t input[160U];
+	unsigned long iter;
+
+	for (iter = 0UL; iter < iterations; ++iter)
+	{
+		ULONG expected = SENTINEL, value = SENTINEL;
+		int expectedError, error;
+		expectedError = generateDuration(input, &expected);
+		if (expectedError)
+		{
+			expected = SENTINEL;
+		}
+		error = parseDuration(input, &value);
+		testCheck((error == expectedError) && (value == expected), L"parseDuration() differs from the model", input);
+	}
+}
+
+static const struct
+{
+	const wchar_t *input;
+	BOOL duration;
+	int error;
+	ULONG value;
+}
+FIXED_CASES[] =
+{
+	{ L"-1",                          FALSE, EINVAL, SENTINEL },
+	{ L"0x",                          FALSE, EINVAL, SENTINEL },
+	{ L"+0x10",                       FALSE, 0,      16UL },
+	{ L"",                            FALSE, EINVAL, SENTINEL },
+	{ L" 7 ",                         FALSE, 0,      7UL },
+	{ L"4294967295",                  FALSE, 0,      ULONG_MAX },
+	{ L"4294967296",                  FALSE, ERANGE, SENTINEL },
+	{ L"0xFFFFFFFF",                  FALSE, 0,      ULONG_MAX },
+	{ L"0x100000000",                 FALSE, ERANGE, SENTINEL },
+	{ L"99999999999999999999999999",  FALSE, ERANGE, SENTINEL },
+	{ L"0x99999999999999999999999999",FALSE, ERANGE, SENTINEL },
+	{ L"-1",                          TRUE,  EINVAL, SENTINEL },
+	{ L"1m30s",                       TRUE,  0,      90000UL },
+	{ L"2.5s",                        TRUE,  0,      2500UL },
+	{ L"1500us",                      TRUE,  0,      1UL },
+	{ L"1.5",                         TRUE,  0,      1UL },
+	{ L"1193h2m47.295s",              TRUE,  0,      ULONG_MAX },
+	{ L"1193h2m47.296s",              TRUE,  ERANGE, SENTINEL },
+	{ L"4294967295ms",                TRUE,  0,      ULONG_MAX },
+	{ L"4294967296ms",                TRUE,  ERANGE, SENTINEL },
+	{ L"1s1m",                        TRUE,  EINVAL, SENTINEL },
+	{ L"1s1s",                        TRUE,  EINVAL, SENTINEL },
+	{ L"1s500",                       TRUE,  EINVAL, SENTINEL },
+	{ L"1s 500ms",                    TRUE,  EINVAL, SENTINEL },
+	{ L"1.s",                         TRUE,  EINVAL, SENTINEL },
+	{ L"s",                           TRUE,  EINVAL, SENTINEL },
+	{ L"0x10",                        TRUE,  0,      16UL },
+	{ NULL,                           FALSE, 0,      0UL }
+};
+
+static void testFixedCases(void)
+{
+	size_t idx;
+	for (idx = 0U; FIXED_CASES[idx].input; ++idx)
+	{
+		ULONG value = SENTINEL;
+		const int error = FIXED_CASES[idx].duration ? parseDuration(FIXED_CASES[idx].input, &value) : parseULong(FIXED_CASES[idx].input, &value);
+		testCheck((error == FIXED_CASES[idx].error) && (value == FIXED_CASES[idx].value), FIXED_CASES[idx].duration ? L"parseDuration() fixed case" : L"parseULong() fixed case", FIXED_CASES[idx].input);
+	}
+}
+
+/* ======================================================================= */
+/* MICROBENCHMARK                                                          */
+/* ======================================================================= */
+
+typedef int (*parse_function)(const wchar_t *str, ULONG *const out);
+
+static double benchmark(const parse_function function, wchar_t inputs[][32U])
+{
+	volatile ULONG sink = 0U;
+	double start;
+	ULONG round, idx, value;
+
+	start = testSeconds();
+	for (round = 0U; round < BENCH_ROUNDS; ++round)
+	{
+		for (idx = 0U; idx < BENCH_INPUTS; ++idx)
+		{
+			if (!function(inputs[idx], &value))
+			{
+				sink += value;
+			}
+		}
+	}
+	return ((testSeconds() - start) * 1.0e9) / (((double)BENCH_ROUNDS) * ((double)BENCH_INPUTS));
+}
+
+static void runBenchmark(void)
+{
+	static wchar_t inputs[BENCH_INPUTS][32U];
+	double timeOld, timeNew, timeDuration;
+	ULONG idx;
+
+	for (idx = 0U; idx < BENCH_INPUTS; ++idx)
+	{
+		const ULONG value = (idx & 1U) ? testRandom(0U) : testRandom(100000U);
+		_snwprintf(inputs[idx], 32U, (idx % 5U) ? L"%lu" : L"0x%lX", value);
+	}
+
+	timeOld = benchmark(parseULongSwscanf, inputs);
+	timeNew = benchmark(parseULong, inputs);
+	timeDuration = benchmark(parseDuration, inputs);
+
+	fwprintf(stderr, L"swscanf()       : %7.1f ns/call\n", timeOld);
+	fwprintf(stderr, L"parseULong()    : %7.1f ns/call (%.1fx)\n", timeNew, timeOld / timeNew);
+	fwprintf(stderr, L"parseDuration() : %7.1f ns/call (%.1fx)\n", timeDuration, timeOld / timeDuration);
+}
+
+/* ======================================================================= */
+/* MAIN                                                                    */
+/* ======================================================================= */
+
+int wmain(int argc, wchar_t *argv[])
+{
+	const unsigned long iterations = (argc > 1) ? wcstoul(argv[1U], NULL, 10) : TEST_ITERATIONS;
+	testRandomSeed((argc > 2) ? _wcstoui64(argv[2U], NULL, 10) : 0ULL);
+	setlocale(LC_ALL, "C");
+
+	testFixedCases();
+	testPlainNumbers(iterations);
+	testDurations(iterations);
+	if (testFailures)
+	{
+		return testSummary(L"parse_test");
+	}
+
+	runBenchmark();
+	return testSummary(L"parse_test");
+}
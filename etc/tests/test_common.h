@@ -0,0 +1,75 @@
+/*
+ * Test helpers
+ * Created by LoRd_MuldeR <mulder2@gmx.de>.
+ *
+ * This work is licensed under the CC0 1.0 Universal License.
+ * To view a copy of the license, visit:
+ * https://creativecommons.org/publicdomain/zero/1.0/legalcode
+ */
+
+#pragma once
+
+/* the tests are built against the sources, so that they can reach the static functions */
+#include "../../src/common.c"
+
+/* ======================================================================= */
+/* CHECKS                                                                  */
+/* ======================================================================= */
+
+static unsigned long testChecks = 0UL, testFailures = 0UL;
+
+static BOOL testCheck(const BOOL condition, const wchar_t *const what, const wchar_t *const input)
+{
+	++testChecks;
+	if (!condition)
+	{
+		if (++testFailures <= 25UL)
+		{
+			fwprintf(stderr, L"FAILED: %s [input: \"%s\"]\n", what, input ? input : L"(null)");
+		}
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static int testSummary(const wchar_t *const name)
+{
+	if (testFailures)
+	{
+		fwprintf(stderr, L"%s: %lu of %lu check(s) failed!\n", name, testFailures, testChecks);
+		return EXIT_FAILURE;
+	}
+	fwprintf(stderr, L"%s: All %lu check(s) passed.\n", name, testChecks);
+	return EXIT_SUCCESS;
+}
+
+/* ======================================================================= */
+/* RANDOM NUMBERS                                                          */
+/* ======================================================================= */
+
+static unsigned long long testRandomState = 0x9E3779B97F4A7C15ULL;
+
+static void testRandomSeed(const unsigned long long seed)
+{
+	testRandomState = seed ? seed : 0x9E3779B97F4A7C15ULL;
+}
+
+static ULONG testRandom(const ULONG range)
+{
+	testRandomState ^= testRandomState << 13;
+	testRandomState ^= testRandomState >> 7;
+	testRandomState ^= testRandomState << 17;
+	return range ? ((ULONG)(testRandomState >> 32) % range) : ((ULONG)(testRandomState >> 32));
+}
+
+/* ======================================================================= */
+/* TIMING                                                                  */
+/* ======================================================================= */
+
+static double testSeconds(void)
+{
+	LARGE_INTEGER counter, frequency;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+	return ((double)counter.QuadPart) / ((double)frequency.QuadPart);
+}
@@ -0,0 +1,43 @@
+@echo off
+setlocal enabledelayedexpansion
+
+REM -------------------------------------------------------------------------
+REM BUILD AND RUN THE C TESTS
+REM Run this from a Visual Studio command prompt, so that "cl" is available.
+REM The tests include the sources directly, there is nothing to link but
+REM the system libraries.
+REM -------------------------------------------------------------------------
+
+set "OUT_DIR=%~dp0bin"
+set "FAILED=0"
+
+where cl >nul 2>&1 || (
+	echo Compiler "cl" not found, please run from a Visual Studio command prompt^^!
+	exit /b 1
+)
+
+if not exist "%OUT_DIR%" mkdir "%OUT_DIR%"
+
+for %%f in ("%~dp0*_test.c") do (
+	echo ----------------------------------------------------------------------
+	echo %%~nf
+	echo ----------------------------------------------------------------------
+	cl /nologo /O2 /W3 /MT /DUNICODE /D_UNICODE /Fo"%OUT_DIR%\\" /Fe"%OUT_DIR%\%%~nf.exe" "%%~f" Shlwapi.lib >"%OUT_DIR%\%%~nf.log" 2>&1
+	if errorlevel 1 (
+		type "%OUT_DIR%\%%~nf.log"
+		echo Build failed^^!
+		set /a FAILED+=1
+	) else (
+		"%OUT_DIR%\%%~nf.exe"
+		if errorlevel 1 set /a FAILED+=1
+	)
+	echo.
+)
+
+if not "%FAILED%"=="0" (
+	echo %FAILED% test^(s^) failed^^!
+	exit /b 1
+)
+
+echo All tests passed.
+exit /b 0
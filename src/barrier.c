@@ -0,0 +1,410 @@
+/*
+ * barrier for Win32
+ * Created by LoRd_MuldeR <mulder2@gmx.de>.
+ * 
+ * This work is licensed under the CC0 1.0 Universal License.
+ * To view a copy of the license, visit:
+ * https://creativecommons.org/publicdomain/zero/1.0/legalcode
+ */
+
+#include "common.h"
+
+/* ======================================================================= */
+/* UTILITY FUNCTIONS                                                       */
+/* ======================================================================= */
+
+static BOOL __stdcall crtlHandler(DWORD dwCtrlTyp)
+{
+	return handleInterrupt(dwCtrlTyp, L"Barrier", 3); /*the main thread is signaled to clean up*/
+}
+
+/* ======================================================================= */
+/* HELPER MACROS AND TYPES                                                 */
+/* ======================================================================= */
+
+#define EXIT_TIMEOUT 2 /*exit code when timeout occrus*/
+#define EXIT_INTERRUPTED 3 /*exit code when interrupted by user*/
+
+#define MAXIMUM_PARTIES 1024U
+#define MAXIMUM_NAME 128U
+#define OBJECT_NAME_SIZE (MAXIMUM_NAME + 64U)
+
+#define TAG_RELEASE 0
+#define TAG_TIMEOUT 1
+#define TAG_INTERRUPT 2
+
+#define TRY_PARSE_OPTION(NAME) \
+	if (!_wcsicmp(argv[argOffset] + 2U, L#NAME)) \
+	{ \
+		opt_##NAME = TRUE; \
+		continue; \
+	}
+
+typedef struct
+{
+	DWORD pid;
+	FILETIME creationTime;
+}
+barrier_party;
+
+typedef struct
+{
+	DWORD count, arrived, generation;
+	barrier_party parties[MAXIMUM_PARTIES];
+}
+barrier_state;
+
+typedef struct
+{
+	const wchar_t *name;
+	HANDLE mutex, mapping, release;
+	barrier_state *state;
+}
+barrier_t;
+
+/* ======================================================================= */
+/* PROCESS IDENTITY                                                        */
+/* ======================================================================= */
+
+static BOOL getCreationTime(const HANDLE process, FILETIME *const creationTime)
+{
+	FILETIME timeExit, timeKernel, timeUser;
+	return GetProcessTimes(process, creationTime, &timeExit, &timeKernel, &timeUser);
+}
+
+static BOOL isPartyAlive(const barrier_party *const party)
+{
+	FILETIME creationTime;
+	BOOL alive = TRUE;
+
+	//A process that can not be opened, because it does not exist (anymore), has crashed or was killed
+	const HANDLE process = OpenProcess(SYNCHRONIZE | PROCESS_QUERY_INFORMATION, FALSE, party->pid);
+	if (!process)
+	{
+		return (GetLastError() != ERROR_INVALID_PARAMETER); /*access denied means that the process is still there*/
+	}
+
+	//The PID may have been re-used by another process, so the creation time has to match as well
+	if (WaitForSingleObject(process, 0U) == WAIT_OBJECT_0)
+	{
+		alive = FALSE;
+	}
+	else if (getCreationTime(process, &creationTime) && CompareFileTime(&creationTime, &party->creationTime))
+	{
+		alive = FALSE;
+	}
+
+	CloseHandle(process);
+	return alive;
+}
+
+/* ======================================================================= */
+/* BARRIER                                                                 */
+/* ======================================================================= */
+
+static BOOL barrierLock(barrier_t *const barrier)
+{
+	switch (WaitForSingleObject(barrier->mutex, INFINITE))
+	{
+	case WAIT_OBJECT_0:
+	case WAIT_ABANDONED:
+		return TRUE; /*an abandoned mutex is fine, stale parties are removed anyway*/
+	default:
+		return FALSE;
+	}
+}
+
+static void barrierUnlock(barrier_t *const barrier)
+{
+	ReleaseMutex(barrier->mutex);
+}
+
+static HANDLE barrierEvent(const barrier_t *const barrier, const DWORD generation)
+{
+	wchar_t objectName[OBJECT_NAME_SIZE];
+	_snwprintf(objectName, OBJECT_NAME_SIZE, L"Local\\MSleep.Barrier.%s.Release.%lu", barrier->name, generation);
+	objectName[OBJECT_NAME_SIZE - 1U] = L'\0';
+	return CreateEventW(NULL, TRUE, FALSE, objectName);
+}
+
+static BOOL barrierOpen(barrier_t *const barrier, const wchar_t *const name)
+{
+	wchar_t objectName[OBJECT_NAME_SIZE];
+
+	memset(barrier, 0, sizeof(barrier_t));
+	barrier->name = name;
+
+	//The mutex serializes all access to the shared state, including its initialization
+	_snwprintf(objectName, OBJECT_NAME_SIZE, L"Local\\MSleep.Barrier.%s.Mutex", name);
+	objectName[OBJECT_NAME_SIZE - 1U] = L'\0';
+	if (!(barrier->mutex = CreateMutexW(NULL, FALSE, objectName)))
+	{
+		return FALSE;
+	}
+
+	//A newly created mapping is initialized to zero, so a count of zero means "not initialized yet"
+	_snwprintf(objectName, OBJECT_NAME_SIZE, L"Local\\MSleep.Barrier.%s.State", name);
+	objectName[OBJECT_NAME_SIZE - 1U] = L'\0';
+	if (!(barrier->mapping = CreateFileMappingW(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0U, sizeof(barrier_state), objectName)))
+	{
+		return FALSE;
+	}
+	if (!(barrier->state = (barrier_state*) MapViewOfFile(barrier->mapping, FILE_MAP_ALL_ACCESS, 0U, 0U, sizeof(barrier_state))))
+	{
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static void barrierClose(barrier_t *const barrier)
+{
+	if (barrier->state)
+	{
+		UnmapViewOfFile(barrier->state);
+	}
+	CLOSE_HANDLE(barrier->release);
+	CLOSE_HANDLE(barrier->mapping);
+	CLOSE_HANDLE(barrier->mutex);
+}
+
+static DWORD barrierCleanup(barrier_state *const state)
+{
+	DWORD idx = 0U, removed = 0U;
+
+	//Remove the parties whose processes have terminated without passing the barrier
+	while (idx < state->arrived)
+	{
+		if (isPartyAlive(&state->parties[idx]))
+		{
+			++idx;
+			continue;
+		}
+		state->parties[idx] = state->parties[--state->arrived];
+		++removed;
+	}
+
+	return removed;
+}
+
+static void barrierLeave(barrier_state *const state, const DWORD pid)
+{
+	DWORD idx;
+
+	for (idx = 0U; idx < state->arrived; ++idx)
+	{
+		if (state->parties[idx].pid == pid)
+		{
+			state->parties[idx] = state->parties[--state->arrived];
+			break;
+		}
+	}
+}
+
+/* ======================================================================= */
+/* MAIN                                                                    */
+/* ======================================================================= */
+
+int wmain(int argc, wchar_t *argv[])
+{
+	int result = EXIT_FAILURE, argOffset = 1, tag = REACTOR_FAILED;
+	BOOL opt_quiet = FALSE, locked = FALSE;
+	DWORD timeout = INFINITE, generation, removed;
+	ULONG count;
+	barrier_t barrier;
+	barrier_party self;
+	reactor_t reactor;
+
+	//Initialize
+	INITIALIZE_C_RUNTIME();
+	memset(&barrier, 0, sizeof(barrier_t));
+
+	//Check command-line arguments
+	if ((argc < 2) || (!_wcsicmp(argv[1U], L"/?")) || (!_wcsicmp(argv[1U], L"--help")))
+	{
+		fwprintf(stderr, L"barrier %s\n", PROGRAM_VERSION);
+		wprintln(stderr, L"Wait (sleep) until the specified number of processes have reached the barrier.\n");
+		wprintln(stderr, L"Usage:");
+		wprintln(stderr, L"   barrier.exe [options] <name> <count>\n");
+		wprintln(stderr, L"Options:");
+		wprintln(stderr, L"   --timeout <T>  exit as soon as the timeout has expired, in milliseconds (or with unit, e.g. 30s)");
+		wprintln(stderr, L"   --quiet        do *not* print any diagnostic messages; errors are shown anyway\n");
+		wprintln(stderr, L"Exit status:");
+		wprintln(stderr, L"   0 - All processes have reached the barrier");
+		wprintln(stderr, L"   1 - Failed with error");
+		wprintln(stderr, L"   2 - Aborted because the timeout has expired");
+		wprintln(stderr, L"   3 - Interrupted by user\n");
+		wprintln(stderr, L"Remarks:");
+		wprintln(stderr, L"   All processes must use the same name and count. The barrier can be re-used.");
+		wprintln(stderr, L"   Processes that have terminated without passing the barrier are no longer counted.\n");
+		return EXIT_FAILURE;
+	}
+
+	//Parse command-line options
+	for (; (argOffset < argc) && (!wcsncmp(argv[argOffset], L"--", 2)); ++argOffset)
+	{
+		if (!argv[argOffset][2U])
+		{
+			++argOffset;
+			break; /*stop option parsing*/
+		}
+		if (!_wcsicmp(argv[argOffset] + 2U, L"timeout"))
+		{
+			if ((++argOffset >= argc) || parseDuration(argv[argOffset], &timeout) || (timeout == INFINITE))
+			{
+				wprintln(stderr, L"Error: Option --timeout requires a valid timeout!\n");
+				return EXIT_FAILURE;
+			}
+			continue;
+		}
+		TRY_PARSE_OPTION(quiet)
+		fwprintf(stderr, L"Error: Unknown option \"%s\" encountered!\n\n", argv[argOffset]);
+		return EXIT_FAILURE;
+	}
+
+	//Check remaining arguments
+	if ((argc - argOffset) != 2)
+	{
+		wprintln(stderr, L"Error: Barrier name and count must be specified!\n");
+		return EXIT_FAILURE;
+	}
+	if ((!argv[argOffset][0U]) || (wcslen(argv[argOffset]) > MAXIMUM_NAME) || wcschr(argv[argOffset], L'\\'))
+	{
+		fwprintf(stderr, L"Error: Barrier name \"%s\" is invalid!\n\n", argv[argOffset]);
+		return EXIT_FAILURE;
+	}
+	if (parseULong(argv[argOffset + 1], &count) || (count < 1U) || (count > MAXIMUM_PARTIES))
+	{
+		fwprintf(stderr, L"Error: Count must be a number between 1 and %u!\n\n", MAXIMUM_PARTIES);
+		return EXIT_FAILURE;
+	}
+
+	//Identify this process
+	self.pid = GetCurrentProcessId();
+	if (!getCreationTime(GetCurrentProcess(), &self.creationTime))
+	{
+		wprintln(stderr, L"System Error: Failed to query the process creation time!\n");
+		return EXIT_FAILURE;
+	}
+
+	//Open or create the barrier
+	if (!barrierOpen(&barrier, argv[argOffset]))
+	{
+		fwprintf(stderr, L"System Error: Failed to open the barrier! [error: %lu]\n\n", GetLastError());
+		goto cleanup;
+	}
+	if (!(locked = barrierLock(&barrier)))
+	{
+		fwprintf(stderr, L"System Error: Failed to lock the barrier! [error: %lu]\n\n", GetLastError());
+		goto cleanup;
+	}
+
+	//Remove stale parties first
+	if (((removed = barrierCleanup(barrier.state)) > 0U) && (!opt_quiet))
+	{
+		fwprintf(stderr, L"Removed %lu stale process(es) from the barrier.\n", removed);
+	}
+
+	//Check the barrier count, which can only be changed while no process is waiting
+	if ((!barrier.state->count) || (!barrier.state->arrived))
+	{
+		barrier.state->count = count;
+	}
+	else if (barrier.state->count != count)
+	{
+		fwprintf(stderr, L"Error: Barrier \"%s\" is in use with a different count! [count: %lu]\n\n", barrier.name, barrier.state->count);
+		goto cleanup;
+	}
+
+	//Arrive at the barrier
+	generation = barrier.state->generation;
+	barrier.state->parties[barrier.state->arrived++] = self;
+
+	//The last arriving process releases all others
+	if (barrier.state->arrived >= barrier.state->count)
+	{
+		HANDLE release = barrierEvent(&barrier, generation);
+		barrier.state->arrived = 0U;
+		++barrier.state->generation;
+		if (!(release && SetEvent(release)))
+		{
+			fwprintf(stderr, L"System Error: Failed to release the barrier! [error: %lu]\n\n", GetLastError());
+			CLOSE_HANDLE(release);
+			goto cleanup;
+		}
+		CloseHandle(release);
+		result = EXIT_SUCCESS;
+		goto cleanup;
+	}
+
+	//Open the release event for the current generation, *before* the lock is released
+	if (!(barrier.release = barrierEvent(&barrier, generation)))
+	{
+		fwprintf(stderr, L"System Error: Failed to create event object! [error: %lu]\n\n", GetLastError());
+		barrierLeave(barrier.state, self.pid);
+		goto cleanup;
+	}
+	if (!opt_quiet)
+	{
+		fwprintf(stderr, L"Waiting at barrier \"%s\" [%lu/%lu]...\n", barrier.name, barrier.state->arrived, barrier.state->count);
+	}
+	barrierUnlock(&barrier);
+	locked = FALSE;
+
+	//Wait for the last process, the timeout or an interrupt
+	reactorInit(&reactor);
+	if (!(reactorAddHandle(&reactor, barrier.release, TAG_RELEASE) && reactorAddTimer(&reactor, timeout, TAG_TIMEOUT) && reactorAddInterrupt(&reactor, TAG_INTERRUPT)))
+	{
+		wprintln(stderr, L"System Error: Failed to set up the interrupt handler!\n");
+	}
+	else if ((tag = reactorWait(&reactor)) == REACTOR_FAILED)
+	{
+		fwprintf(stderr, L"System Error: Failed to wait for the barrier! [error: %lu]\n\n", GetLastError());
+	}
+
+	//Leave the barrier, unless it has been released in the meantime
+	if (tag != TAG_RELEASE)
+	{
+		if (!(locked = barrierLock(&barrier)))
+		{
+			fwprintf(stderr, L"System Error: Failed to lock the barrier! [error: %lu]\n\n", GetLastError());
+			goto cleanup;
+		}
+		if (barrier.state->generation != generation)
+		{
+			tag = TAG_RELEASE; /*the last process has arrived after all*/
+		}
+		else
+		{
+			barrierLeave(barrier.state, self.pid);
+		}
+	}
+
+	//Set the exit status
+	switch (tag)
+	{
+	case TAG_RELEASE:
+		result = EXIT_SUCCESS;
+		break;
+	case TAG_TIMEOUT:
+		if (!opt_quiet)
+		{
+			wprintln(stderr, L"Timeout has expired.\n");
+		}
+		result = EXIT_TIMEOUT;
+		break;
+	case TAG_INTERRUPT:
+		result = EXIT_INTERRUPTED;
+		break;
+	}
+
+	//Perform final clean-up
+cleanup:
+	if (locked)
+	{
+		barrierUnlock(&barrier);
+	}
+	barrierClose(&barrier);
+
+	return result; /*exit*/
+}
@@ -13,8 +13,13 @@
 
 #include <stdlib.h>
 #include <wchar.h>
+#include <limits.h>
 #include <Shlwapi.h>
 
+#if defined(_M_IX86) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
 /* ======================================================================= */
 /* PROGRAM VERSION                                                         */
 /* ======================================================================= */
@@ -28,23 +33,206 @@ const wchar_t *const PROGRAM_VERSION = WSTR(VER_MSLEEP_STR) L" [" WSTR(__DATE__)
 /* PARSE UNSIGNED LONG                                                     */
 /* ======================================================================= */
 
+#define IS_DIGIT(C) (((C) >= L'0') && ((C) <= L'9'))
+
+static __inline int getDigitValue(const wchar_t c)
+{
+	if (IS_DIGIT(c))
+	{
+		return c - L'0';
+	}
+	if ((c >= L'a') && (c <= L'f'))
+	{
+		return c - L'a' + 10;
+	}
+	if ((c >= L'A') && (c <= L'F'))
+	{
+		return c - L'A' + 10;
+	}
+	return -1;
+}
+
+/* consumes all digits, even if the value exceeds "limit" */
+static int parseDigits(const wchar_t **const str, const ULONG base, const unsigned long long limit, unsigned long long *const out)
+{
+	const wchar_t *pos = *str;
+	unsigned long long value = 0U;
+	BOOL overflow = FALSE;
+	int digit;
+
+	for (; ((digit = getDigitValue(*pos)) >= 0) && (((ULONG)digit) < base); ++pos)
+	{
+		if (value > ((limit - digit) / base))
+		{
+			overflow = TRUE;
+			continue;
+		}
+		value = (value * base) + digit;
+	}
+
+	if (pos == *str)
+	{
+		return EINVAL; /*no digits at all*/
+	}
+
+	*str = pos;
+	*out = value;
+	return overflow ? ERANGE : 0;
+}
+
 int parseULong(const wchar_t *str, ULONG *const out)
 {
-	unsigned long long value;
-	char c;
-	while(isspace(*str))
+	unsigned long long value = 0U;
+	int error;
+
+	while (iswspace(*str))
+	{
+		str++;
+	}
+	if (*str == L'+')
+	{
+		str++;
+	}
+	if ((str[0U] == L'0') && ((str[1U] == L'x') || (str[1U] == L'X')))
+	{
+		str += 2U;
+		error = parseDigits(&str, 16U, ULONG_MAX, &value);
+	}
+	else
+	{
+		error = parseDigits(&str, 10U, ULONG_MAX, &value);
+	}
+	while (iswspace(*str))
+	{
+		str++;
+	}
+
+	if (*str)
+	{
+		return EINVAL; /*trailing garbage*/
+	}
+	if (!error)
+	{
+		*out = (ULONG) value;
+	}
+	return error;
+}
+
+/* ======================================================================= */
+/* PARSE DURATION                                                          */
+/* ======================================================================= */
+
+#define DURATION_LIMIT ((((unsigned long long)ULONG_MAX) * 1000U) + 999U) /*in microseconds*/
+
+static const struct
+{
+	const wchar_t *suffix;
+	size_t length;
+	unsigned long long scale;
+}
+DURATION_UNITS[] =
+{
+	{ L"us", 2U, 1U },
+	{ L"ms", 2U, 1000U },
+	{ L"h",  1U, 3600000000U },
+	{ L"m",  1U, 60000000U },
+	{ L"s",  1U, 1000000U },
+	{ NULL,  0U, 0U }
+};
+
+int parseDuration(const wchar_t *str, ULONG *const out)
+{
+	unsigned long long total = 0U, value, part, scale, lastScale = 0U;
+	const wchar_t *fraction;
+	BOOL overflow = FALSE;
+	size_t idx;
+	int error;
+
+	while (iswspace(*str))
+	{
+		str++;
+	}
+	if (*str == L'+')
+	{
+		str++;
+	}
+
+	//Hexadecimal values are plain milliseconds
+	if ((str[0U] == L'0') && ((str[1U] == L'x') || (str[1U] == L'X')))
+	{
+		return parseULong(str, out);
+	}
+
+	//Sequence of "<number>[.<fraction>]<unit>" components, with strictly decreasing units
+	do
+	{
+		if ((error = parseDigits(&str, 10U, DURATION_LIMIT, &value)) == EINVAL)
+		{
+			return EINVAL;
+		}
+		overflow = overflow || (error == ERANGE);
+		fraction = NULL;
+		if (*str == L'.')
+		{
+			for (fraction = ++str; IS_DIGIT(*str); ++str);
+			if (str == fraction)
+			{
+				return EINVAL;
+			}
+		}
+		for (idx = 0U; DURATION_UNITS[idx].suffix && _wcsnicmp(str, DURATION_UNITS[idx].suffix, DURATION_UNITS[idx].length); ++idx);
+		if (DURATION_UNITS[idx].suffix)
+		{
+			scale = DURATION_UNITS[idx].scale;
+			str += DURATION_UNITS[idx].length;
+		}
+		else if ((!lastScale) && ((!(*str)) || iswspace(*str)))
+		{
+			scale = 1000U; /*plain number is in milliseconds*/
+		}
+		else
+		{
+			return EINVAL;
+		}
+		if (lastScale && (scale >= lastScale))
+		{
+			return EINVAL;
+		}
+		lastScale = scale;
+
+		//Accumulate in microseconds, fractions of a microsecond are ignored
+		if (value > (DURATION_LIMIT / scale))
+		{
+			overflow = TRUE;
+			continue;
+		}
+		for (part = value * scale; fraction && IS_DIGIT(*fraction) && (scale /= 10U); ++fraction)
+		{
+			part += (*fraction - L'0') * scale;
+		}
+		if (part > (DURATION_LIMIT - total))
+		{
+			overflow = TRUE;
+			continue;
+		}
+		total += part;
+	}
+	while (*str && (!iswspace(*str)));
+
+	while (iswspace(*str))
 	{
 		str++;
 	}
-	if(swscanf(str, _wcsnicmp(str, L"0x", 2) ? L"%I64u %c" : L"%I64x %c", &value, &c) != 1)
+
+	if (*str)
 	{
-		return EINVAL;
+		return EINVAL; /*trailing garbage*/
 	}
-	if(value > ULONG_MAX)
+	if (overflow)
 	{
 		return ERANGE;
 	}
-	*out = (unsigned long) value;
+	*out = (ULONG)(total / 1000U);
 	return 0;
 }
 
@@ -52,12 +240,94 @@ int parseULong(const wchar_t *str, ULONG *const out)
 /* STRING BUFFER HANDLING                                                  */
 /* ======================================================================= */
 
-static __inline BOOL resizeBuffer(wchar_t **const buffer, size_t *const size, const size_t requiredSize)
+#define ARENA_BLOCK_SIZE 32768U /*characters per arena block*/
+
+void arenaInit(path_arena *const arena)
+{
+	memset(arena, 0, sizeof(path_arena));
+}
+
+wchar_t *arenaAlloc(path_arena *const arena, const size_t length)
+{
+	const size_t aligned = (length + 3U) & (~((size_t)3U)); /*keep the strings aligned*/
+	path_arena_block *block = arena->blocks;
+	wchar_t *buffer;
+
+	//Allocate new block, if current block is exhausted
+	if ((!block) || ((block->used + aligned) > block->capacity))
+	{
+		const size_t capacity = (aligned > ARENA_BLOCK_SIZE) ? aligned : ARENA_BLOCK_SIZE;
+		if (!(block = (path_arena_block*) malloc(sizeof(path_arena_block) + (sizeof(wchar_t) * capacity))))
+		{
+			return NULL; /*allocation failed*/
+		}
+		block->next = arena->blocks;
+		block->capacity = capacity;
+		block->used = 0U;
+		arena->blocks = block;
+	}
+
+	buffer = block->data + block->used;
+	block->used += aligned;
+	return buffer;
+}
+
+wchar_t *arenaDup(path_arena *const arena, const wchar_t *const str)
+{
+	const size_t length = wcslen(str) + 1U;
+	wchar_t *const buffer = arena ? arenaAlloc(arena, length) : ((wchar_t*) malloc(sizeof(wchar_t) * length));
+	if (buffer)
+	{
+		wmemcpy(buffer, str, length);
+	}
+	return buffer;
+}
+
+void arenaReset(path_arena *const arena)
+{
+	path_arena_block *block = arena->blocks;
+
+	//Release all strings at once, but keep the most recent block for re-use
+	if (block)
+	{
+		path_arena_block *next = block->next;
+		while (next)
+		{
+			path_arena_block *const temp = next->next;
+			free(next);
+			next = temp;
+		}
+		block->next = NULL;
+		block->used = 0U;
+	}
+}
+
+void arenaFree(path_arena *const arena)
+{
+	arenaReset(arena);
+	FREE(arena->blocks);
+	arenaInit(arena);
+}
+
+void freePath(path_arena *const arena, const wchar_t *const path)
+{
+	if ((!arena) && path)
+	{
+		free((void*)path); /*arena strings are released in bulk*/
+	}
+}
+
+static __inline wchar_t *allocPath(path_arena *const arena, const size_t length)
+{
+	return arena ? arenaAlloc(arena, length) : ((wchar_t*) malloc(sizeof(wchar_t) * length));
+}
+
+static __inline BOOL resizeBuffer(path_arena *const arena, wchar_t **const buffer, size_t *const size, const size_t requiredSize)
 {
 	if((!(*buffer)) || (*size != requiredSize))
 	{
-		//Try to allocate new buffer
-		wchar_t *const bufferNext = (wchar_t*) realloc(*buffer, sizeof(wchar_t) * requiredSize);
+		//Try to allocate new buffer (the previous content is not preserved in the arena case)
+		wchar_t *const bufferNext = arena ? arenaAlloc(arena, requiredSize) : ((wchar_t*) realloc(*buffer, sizeof(wchar_t) * requiredSize));
 		if (!bufferNext)
 		{
 			return FALSE; /*allocation failed*/
@@ -70,6 +340,16 @@ static __inline BOOL resizeBuffer(wchar_t **const buffer, size_t *const size, co
 	return TRUE; /*success*/
 }
 
+static __inline ULONG hashPathKey(const wchar_t *key)
+{
+	ULONG hash = 2166136261UL;
+	for (; *key; ++key)
+	{
+		hash = (hash ^ ((ULONG)(((*key >= L'a') && (*key <= L'z')) ? (*key - 0x20) : towupper(*key)))) * 16777619UL;
+	}
+	return hash;
+}
+
 /* ======================================================================= */
 /* TIME FUNCTIONS                                                          */
 /* ======================================================================= */
@@ -100,24 +380,162 @@ unsigned long long getStartupTime(void)
 /* FILE ATTRIBUTES                                                         */
 /* ======================================================================= */
 
-DWORD getAttributes(const wchar_t *const filePath, unsigned long long *const timeStamp)
+#define NEGATIVE_CACHE_SIZE 64U
+
+static volatile DWORD attribRetryBudget = 28U;
+static volatile DWORD negativeCacheTime = 0U;
+
+static volatile LONG negativeCacheInit = 0L;
+static CRITICAL_SECTION negativeCacheLock;
+static struct
 {
-	DWORD loop;
-	WIN32_FILE_ATTRIBUTE_DATA attribs;
+	wchar_t *path;
+	DWORD error, expires;
+}
+negativeCache[NEGATIVE_CACHE_SIZE];
+
+void setAttributeOptions(const DWORD retryBudget, const DWORD cacheTime)
+{
+	attribRetryBudget = retryBudget;
+	negativeCacheTime = cacheTime;
+}
+
+static __inline BOOL isPermanentError(const DWORD error)
+{
+	switch (error)
+	{
+	case ERROR_FILE_NOT_FOUND:
+	case ERROR_PATH_NOT_FOUND:
+	case ERROR_INVALID_DRIVE:
+	case ERROR_INVALID_NAME:
+	case ERROR_BAD_PATHNAME:
+	case ERROR_BAD_NETPATH:
+	case ERROR_BAD_NET_NAME:
+	case ERROR_DIRECTORY:
+	case ERROR_FILENAME_EXCED_RANGE:
+	case ERROR_INVALID_PARAMETER:
+		return TRUE; /*retrying will not help*/
+	default:
+		return FALSE; /*e.g. sharing violation, lock violation or delete pending*/
+	}
+}
+
+static void negativeCacheEnter(void)
+{
+	LONG state = 0L;
+
+	//Initialize on first call
+	while ((state = InterlockedCompareExchange(&negativeCacheInit, -1L, 0L)) != 1L)
+	{
+		if(!state) /*first thread initializes*/
+		{
+			InitializeCriticalSection(&negativeCacheLock);
+			InterlockedExchange(&negativeCacheInit, 1L);
+		}
+		else
+		{
+			Sleep(0U); /*wait for initialized*/
+		}
+	}
 
-	for (loop = 0U; loop <= 7U; ++loop)
+	EnterCriticalSection(&negativeCacheLock);
+}
+
+static __inline void negativeCacheLeave(void)
+{
+	LeaveCriticalSection(&negativeCacheLock);
+}
+
+static BOOL negativeCacheFind(const wchar_t *const filePath, DWORD *const error)
+{
+	BOOL found = FALSE;
+	const ULONG idx = hashPathKey(filePath) & (NEGATIVE_CACHE_SIZE - 1U);
+
+	negativeCacheEnter();
+	if (negativeCache[idx].path && (!_wcsicmp(negativeCache[idx].path, filePath)))
+	{
+		if (((LONG)(negativeCache[idx].expires - GetTickCount())) > 0L)
+		{
+			*error = negativeCache[idx].error;
+			found = TRUE;
+		}
+		else
+		{
+			free(negativeCache[idx].path); /*expired*/
+			negativeCache[idx].path = NULL;
+		}
+	}
+	negativeCacheLeave();
+
+	return found;
+}
+
+static void negativeCacheStore(const wchar_t *const filePath, const DWORD error)
+{
+	const ULONG idx = hashPathKey(filePath) & (NEGATIVE_CACHE_SIZE - 1U);
+	wchar_t *const pathCopy = _wcsdup(filePath);
+
+	if (pathCopy)
+	{
+		negativeCacheEnter();
+		FREE(negativeCache[idx].path);
+		negativeCache[idx].path = pathCopy;
+		negativeCache[idx].error = error;
+		negativeCache[idx].expires = GetTickCount() + negativeCacheTime;
+		negativeCacheLeave();
+	}
+}
+
+void releaseAttributeCache(void)
+{
+	DWORD idx;
+
+	//Must not be called while other threads are still querying attributes
+	if (InterlockedCompareExchange(&negativeCacheInit, 0L, 1L) == 1L)
 	{
-		if (loop > 0U)
+		for (idx = 0U; idx < NEGATIVE_CACHE_SIZE; ++idx)
 		{
-			Sleep(loop);
+			FREE(negativeCache[idx].path);
+			negativeCache[idx].path = NULL;
 		}
-		if (GetFileAttributesExW(filePath, GetFileExInfoStandard, &attribs))
+		DeleteCriticalSection(&negativeCacheLock);
+	}
+}
+
+DWORD getAttributes(const wchar_t *const filePath, unsigned long long *const timeStamp)
+{
+	DWORD loop, error = ERROR_FILE_NOT_FOUND;
+	const DWORD startTime = GetTickCount(), cacheTime = negativeCacheTime;
+	WIN32_FILE_ATTRIBUTE_DATA attribs;
+
+	//Recently found missing?
+	if ((!cacheTime) || (!negativeCacheFind(filePath, &error)))
+	{
+		for (loop = 0U; ; ++loop)
 		{
-			if(timeStamp)
+			DWORD elapsed, delay;
+			if (GetFileAttributesExW(filePath, GetFileExInfoStandard, &attribs))
+			{
+				if(timeStamp)
+				{
+					*timeStamp = fileTimeToMSec(&attribs.ftLastWriteTime);
+				}
+				return attribs.dwFileAttributes;
+			}
+			if (isPermanentError(error = GetLastError()))
+			{
+				if (cacheTime)
+				{
+					negativeCacheStore(filePath, error);
+				}
+				break; /*fail fast*/
+			}
+			if ((elapsed = GetTickCount() - startTime) >= attribRetryBudget)
 			{
-				*timeStamp = fileTimeToMSec(&attribs.ftLastWriteTime);
+				break; /*retry budget exhausted*/
 			}
-			return attribs.dwFileAttributes;
+			delay = (loop < 8U) ? loop : 8U;
+			Sleep((delay < (attribRetryBudget - elapsed)) ? delay : (attribRetryBudget - elapsed));
 		}
 	}
 
@@ -126,6 +544,7 @@ DWORD getAttributes(const wchar_t *const filePath, unsigned long long *const tim
 		*timeStamp = 0ULL;
 	}
 
+	SetLastError(error);
 	return INVALID_FILE_ATTRIBUTES;
 }
 
@@ -143,11 +562,11 @@ BOOL clearAttribute(const wchar_t *const filePath, const DWORD mask)
 		{
 			return TRUE; /*attrib successfully cleared*/
 		}
-		else
+		if ((!SetFileAttributesW(filePath, attribs & (~mask))) && isPermanentError(GetLastError()))
 		{
-			SetFileAttributesW(filePath, attribs & (~mask));
-			Sleep(1); /*small delay!*/
+			break;
 		}
+		Sleep(1); /*small delay!*/
 	}
 
 	return FALSE;
@@ -209,12 +628,9 @@ static __inline void cleanFilePath(wchar_t *const buffer)
 	}
 }
 
-static const wchar_t* getFinalPathName(const wchar_t *const fileName)
+static BOOL initFinalPathName(void)
 {
 	LONG loop = 0L;
-	wchar_t *buffer = NULL;
-	size_t size = 0UL;
-	HANDLE handle = NULL;
 
 	//Initialize on first call
 	while ((loop = InterlockedCompareExchange(&getFinalPathNameInit, -1L, 0L)) != 1L)
@@ -230,17 +646,19 @@ static const wchar_t* getFinalPathName(const wchar_t *const fileName)
 		}
 	}
 
-	//Is available?
-	if (!getFinalPathNamePtr)
-	{
-		goto failure; /*GetFinalPathNameByHandleW unavailable!*/
-	}
+	return (getFinalPathNamePtr != NULL);
+}
 
-	//Try to open file (or directory)
-	handle = CreateFileW(fileName, 0, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
-	if (handle == INVALID_HANDLE_VALUE)
+static const wchar_t* pathFromHandle(const HANDLE handle, path_arena *const arena)
+{
+	LONG loop = 0L;
+	wchar_t *buffer = NULL;
+	size_t size = 0UL;
+
+	//Is available?
+	if (!initFinalPathName())
 	{
-		goto failure;
+		return NULL; /*GetFinalPathNameByHandleW unavailable!*/
 	}
 
 	for (loop = 0L; loop < 3L; ++loop)
@@ -249,34 +667,57 @@ static const wchar_t* getFinalPathName(const wchar_t *const fileName)
 		const DWORD result = getFinalPathNamePtr(handle, buffer, (DWORD)size, VOLUME_NAME_DOS);
 		if (result < 1U)
 		{
-			goto failure;
+			break;
 		}
 
 		//Increase buffer size as needed
 		if (result > size)
 		{
-			if (!resizeBuffer(&buffer, &size, result))
+			if (!resizeBuffer(arena, &buffer, &size, result))
 			{
-				goto failure;
+				break;
 			}
 			continue;
 		}
 
-		//Clean up
-		CLOSE_HANDLE(handle);
-
 		//Clean the path string
 		cleanFilePath(buffer);
 		return buffer; /*success*/
 	}
 
-failure:
-	FREE(buffer);
-	CLOSE_HANDLE(handle);
+	freePath(arena, buffer);
 	return NULL;
 }
 
-static const wchar_t* getFullPathName(const wchar_t *const fileName)
+const wchar_t* getPathFromHandle(const HANDLE handle)
+{
+	return pathFromHandle(handle, NULL);
+}
+
+static const wchar_t* getFinalPathName(const wchar_t *const fileName, path_arena *const arena)
+{
+	const wchar_t *result;
+	HANDLE handle = NULL;
+
+	//Is available?
+	if (!initFinalPathName())
+	{
+		return NULL; /*GetFinalPathNameByHandleW unavailable!*/
+	}
+
+	//Try to open file (or directory)
+	handle = CreateFileW(fileName, 0, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+	if (handle == INVALID_HANDLE_VALUE)
+	{
+		return NULL;
+	}
+
+	result = pathFromHandle(handle, arena);
+	CloseHandle(handle);
+	return result;
+}
+
+static const wchar_t* getFullPathName(const wchar_t *const fileName, path_arena *const arena)
 {
 	LONG loop = 0L;
 	wchar_t *buffer = NULL;
@@ -294,7 +735,7 @@ static const wchar_t* getFullPathName(const wchar_t *const fileName)
 		//Increase buffer size as needed
 		if (result > size)
 		{
-			if (!resizeBuffer(&buffer, &size, result))
+			if (!resizeBuffer(arena, &buffer, &size, result))
 			{
 				goto failure;
 			}
@@ -307,11 +748,11 @@ static const wchar_t* getFullPathName(const wchar_t *const fileName)
 	}
 
 failure:
-	FREE(buffer);
+	freePath(arena, buffer);
 	return NULL;
 }
 
-static const wchar_t* getLongPathName(const wchar_t *const fileName)
+static const wchar_t* getLongPathName(const wchar_t *const fileName, path_arena *const arena)
 {
 	LONG loop = 0L;
 	wchar_t *buffer = NULL;
@@ -329,7 +770,7 @@ static const wchar_t* getLongPathName(const wchar_t *const fileName)
 		//Increase buffer size as needed
 		if (result > size)
 		{
-			if (!resizeBuffer(&buffer, &size, result))
+			if (!resizeBuffer(arena, &buffer, &size, result))
 			{
 				goto failure;
 			}
@@ -342,43 +783,702 @@ static const wchar_t* getLongPathName(const wchar_t *const fileName)
 	}
 
 failure:
-	FREE(buffer);
+	freePath(arena, buffer);
 	return NULL;
 }
 
-const wchar_t* getCanonicalPath(const wchar_t *const fileName)
+static const wchar_t* getLegacyPath(const wchar_t *const fileName, path_arena *const arena)
 {
-	//Try the "modern" way first
-	const wchar_t* canonicalPath = getFinalPathName(fileName);
+	const wchar_t* canonicalPath = getFullPathName(fileName, arena);
 	if (canonicalPath)
 	{
-		return canonicalPath;
-	}
-
-	//Fallback method for "legacy" OS
-	if (canonicalPath = getFullPathName(fileName))
-	{
-		const wchar_t* longFullPath = getLongPathName(canonicalPath);
+		const wchar_t* longFullPath = getLongPathName(canonicalPath, arena);
 		if (longFullPath)
 		{
-			free((void*)canonicalPath);
+			freePath(arena, canonicalPath);
 			canonicalPath = longFullPath;
 		}
 	}
-
 	return canonicalPath;
 }
 
-/* ======================================================================= */
-/* GET DIRECTORY PART                                                      */
-/* ======================================================================= */
-
-static void remove_filespec(wchar_t *pathstr)
+static const wchar_t* resolveCanonicalPath(const wchar_t *const fileName, path_arena *const arena)
 {
-	wchar_t *filespec = pathstr;
-
-	if ((*pathstr == L'\\') || (*pathstr == L'/'))
-	{
+	//Try the "modern" way first
+	const wchar_t* canonicalPath = getFinalPathName(fileName, arena);
+	if (canonicalPath)
+	{
+		return canonicalPath;
+	}
+
+	//Fallback method for "legacy" OS
+	return getLegacyPath(fileName, arena);
+}
+
+const wchar_t* getCanonicalPath(const wchar_t *const fileName)
+{
+	return resolveCanonicalPath(fileName, NULL);
+}
+
+const wchar_t* getCanonicalPathInfo(const wchar_t *const fileName, BY_HANDLE_FILE_INFORMATION *const info, path_arena *const arena)
+{
+	const wchar_t *canonicalPath = NULL;
+	HANDLE handle;
+
+	//Open the file (or directory) once, for the metadata as well as the final path
+	memset(info, 0, sizeof(BY_HANDLE_FILE_INFORMATION));
+	info->dwFileAttributes = INVALID_FILE_ATTRIBUTES;
+	handle = CreateFileW(fileName, FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+	if (handle != INVALID_HANDLE_VALUE)
+	{
+		if (!GetFileInformationByHandle(handle, info))
+		{
+			info->dwFileAttributes = INVALID_FILE_ATTRIBUTES;
+		}
+		canonicalPath = pathFromHandle(handle, arena);
+		CloseHandle(handle);
+	}
+
+	//Fallback method for "legacy" OS, or if the file does not exist
+	if (!canonicalPath)
+	{
+		canonicalPath = getLegacyPath(fileName, arena);
+	}
+
+	//The file may exist, even though it can not be opened (e.g. "pagefile.sys", or an ACL that denies reading the attributes)
+	if (canonicalPath && (info->dwFileAttributes == INVALID_FILE_ATTRIBUTES))
+	{
+		WIN32_FILE_ATTRIBUTE_DATA attribs;
+		if (GetFileAttributesExW(canonicalPath, GetFileExInfoStandard, &attribs))
+		{
+			info->dwFileAttributes = attribs.dwFileAttributes;
+			info->ftCreationTime = attribs.ftCreationTime;
+			info->ftLastAccessTime = attribs.ftLastAccessTime;
+			info->ftLastWriteTime = attribs.ftLastWriteTime;
+			info->nFileSizeHigh = attribs.nFileSizeHigh;
+			info->nFileSizeLow = attribs.nFileSizeLow;
+		}
+	}
+
+	return canonicalPath;
+}
+
+/* ======================================================================= */
+/* LEXICAL PATH                                                            */
+/* ======================================================================= */
+
+#define IS_PATH_SEP(C) (((C) == L'\\') || ((C) == L'/'))
+
+static __inline size_t findSeparatorScalar(const wchar_t *const path, size_t offset, const size_t length)
+{
+	while ((offset < length) && (!IS_PATH_SEP(path[offset])))
+	{
+		++offset;
+	}
+	return offset;
+}
+
+#if defined(_M_IX86) || defined(_M_X64)
+
+#ifdef _M_X64
+static volatile LONG sse2Support = 1L; /*always available on x64*/
+#else
+static volatile LONG sse2Support = -1L;
+#endif
+
+static __inline BOOL haveSSE2(void)
+{
+	LONG value = sse2Support;
+	if (value < 0L)
+	{
+		value = IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE) ? 1L : 0L;
+		InterlockedExchange(&sse2Support, value);
+	}
+	return (value > 0L);
+}
+
+static size_t findSeparatorSSE2(const wchar_t *const path, size_t offset, const size_t length)
+{
+	const __m128i backslash = _mm_set1_epi16(L'\\'), slash = _mm_set1_epi16(L'/');
+	while ((offset + 8U) <= length)
+	{
+		const __m128i chunk = _mm_loadu_si128((const __m128i*)(path + offset));
+		int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi16(chunk, backslash), _mm_cmpeq_epi16(chunk, slash)));
+		if (mask)
+		{
+			for (; !(mask & 1); mask >>= 2, ++offset);
+			return offset;
+		}
+		offset += 8U;
+	}
+	return findSeparatorScalar(path, offset, length);
+}
+
+#define FIND_SEPARATOR(PATH, OFFSET, LENGTH) (useSSE2 ? findSeparatorSSE2((PATH), (OFFSET), (LENGTH)) : findSeparatorScalar((PATH), (OFFSET), (LENGTH)))
+
+#else
+
+#define haveSSE2() FALSE
+#define FIND_SEPARATOR(PATH, OFFSET, LENGTH) findSeparatorScalar((PATH), (OFFSET), (LENGTH))
+
+#endif
+
+static size_t normalizeRoot(wchar_t *const path, const size_t length, const BOOL useSSE2)
+{
+	size_t offset, count, separator;
+
+	//Drive letter
+	if (iswalpha(path[0U]) && (path[1U] == L':') && IS_PATH_SEP(path[2U]))
+	{
+		path[2U] = L'\\';
+		return 3U;
+	}
+	if (!(IS_PATH_SEP(path[0U]) && IS_PATH_SEP(path[1U])))
+	{
+		return 0U;
+	}
+
+	//UNC path, optionally with "\\?\" or "\\.\" prefix
+	path[0U] = path[1U] = L'\\';
+	offset = 2U;
+	if (((path[2U] == L'?') || (path[2U] == L'.')) && IS_PATH_SEP(path[3U]))
+	{
+		path[3U] = L'\\';
+		if (iswalpha(path[4U]) && (path[5U] == L':') && IS_PATH_SEP(path[6U]))
+		{
+			path[6U] = L'\\';
+			return 7U;
+		}
+		if (_wcsnicmp(path + 4U, L"UNC", 3U) || (!IS_PATH_SEP(path[7U])))
+		{
+			return 0U; /*device path*/
+		}
+		path[7U] = L'\\';
+		offset = 8U;
+	}
+
+	//Skip server and share name
+	for (count = 0U; count < 2U; ++count)
+	{
+		if (((separator = FIND_SEPARATOR(path, offset, length)) <= offset) || (separator >= length))
+		{
+			return 0U;
+		}
+		path[separator] = L'\\';
+		offset = separator + 1U;
+	}
+
+	return offset;
+}
+
+static wchar_t *makeAbsolutePath(const wchar_t *const fileName, path_arena *const arena)
+{
+	DWORD size;
+	size_t length;
+	wchar_t *buffer;
+
+	//Absolute paths are used as-is, drive-relative or rooted paths need the per-drive state
+	if ((IS_PATH_SEP(fileName[0U]) && IS_PATH_SEP(fileName[1U])) || (iswalpha(fileName[0U]) && (fileName[1U] == L':') && IS_PATH_SEP(fileName[2U])))
+	{
+		return arenaDup(arena, fileName);
+	}
+	if (IS_PATH_SEP(fileName[0U]) || (iswalpha(fileName[0U]) && (fileName[1U] == L':')))
+	{
+		return (wchar_t*) getFullPathName(fileName, arena);
+	}
+
+	//Relative path: prepend the current directory
+	length = wcslen(fileName);
+	if ((size = GetCurrentDirectoryW(0U, NULL)) < 1U)
+	{
+		return NULL;
+	}
+	if (!(buffer = allocPath(arena, size + length + 1U)))
+	{
+		return NULL;
+	}
+	if ((GetCurrentDirectoryW(size, buffer) + 1U) != size)
+	{
+		freePath(arena, buffer);
+		return NULL; /*changed in the meantime*/
+	}
+	buffer[size - 1U] = L'\\';
+	wmemcpy(buffer + size, fileName, length + 1U);
+	return buffer;
+}
+
+const wchar_t* getLexicalPath(const wchar_t *const fileName, path_arena *const arena)
+{
+	const BOOL useSSE2 = haveSSE2();
+	wchar_t *buffer;
+	size_t length, rootLen, input, output, separator, count;
+
+	if ((!fileName[0U]) || (!(buffer = makeAbsolutePath(fileName, arena))))
+	{
+		return NULL;
+	}
+
+	//Determine the root, which is never removed
+	length = wcslen(buffer);
+	if (!(rootLen = normalizeRoot(buffer, length, useSSE2)))
+	{
+		freePath(arena, buffer);
+		return getFullPathName(fileName, arena); /*unusual root, let the OS decide*/
+	}
+
+	//Single pass over the components: skip "." and empty ones, ".." removes the previous one
+	for (input = output = rootLen; input < length; input = separator + 1U)
+	{
+		separator = FIND_SEPARATOR(buffer, input, length);
+		count = separator - input;
+		if ((count < 1U) || ((count == 1U) && (buffer[input] == L'.')))
+		{
+			continue;
+		}
+		if ((count == 2U) && (buffer[input] == L'.') && (buffer[input + 1U] == L'.'))
+		{
+			while ((output > rootLen) && (buffer[output - 1U] != L'\\'))
+			{
+				--output;
+			}
+			if (output > rootLen)
+			{
+				--output;
+			}
+			continue;
+		}
+		if (output > rootLen)
+		{
+			buffer[output++] = L'\\';
+		}
+		if (output != input)
+		{
+			wmemmove(buffer + output, buffer + input, count);
+		}
+		output += count;
+	}
+
+	buffer[output] = L'\0';
+	cleanFilePath(buffer);
+	return buffer;
+}
+
+/* ======================================================================= */
+/* CANONICAL PATH CACHE                                                    */
+/* ======================================================================= */
+
+#define PATH_CACHE_SIZE 4096U
+
+static size_t getPathRootLength(const wchar_t *const path)
+{
+	size_t offset, count;
+
+	//Drive letter or UNC path, optionally with "\\?\" prefix
+	if (!wcsncmp(path, L"\\\\?\\", 4U))
+	{
+		if (iswalpha(path[4U]) && (!wcsncmp(path + 5U, L":\\", 2U)))
+		{
+			return 7U;
+		}
+		if (_wcsnicmp(path + 4U, L"UNC\\", 4U))
+		{
+			return 0U;
+		}
+		offset = 8U;
+	}
+	else if (iswalpha(path[0U]) && (!wcsncmp(path + 1U, L":\\", 2U)))
+	{
+		return 3U;
+	}
+	else if ((!wcsncmp(path, L"\\\\", 2U)) && (path[2U] != L'.') && (path[2U] != L'?'))
+	{
+		offset = 2U;
+	}
+	else
+	{
+		return 0U; /*unsupported*/
+	}
+
+	//Skip server and share name
+	for (count = 0U; count < 2U; ++count)
+	{
+		const wchar_t *const separator = wcschr(path + offset, L'\\');
+		if ((!separator) || (separator == path + offset))
+		{
+			return 0U;
+		}
+		offset = (separator - path) + 1U;
+	}
+
+	return offset;
+}
+
+static wchar_t *joinPath(const wchar_t *const prefix, const wchar_t *const name, path_arena *const arena)
+{
+	const size_t prefixLen = wcslen(prefix), nameLen = wcslen(name);
+	const size_t separator = ((prefixLen > 0U) && (prefix[prefixLen - 1U] != L'\\')) ? 1U : 0U;
+	wchar_t *buffer;
+
+	//Names that getCanonicalPath() would keep the "\\?\" prefix for are not handled here
+	if ((nameLen < 1U) || (name[nameLen - 1U] == L'.') || (name[nameLen - 1U] == L' ') || ((prefixLen + separator + nameLen) >= MAX_PATH))
+	{
+		return NULL;
+	}
+
+	if (buffer = allocPath(arena, prefixLen + separator + nameLen + 1U))
+	{
+		wmemcpy(buffer, prefix, prefixLen);
+		if (separator)
+		{
+			buffer[prefixLen] = L'\\';
+		}
+		wmemcpy(buffer + prefixLen + separator, name, nameLen + 1U);
+	}
+
+	return buffer;
+}
+
+static const wchar_t *pathCacheLookup(const path_cache *const cache, const wchar_t *const key)
+{
+	ULONG idx;
+
+	if (!cache->entries)
+	{
+		return NULL;
+	}
+
+	for (idx = hashPathKey(key) & (PATH_CACHE_SIZE - 1U); cache->entries[idx].key; idx = (idx + 1U) & (PATH_CACHE_SIZE - 1U))
+	{
+		if (!_wcsicmp(cache->entries[idx].key, key))
+		{
+			return cache->entries[idx].value;
+		}
+	}
+
+	return NULL;
+}
+
+/* stores a copy of "value", returns the cached copy or NULL on failure */
+static const wchar_t *pathCacheInsert(path_cache *const cache, const wchar_t *const key, const wchar_t *const value)
+{
+	ULONG idx;
+	wchar_t *keyCopy, *valueCopy;
+
+	//Allocate the table on first use, start over when it is getting full
+	if ((!cache->entries) && (!(cache->entries = (path_cache_entry*) calloc(PATH_CACHE_SIZE, sizeof(path_cache_entry)))))
+	{
+		return NULL;
+	}
+	if (cache->count >= ((PATH_CACHE_SIZE / 4U) * 3U))
+	{
+		pathCacheClear(cache);
+	}
+
+	if (!(keyCopy = _wcsdup(key)))
+	{
+		return NULL;
+	}
+	if (!(valueCopy = _wcsdup(value)))
+	{
+		free(keyCopy);
+		return NULL;
+	}
+
+	for (idx = hashPathKey(key) & (PATH_CACHE_SIZE - 1U); cache->entries[idx].key; idx = (idx + 1U) & (PATH_CACHE_SIZE - 1U));
+	cache->entries[idx].key = keyCopy;
+	cache->entries[idx].value = valueCopy;
+	cache->count++;
+
+	return valueCopy;
+}
+
+void pathCacheInit(path_cache *const cache)
+{
+	memset(cache, 0, sizeof(path_cache));
+}
+
+void pathCacheClear(path_cache *const cache)
+{
+	ULONG idx;
+	if (cache->entries)
+	{
+		for (idx = 0U; idx < PATH_CACHE_SIZE; ++idx)
+		{
+			FREE(cache->entries[idx].key);
+			FREE(cache->entries[idx].value);
+		}
+		memset(cache->entries, 0, sizeof(path_cache_entry) * PATH_CACHE_SIZE);
+	}
+	cache->count = 0U;
+}
+
+void pathCacheFree(path_cache *const cache)
+{
+	pathCacheClear(cache);
+	FREE(cache->entries);
+	memset(cache, 0, sizeof(path_cache));
+}
+
+const wchar_t* getCanonicalPathCached(path_cache *const cache, const wchar_t *const fileName, path_arena *const arena)
+{
+	wchar_t *fullPath = NULL, *result = NULL, saved;
+	const wchar_t *prefix = NULL;
+	size_t rootLen, length, end, next;
+	WIN32_FIND_DATAW findData;
+	HANDLE handle;
+
+	//Roots and reparse points are resolved by GetFinalPathNameByHandleW
+	if ((!initFinalPathName()) || (!(fullPath = (wchar_t*) getFullPathName(fileName, arena))))
+	{
+		goto fallback;
+	}
+
+	//Only plain paths below a drive letter or UNC share are handled here
+	length = wcslen(fullPath);
+	if ((!(rootLen = getPathRootLength(fullPath))) || (length <= rootLen) || (length >= MAX_PATH) || wcspbrk(fullPath + rootLen, L"*?:<>\"|") || wcsstr(fullPath + rootLen, L"\\\\"))
+	{
+		goto fallback;
+	}
+
+	//Find the longest prefix that has been resolved before
+	for (end = length; ; end = next)
+	{
+		saved = fullPath[end];
+		fullPath[end] = L'\0';
+		prefix = pathCacheLookup(cache, fullPath);
+		fullPath[end] = saved;
+		if (prefix || (end <= rootLen))
+		{
+			break;
+		}
+		for (next = end; (next > rootLen) && (fullPath[next - 1U] != L'\\'); --next);
+		next = (next > rootLen) ? (next - 1U) : rootLen;
+	}
+
+	//Resolve the root itself, if not cached yet (e.g. SUBST drives)
+	if (!prefix)
+	{
+		const wchar_t *canonical;
+		saved = fullPath[rootLen];
+		fullPath[rootLen] = L'\0';
+		if (canonical = getFinalPathName(fullPath, arena))
+		{
+			prefix = pathCacheInsert(cache, fullPath, canonical);
+			freePath(arena, canonical);
+		}
+		fullPath[rootLen] = saved;
+		if (!prefix)
+		{
+			goto fallback;
+		}
+	}
+
+	//Walk the remaining components, looking up one directory entry at a time
+	while (end < length)
+	{
+		wchar_t *canonical = NULL;
+		const size_t start = (end > rootLen) ? (end + 1U) : rootLen;
+		for (next = start; (next < length) && (fullPath[next] != L'\\'); ++next);
+		saved = fullPath[next];
+		fullPath[next] = L'\0';
+		if ((handle = FindFirstFileW(fullPath, &findData)) != INVALID_HANDLE_VALUE)
+		{
+			FindClose(handle);
+			if (findData.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)
+			{
+				canonical = (wchar_t*) getFinalPathName(fullPath, arena); /*symbolic link, junction or mount point*/
+			}
+			else
+			{
+				canonical = joinPath(prefix, findData.cFileName, arena);
+			}
+		}
+		if (canonical && (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+		{
+			prefix = pathCacheInsert(cache, fullPath, canonical);
+			freePath(arena, canonical);
+			canonical = NULL;
+		}
+		else
+		{
+			prefix = NULL;
+		}
+		fullPath[next] = saved;
+		if (!prefix)
+		{
+			if (canonical && (next >= length))
+			{
+				result = canonical; /*regular file as the final component*/
+				break;
+			}
+			freePath(arena, canonical);
+			goto fallback;
+		}
+		end = next;
+	}
+
+	//Final component is a directory, or the whole path was cached already
+	if ((!result) && (!(result = arenaDup(arena, prefix))))
+	{
+		goto fallback;
+	}
+
+	freePath(arena, fullPath);
+	return result;
+
+fallback:
+	freePath(arena, fullPath);
+	return resolveCanonicalPath(fileName, arena);
+}
+
+/* ======================================================================= */
+/* RELATIVE PATH                                                           */
+/* ======================================================================= */
+
+static __inline size_t getRootPrefixLength(const wchar_t *const path, BOOL *const isUNC)
+{
+	//The "\\?\" and "\\?\UNC\" forms are equivalent to the plain forms
+	if (!_wcsnicmp(path, L"\\\\?\\UNC\\", 8U))
+	{
+		*isUNC = TRUE;
+		return 8U;
+	}
+	*isUNC = (!wcsncmp(path, L"\\\\", 2U)) && wcsncmp(path, L"\\\\?\\", 4U);
+	return (*isUNC) ? 2U : ((!wcsncmp(path, L"\\\\?\\", 4U)) ? 4U : 0U);
+}
+
+static BOOL isSameRoot(const wchar_t *const pathA, const size_t lengthA, const wchar_t *const pathB, const size_t lengthB)
+{
+	BOOL uncA, uncB;
+	const size_t offsetA = getRootPrefixLength(pathA, &uncA), offsetB = getRootPrefixLength(pathB, &uncB);
+	return (uncA == uncB) && ((lengthA - offsetA) == (lengthB - offsetB)) && (!_wcsnicmp(pathA + offsetA, pathB + offsetB, lengthA - offsetA));
+}
+
+BOOL relativeBaseInit(relative_base *const base, const wchar_t *const basePath)
+{
+	size_t length, pos, idx;
+
+	memset(base, 0, sizeof(relative_base));
+
+	//Keep a copy with a trailing backslash, so that a share root is recognized too
+	length = wcslen(basePath);
+	if (!(base->path = (wchar_t*) malloc(sizeof(wchar_t) * (length + 2U))))
+	{
+		return FALSE;
+	}
+	wmemcpy(base->path, basePath, length + 1U);
+	if ((length > 0U) && (base->path[length - 1U] != L'\\'))
+	{
+		base->path[length++] = L'\\';
+		base->path[length] = L'\0';
+	}
+	if (!(base->rootLen = getPathRootLength(base->path)))
+	{
+		goto failure;
+	}
+
+	//Split into components, once
+	for (pos = base->rootLen; pos < length; ++pos)
+	{
+		if (base->path[pos] == L'\\')
+		{
+			base->count++;
+		}
+	}
+	if (base->count > 0U)
+	{
+		if (!((base->offsets = (size_t*) malloc(sizeof(size_t) * base->count)) && (base->lengths = (size_t*) malloc(sizeof(size_t) * base->count))))
+		{
+			goto failure;
+		}
+		for (pos = base->rootLen, idx = 0U; idx < base->count; ++idx)
+		{
+			base->offsets[idx] = pos;
+			while (base->path[pos] != L'\\')
+			{
+				++pos;
+			}
+			base->lengths[idx] = pos++ - base->offsets[idx];
+		}
+	}
+
+	return TRUE;
+
+failure:
+	relativeBaseFree(base);
+	return FALSE;
+}
+
+void relativeBaseFree(relative_base *const base)
+{
+	FREE(base->path);
+	FREE(base->offsets);
+	FREE(base->lengths);
+	memset(base, 0, sizeof(relative_base));
+}
+
+const wchar_t* getRelativePath(const relative_base *const base, const wchar_t *const fullPath, path_arena *const arena)
+{
+	const size_t rootLen = getPathRootLength(fullPath);
+	size_t pos, end, common, climbs, restLen, idx;
+	wchar_t *buffer, *output;
+
+	//Paths on a different drive (or share) stay absolute
+	if ((!rootLen) || (!isSameRoot(base->path, base->rootLen, fullPath, rootLen)))
+	{
+		return arenaDup(arena, fullPath);
+	}
+
+	//Skip the components that are shared with the base directory
+	for (pos = rootLen, common = 0U; (common < base->count) && fullPath[pos]; ++common)
+	{
+		for (end = pos; fullPath[end] && (fullPath[end] != L'\\'); ++end);
+		if (((end - pos) != base->lengths[common]) || _wcsnicmp(fullPath + pos, base->path + base->offsets[common], end - pos))
+		{
+			break;
+		}
+		pos = fullPath[end] ? (end + 1U) : end;
+	}
+
+	//Climb up from the base directory, then descend into the remaining part
+	climbs = base->count - common;
+	restLen = wcslen(fullPath + pos);
+	if (!(buffer = allocPath(arena, (3U * climbs) + restLen + 2U)))
+	{
+		return NULL;
+	}
+	for (output = buffer, idx = 0U; idx < climbs; ++idx)
+	{
+		*output++ = L'.';
+		*output++ = L'.';
+		*output++ = L'\\';
+	}
+	if (restLen > 0U)
+	{
+		wmemcpy(output, fullPath + pos, restLen + 1U);
+	}
+	else if (climbs > 0U)
+	{
+		output[-1] = L'\0'; /*no trailing backslash*/
+	}
+	else
+	{
+		wcscpy(output, L"."); /*same directory*/
+	}
+
+	return buffer;
+}
+
+/* ======================================================================= */
+/* GET DIRECTORY PART                                                      */
+/* ======================================================================= */
+
+static void remove_filespec(wchar_t *pathstr)
+{
+	wchar_t *filespec = pathstr;
+
+	if ((*pathstr == L'\\') || (*pathstr == L'/'))
+	{
 		filespec = ++pathstr;
 	}
 	if ((*pathstr == L'\\') || (*pathstr == L'/'))
@@ -494,3 +1594,361 @@ DWORD shutdownComputer(const wchar_t *const message, const DWORD timeout, const
 
 	return GetLastError(); /*failure*/
 }
+
+/* ======================================================================= */
+/* INTERRUPT HANDLING                                                      */
+/* ======================================================================= */
+
+#define INTERRUPT_DEADLINE 5000U /*time for the clean-up after an interrupt, in milliseconds*/
+
+static volatile LONG interruptInit = 0L, interruptCount = 0L;
+static HANDLE interruptEvent = NULL;
+
+HANDLE getInterruptEvent(void)
+{
+	LONG loop = 0L;
+
+	//Initialize on first call
+	while ((loop = InterlockedCompareExchange(&interruptInit, -1L, 0L)) != 1L)
+	{
+		if(!loop) /*first thread initializes*/
+		{
+			interruptEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+			InterlockedExchange(&interruptInit, 1L);
+		}
+		else
+		{
+			Sleep(0U); /*wait for initialized*/
+		}
+	}
+
+	return interruptEvent;
+}
+
+BOOL isInterrupted(void)
+{
+	return (interruptCount > 0L);
+}
+
+BOOL handleInterrupt(const DWORD ctrlType, const wchar_t *const name, const int exitCode)
+{
+	switch (ctrlType)
+	{
+	case CTRL_C_EVENT:
+		fwprintf(stderr, L"Ctrl+C: %s has been interrupted !!!\n\n", name);
+		break;
+	case CTRL_BREAK_EVENT:
+		fwprintf(stderr, L"Break: %s has been interrupted !!!\n\n", name);
+		break;
+	default:
+		return FALSE;
+	}
+
+	fflush(stderr);
+
+	//Signal the main thread, so that it can clean up; a second interrupt terminates right away
+	if ((InterlockedIncrement(&interruptCount) > 1L) || (!SetEvent(getInterruptEvent())))
+	{
+		_exit(exitCode);
+	}
+
+	//The handler runs in its own thread, so it can enforce the deadline
+	Sleep(INTERRUPT_DEADLINE);
+	fwprintf(stderr, L"Error: %s did not terminate in time!\n\n", name);
+	fflush(stderr);
+	_exit(exitCode);
+	return TRUE;
+}
+
+/* ======================================================================= */
+/* EVENT REACTOR                                                           */
+/* ======================================================================= */
+
+void reactorInit(reactor_t *const reactor)
+{
+	memset(reactor, 0, sizeof(reactor_t));
+}
+
+BOOL reactorAddHandle(reactor_t *const reactor, const HANDLE handle, const int tag)
+{
+	if ((!handle) || (handle == INVALID_HANDLE_VALUE) || (reactor->count >= REACTOR_MAXIMUM))
+	{
+		return FALSE;
+	}
+	reactor->handles[reactor->count] = handle;
+	reactor->tags[reactor->count++] = tag;
+	return TRUE;
+}
+
+BOOL reactorAddTimer(reactor_t *const reactor, const DWORD timeout, const int tag)
+{
+	if (timeout == INFINITE)
+	{
+		return TRUE; /*never expires*/
+	}
+	if (reactor->timerCount >= REACTOR_TIMERS)
+	{
+		return FALSE;
+	}
+	reactor->timers[reactor->timerCount].start = GetTickCount();
+	reactor->timers[reactor->timerCount].timeout = timeout;
+	reactor->timers[reactor->timerCount++].tag = tag;
+	return TRUE;
+}
+
+BOOL reactorAddInterrupt(reactor_t *const reactor, const int tag)
+{
+	return reactorAddHandle(reactor, getInterruptEvent(), tag);
+}
+
+BOOL reactorRemove(reactor_t *const reactor, const int tag)
+{
+	DWORD idx;
+	for (idx = 0U; idx < reactor->count; ++idx)
+	{
+		if (reactor->tags[idx] == tag)
+		{
+			memmove(&reactor->handles[idx], &reactor->handles[idx + 1U], (reactor->count - idx - 1U) * sizeof(HANDLE));
+			memmove(&reactor->tags[idx], &reactor->tags[idx + 1U], (reactor->count - idx - 1U) * sizeof(int));
+			reactor->count--;
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+int reactorWait(reactor_t *const reactor)
+{
+	DWORD idx, remaining, status, next = 0U;
+
+	for (;;)
+	{
+		//Find the timer that expires first (tick differences are safe across the wrap-around)
+		const DWORD now = GetTickCount();
+		for (remaining = INFINITE, idx = 0U; idx < reactor->timerCount; ++idx)
+		{
+			const DWORD elapsed = now - reactor->timers[idx].start;
+			const DWORD left = (elapsed < reactor->timers[idx].timeout) ? (reactor->timers[idx].timeout - elapsed) : 0U;
+			if (left < remaining)
+			{
+				remaining = left;
+				next = idx;
+			}
+		}
+
+		//Wait for the first handle to become signaled, or the next timer to expire
+		if (reactor->count < 1U)
+		{
+			if (remaining == INFINITE)
+			{
+				return REACTOR_FAILED; /*nothing to wait for*/
+			}
+			Sleep(remaining);
+			return reactor->timers[next].tag;
+		}
+		status = WaitForMultipleObjects(reactor->count, reactor->handles, FALSE, remaining);
+		if ((status >= WAIT_OBJECT_0) && (status < WAIT_OBJECT_0 + reactor->count))
+		{
+			return reactor->tags[status - WAIT_OBJECT_0];
+		}
+		if ((status >= WAIT_ABANDONED_0) && (status < WAIT_ABANDONED_0 + reactor->count))
+		{
+			return reactor->tags[status - WAIT_ABANDONED_0];
+		}
+		if (status != WAIT_TIMEOUT)
+		{
+			return REACTOR_FAILED;
+		}
+		if ((GetTickCount() - reactor->timers[next].start) >= reactor->timers[next].timeout)
+		{
+			return reactor->timers[next].tag;
+		}
+	}
+}
+
+/* ======================================================================= */
+/* BUFFERED OUTPUT                                                         */
+/* ======================================================================= */
+
+#define CONSOLE_CHUNK_SIZE 16384U
+
+BOOL outputOpen(output_buffer *const output, const HANDLE handle, const size_t size)
+{
+	DWORD mode;
+
+	memset(output, 0, sizeof(output_buffer));
+	output->handle = handle;
+	output->size = (size > 16U) ? size : 16U;
+
+	//Interactive consumers (console or other character device) get each line right away, pipes and files get large blocks
+	if (GetFileType(handle) == FILE_TYPE_CHAR)
+	{
+		output->flushMode = OUTPUT_FLUSH_LINE;
+		if (GetConsoleMode(handle, &mode))
+		{
+			output->console = TRUE; /*UTF-8 is not reliable with the console code page*/
+			if (!(output->wideBuffer = (wchar_t*) malloc(sizeof(wchar_t) * output->size)))
+			{
+				return FALSE;
+			}
+		}
+	}
+	else
+	{
+		output->flushMode = OUTPUT_FLUSH_BLOCK;
+	}
+
+	return ((output->buffer = (char*) malloc(output->size)) != NULL);
+}
+
+BOOL outputBytes(output_buffer *const output, const char *const data, const size_t length)
+{
+	size_t offset = 0U;
+	while (offset < length)
+	{
+		const size_t chunk = ((length - offset) < (output->size - output->used)) ? (length - offset) : (output->size - output->used);
+		memcpy(output->buffer + output->used, data + offset, chunk);
+		output->used += chunk;
+		offset += chunk;
+		if ((output->used >= output->size) && (!outputFlush(output)))
+		{
+			return FALSE;
+		}
+	}
+	if ((output->flushMode == OUTPUT_FLUSH_LINE) && (length > 0U) && memchr(data, '\n', length))
+	{
+		return outputFlush(output);
+	}
+	return !output->failed;
+}
+
+BOOL outputWrite(output_buffer *const output, const wchar_t *const text, const size_t length)
+{
+	int count;
+	char *temp;
+
+	if (length < 1U)
+	{
+		return !output->failed;
+	}
+
+	//Convert straight into the buffer, if there is enough space (at most three bytes per UTF-16 unit)
+	if ((length > (((size_t)INT_MAX) / 3U)) || ((3U * length) > output->size))
+	{
+		goto convert_slow;
+	}
+	if (((3U * length) > (output->size - output->used)) && (!outputFlush(output)))
+	{
+		return FALSE;
+	}
+	if ((3U * length) > (output->size - output->used))
+	{
+		goto convert_slow; /*incomplete sequence still pending*/
+	}
+	if ((count = WideCharToMultiByte(CP_UTF8, 0U, text, (int)length, output->buffer + output->used, (int)(output->size - output->used), NULL, NULL)) < 1)
+	{
+		output->failed = TRUE; /*the record is lost*/
+		return FALSE;
+	}
+	output->used += count;
+	if ((output->flushMode == OUTPUT_FLUSH_LINE) && wmemchr(text, L'\n', length))
+	{
+		return outputFlush(output);
+	}
+	return TRUE;
+
+	//Very long strings take a detour through a temporary buffer
+convert_slow:
+	if ((length > ((size_t)INT_MAX)) || ((count = WideCharToMultiByte(CP_UTF8, 0U, text, (int)length, NULL, 0, NULL, NULL)) < 1))
+	{
+		output->failed = TRUE;
+		return FALSE;
+	}
+	if (!(temp = (char*) malloc(count)))
+	{
+		output->failed = TRUE;
+		return FALSE;
+	}
+	WideCharToMultiByte(CP_UTF8, 0U, text, (int)length, temp, count, NULL, NULL);
+	output->failed = output->failed || (!outputBytes(output, temp, count));
+	FREE(temp);
+	return !output->failed;
+}
+
+BOOL outputLine(output_buffer *const output, const wchar_t *const text)
+{
+	return outputWrite(output, text, wcslen(text)) && outputBytes(output, "\r\n", 2U);
+}
+
+static BOOL flushConsole(output_buffer *const output)
+{
+	size_t complete = output->used, tail, offset;
+	int count;
+
+	//An incomplete UTF-8 sequence at the end is kept for the next flush
+	for (tail = 1U; (tail <= 3U) && (tail <= complete); ++tail)
+	{
+		const BYTE c = (BYTE) output->buffer[complete - tail];
+		if ((c & 0xC0) != 0x80)
+		{
+			if (((c >= 0xF0) ? 4U : ((c >= 0xE0) ? 3U : ((c >= 0xC0) ? 2U : 1U))) > tail)
+			{
+				complete -= tail;
+			}
+			break;
+		}
+	}
+
+	//Convert back to UTF-16, then write to the console directly
+	if ((complete > 0U) && ((count = MultiByteToWideChar(CP_UTF8, 0U, output->buffer, (int)complete, output->wideBuffer, (int)output->size)) > 0))
+	{
+		for (offset = 0U; offset < (size_t)count; )
+		{
+			const DWORD chunk = (DWORD)((((size_t)count - offset) < CONSOLE_CHUNK_SIZE) ? ((size_t)count - offset) : CONSOLE_CHUNK_SIZE);
+			DWORD written = 0U;
+			if ((!WriteConsoleW(output->handle, output->wideBuffer + offset, chunk, &written, NULL)) || (written < 1U))
+			{
+				output->failed = TRUE;
+				break;
+			}
+			offset += written;
+		}
+	}
+
+	if (complete < output->used)
+	{
+		memmove(output->buffer, output->buffer + complete, output->used - complete);
+	}
+	output->used -= complete;
+	return !output->failed;
+}
+
+BOOL outputFlush(output_buffer *const output)
+{
+	size_t offset = 0U;
+	if (output->console)
+	{
+		return flushConsole(output);
+	}
+	while (offset < output->used)
+	{
+		DWORD written = 0U;
+		if ((!WriteFile(output->handle, output->buffer + offset, (DWORD)(output->used - offset), &written, NULL)) || (written < 1U))
+		{
+			output->failed = TRUE; /*e.g. broken pipe*/
+			break;
+		}
+		offset += written;
+	}
+	output->used = 0U;
+	return !output->failed;
+}
+
+BOOL outputClose(output_buffer *const output)
+{
+	const BOOL success = output->buffer ? outputFlush(output) : (!output->failed);
+	FREE(output->buffer);
+	FREE(output->wideBuffer);
+	memset(output, 0, sizeof(output_buffer));
+	return success;
+}
@@ -7,6 +7,8 @@
  * https://creativecommons.org/publicdomain/zero/1.0/legalcode
  */
 
+#pragma once
+
 #define WIN32_LEAN_AND_MEAN 1
 #include <Windows.h>
 #include <stdio.h>
@@ -28,19 +30,135 @@ __declspec(dllimport) extern FILE _iob[];
 #endif
 
 int parseULong(const wchar_t *str, ULONG *const out);
+int parseDuration(const wchar_t *str, ULONG *const out);
+
+/* string arena */
+typedef struct path_arena_block
+{
+	struct path_arena_block *next;
+	size_t capacity, used;
+	wchar_t data[1];
+}
+path_arena_block;
+
+typedef struct
+{
+	path_arena_block *blocks;
+}
+path_arena;
+
+void arenaInit(path_arena *const arena);
+wchar_t *arenaAlloc(path_arena *const arena, const size_t length);
+wchar_t *arenaDup(path_arena *const arena, const wchar_t *const str);
+void arenaReset(path_arena *const arena);
+void arenaFree(path_arena *const arena);
+void freePath(path_arena *const arena, const wchar_t *const path);
 
 unsigned long long getCurrentTime(void);
 unsigned long long getStartupTime(void);
 
+void setAttributeOptions(const DWORD retryBudget, const DWORD cacheTime);
+void releaseAttributeCache(void);
 DWORD getAttributes(const wchar_t *const filePath, unsigned long long *const timeStamp);
 BOOL clearAttribute(const wchar_t *const filePath, const DWORD mask);
 
 const wchar_t* getCanonicalPath(const wchar_t *const fileName);
+const wchar_t* getCanonicalPathInfo(const wchar_t *const fileName, BY_HANDLE_FILE_INFORMATION *const info, path_arena *const arena);
+const wchar_t* getLexicalPath(const wchar_t *const fileName, path_arena *const arena);
+const wchar_t* getPathFromHandle(const HANDLE handle);
 const wchar_t* getDirectoryPart(const wchar_t *const fullPath);
 const wchar_t* getEnvironmentString(const wchar_t *const name);
 
+/* canonical path cache */
+typedef struct
+{
+	wchar_t *key, *value;
+}
+path_cache_entry;
+
+typedef struct
+{
+	path_cache_entry *entries;
+	size_t count;
+}
+path_cache;
+
+void pathCacheInit(path_cache *const cache);
+void pathCacheClear(path_cache *const cache);
+void pathCacheFree(path_cache *const cache);
+const wchar_t* getCanonicalPathCached(path_cache *const cache, const wchar_t *const fileName, path_arena *const arena);
+
+/* relative paths */
+typedef struct
+{
+	wchar_t *path;
+	size_t rootLen, count;
+	size_t *offsets, *lengths;
+}
+relative_base;
+
+BOOL relativeBaseInit(relative_base *const base, const wchar_t *const basePath);
+void relativeBaseFree(relative_base *const base);
+const wchar_t* getRelativePath(const relative_base *const base, const wchar_t *const fullPath, path_arena *const arena);
+
 DWORD shutdownComputer(const wchar_t *const message, const DWORD timeout, const DWORD reason);
 
+/* graceful interrupt */
+BOOL handleInterrupt(const DWORD ctrlType, const wchar_t *const name, const int exitCode);
+HANDLE getInterruptEvent(void);
+BOOL isInterrupted(void);
+
+/* event reactor */
+#define REACTOR_MAXIMUM MAXIMUM_WAIT_OBJECTS
+#define REACTOR_TIMERS 16U
+#define REACTOR_FAILED (-1)
+
+typedef struct
+{
+	DWORD start, timeout;
+	int tag;
+}
+reactor_timer;
+
+typedef struct
+{
+	HANDLE handles[REACTOR_MAXIMUM];
+	int tags[REACTOR_MAXIMUM];
+	DWORD count;
+	reactor_timer timers[REACTOR_TIMERS];
+	DWORD timerCount;
+}
+reactor_t;
+
+void reactorInit(reactor_t *const reactor);
+BOOL reactorAddHandle(reactor_t *const reactor, const HANDLE handle, const int tag);
+BOOL reactorAddTimer(reactor_t *const reactor, const DWORD timeout, const int tag);
+BOOL reactorAddInterrupt(reactor_t *const reactor, const int tag);
+BOOL reactorRemove(reactor_t *const reactor, const int tag);
+int reactorWait(reactor_t *const reactor);
+
+/* buffered UTF-8 output */
+#define OUTPUT_FLUSH_BLOCK 0
+#define OUTPUT_FLUSH_LINE  1
+
+typedef struct
+{
+	HANDLE handle;
+	char *buffer;
+	wchar_t *wideBuffer;
+	size_t size, used;
+	int flushMode;
+	BOOL console, failed;
+}
+output_buffer;
+
+BOOL outputOpen(output_buffer *const output, const HANDLE handle, const size_t size);
+BOOL outputBytes(output_buffer *const output, const char *const data, const size_t length);
+BOOL outputWrite(output_buffer *const output, const wchar_t *const text, const size_t length);
+BOOL outputLine(output_buffer *const output, const wchar_t *const text);
+BOOL outputFlush(output_buffer *const output);
+BOOL outputClose(output_buffer *const output);
+
 /* print line */
 static int __inline wprintln(FILE *const stream, const wchar_t *text)
 {
@@ -25,21 +25,7 @@ static __inline unsigned long computeDelta(const unsigned long long begin, const
 
 static BOOL __stdcall crtlHandler(DWORD dwCtrlTyp)
 {
-	switch (dwCtrlTyp)
-	{
-	case CTRL_C_EVENT:
-		wprintln(stderr, L"Ctrl+C: MSleep has been interrupted !!!\n");
-		break;
-	case CTRL_BREAK_EVENT:
-		wprintln(stderr, L"Break: MSleep has been interrupted !!!\n");
-		break;
-	default:
-		return FALSE;
-	}
-
-	fflush(stderr);
-	_exit(2);
-	return TRUE;
+	return handleInterrupt(dwCtrlTyp, L"MSleep", 2); /*the main thread is signaled to clean up*/
 }
 
 /* ======================================================================= */
@@ -60,12 +46,15 @@ int wmain(int argc, wchar_t *argv[])
 		fwprintf(stderr, L"msleep %s\n", PROGRAM_VERSION);
 		wprintln(stderr, L"Wait (sleep) for the specified amount of time, in milliseconds.\n");
 		wprintln(stderr, L"Usage:");
-		wprintln(stderr, L"   msleep.exe <timeout_ms>\n");
+		wprintln(stderr, L"   msleep.exe <timeout>\n");
 		wprintln(stderr, L"Exit status:");
 		wprintln(stderr, L"   0 - Timeout expired normally");
 		wprintln(stderr, L"   1 - Failed with error");
 		wprintln(stderr, L"   2 - Interrupted by user\n");
-		wprintln(stderr, L"Note: Process creation overhead will be measured and compensated.\n");
+		wprintln(stderr, L"Remarks:");
+		wprintln(stderr, L"   The timeout is in milliseconds, unless a unit (us, ms, s, m or h) is given.");
+		wprintln(stderr, L"   Units can be combined, e.g. \"1m30s\", and fractions are allowed, e.g. \"2.5s\".");
+		wprintln(stderr, L"   Process creation overhead will be measured and compensated.\n");
 		return EXIT_FAILURE;
 	}
 
@@ -77,7 +66,7 @@ int wmain(int argc, wchar_t *argv[])
 	}
 
 	//Parse timeout
-	if(error = parseULong(argv[1], &timeout))
+	if(error = parseDuration(argv[1], &timeout))
 	{
 		switch (error)
 		{
@@ -90,11 +79,19 @@ int wmain(int argc, wchar_t *argv[])
 		}
 	}
 
-	//Sleep remaining time
+	//Sleep remaining time (an interrupt ends the sleep early)
 	delta = computeDelta(getStartupTime(), getCurrentTime());
 	if (timeout >= delta)
 	{
-		Sleep(timeout - delta);
+		const HANDLE interrupt = getInterruptEvent();
+		if (!interrupt)
+		{
+			Sleep(timeout - delta);
+		}
+		else if (WaitForSingleObject(interrupt, timeout - delta) == WAIT_OBJECT_0)
+		{
+			return 2; /*interrupted by user*/
+		}
 	}
 
 	return EXIT_SUCCESS;
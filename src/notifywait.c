@@ -8,102 +8,1792 @@
  */
 
 #include "common.h"
+#include "snapshot.h"
+#include "statedb.h"
+
+#include <process.h>
+#include <winioctl.h>
 
 /* ======================================================================= */
 /* UTILITY FUNCTIONS                                                       */
 /* ======================================================================= */
 
-static BOOL __stdcall crtlHandler(DWORD dwCtrlTyp)
+static BOOL __stdcall crtlHandler(DWORD dwCtrlTyp)
+{
+	return handleInterrupt(dwCtrlTyp, L"Notifywait", 2); /*the main thread is signaled to clean up*/
+}
+
+/* ======================================================================= */
+/* HELPER MACROS AND TYPES                                                 */
+/* ======================================================================= */
+
+#define MAXIMUM_FILES 4096 /*maximum number of files*/
+#define MAXIMUM_DIRS (MAXIMUM_WAIT_OBJECTS - 1) /*maximum number of directories, one wait slot is reserved*/
+#define MAXIMUM_PENDING (MAXIMUM_WAIT_OBJECTS - 2) /*maximum number of non-existing files, two wait slots are reserved*/
+#define NOTIFY_BUFFER_SIZE 262144U /*default size of the change notification buffer, in bytes*/
+#define NOTIFY_BUFFER_MIN 4096U /*lower bound of change notification buffer size, in bytes*/
+#define NOTIFY_BUFFER_MAX 16777216U /*upper bound of change notification buffer size, in bytes*/
+#define NOTIFY_BUFFER_NET 65536U /*maximum change notification buffer size for network shares, in bytes*/
+#define JOURNAL_BUFFER_SIZE 65536U /*size of the change journal read buffer, in bytes*/
+#define OUTPUT_BUFFER_SIZE 65536U /*size of the standard output buffer, in bytes*/
+#define EVENT_RING_SIZE 4096L /*number of slots in the event ring, must be a power of two*/
+#define POLL_THREADS 8 /*maximum number of parallel directory scans*/
+#define POLL_INTERVAL_MIN 100U /*lower bound of polling interval, in milliseconds*/
+#define POLL_INTERVAL_MAX 10000U /*upper bound of polling interval, in milliseconds*/
+#define POLL_BUDGET 65536U /*default number of directory entries to read per polling round*/
+#define NOTIFY_FLAGS (FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME | FILE_NOTIFY_CHANGE_ATTRIBUTES | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_CREATION)
+#define CREATE_FLAGS (FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME)
+#define CLOSE_DELAY_MIN 50U /*initial delay between two "open writers" probes, in milliseconds*/
+#define CLOSE_DELAY_MAX 2000U /*maximum delay between two "open writers" probes, in milliseconds*/
+#define RENAME_GRACE 50U /*how long to wait for the new name of a renamed file, in milliseconds*/
+#define EXIT_INTERRUPTED 2 /*exit code when interrupted by user*/
+#define EXIT_TIMEOUT 3 /*exit code, if the writers did not close the file in time*/
+#define TRACE_MAXIMUM 1048576U /*maximum number of recorded trace samples*/
+
+#define TRACE_RECEIVED 0
+#define TRACE_FILTERED 1
+#define TRACE_VERIFIED 2
+#define TRACE_OUTPUT   3
+#define TRACE_STAGES   4
+
+#define TRY_PARSE_OPTION(NAME) \
+	if (!_wcsicmp(argv[argOffset] + 2U, L#NAME)) \
+	{ \
+		opt_##NAME = TRUE; \
+		continue; \
+	}
+
+#define WAIT_UNTIL_CLOSED(PATH) do \
+{ \
+	if (opt_closed && (!waitForWriters((PATH), closeTimeout, opt_debug))) \
+	{ \
+		if (!isInterrupted()) \
+		{ \
+			fwprintf(stderr, L"Error: File \"%s\" was not closed within the timeout!\n\n", (PATH)); \
+		} \
+		result = EXIT_TIMEOUT; \
+		goto cleanup; \
+	} \
+} \
+while(0)
+
+#define REPORT_CHANGE(IDX) do \
+{ \
+	WAIT_UNTIL_CLOSED(fullPath[(IDX)]); \
+	if (!opt_quiet) \
+	{ \
+		outputLine(&stdOutput, fullPath[(IDX)]); /*file was modified*/ \
+	} \
+	traceMark(TRACE_OUTPUT, (IDX)); \
+	goto success; \
+} \
+while(0)
+
+#define REPORT_CREATED(IDX) do \
+{ \
+	WAIT_UNTIL_CLOSED(pendingTarget[(IDX)].path); \
+	if (!opt_quiet) \
+	{ \
+		outputLine(&stdOutput, pendingTarget[(IDX)].path); /*file was created*/ \
+	} \
+	traceMark(TRACE_OUTPUT, -1); \
+	goto success; \
+} \
+while(0)
+
+#define REPORT_MOVE(IDX, NEWPATH) do \
+{ \
+	movedPath = (NEWPATH); /*released on clean-up, even if the wait bails out*/ \
+	WAIT_UNTIL_CLOSED(movedPath); \
+	if (!opt_quiet) \
+	{ \
+		outputLine(&stdOutput, fullPath[(IDX)]); /*file was moved*/ \
+	} \
+	fwprintf(stderr, L"Moved: \"%s\" -> \"%s\"\n", fullPath[(IDX)], movedPath); \
+	traceMark(TRACE_OUTPUT, (IDX)); \
+	goto success; \
+} \
+while(0)
+
+#define CHECK_IF_MODFIED(IDX) do \
+{ \
+	unsigned long long _timeStamp; \
+	const DWORD _attribs = getTrackedAttributes((IDX), &_timeStamp); \
+	traceMark(TRACE_VERIFIED, (IDX)); \
+	if ((_attribs == INVALID_FILE_ATTRIBUTES) || (_attribs & FILE_ATTRIBUTE_DIRECTORY) || ((!stateFile) && (_attribs & FILE_ATTRIBUTE_ARCHIVE)) || (_timeStamp != lastModTs[(IDX)])) \
+	{ \
+		REPORT_CHANGE((IDX)); \
+	} \
+} \
+while(0)
+
+#define CHECK_DIRECTORY(IDX) do \
+{ \
+	int _fileIdx; \
+	if (dirToFilesMap[(IDX)].dirTarget >= 0) \
+	{ \
+		REPORT_CHANGE(dirToFilesMap[(IDX)].dirTarget); \
+	} \
+	for (_fileIdx = 0; _fileIdx < dirToFilesMap[(IDX)].count; ++_fileIdx) \
+	{ \
+		CHECK_IF_MODFIED(dirFiles[dirToFilesMap[(IDX)].first + _fileIdx]); \
+	} \
+} \
+while(0)
+
+typedef struct
+{
+	int first, count;
+	int dirTarget;
+}
+fileIndex_list;
+
+typedef struct
+{
+	snapshot_t snapshot, current;
+	const wchar_t *const *names;
+	size_t nameCount, cost;
+	BOOL valid, success;
+}
+pollDirectory_state;
+
+typedef struct
+{
+	volatile LONG next;
+	LONG count;
+	int dirs[MAXIMUM_DIRS];
+}
+pollDirectory_queue;
+
+typedef struct
+{
+	HANDLE threads[POLL_THREADS];
+	DWORD threadCount;
+	HANDLE start, done;
+	volatile LONG pending, stop;
+	pollDirectory_queue *queue;
+}
+pollWorker_pool;
+
+typedef struct
+{
+	int dirIdx, fileIdx;
+}
+pollDirectory_match;
+
+typedef struct
+{
+	HANDLE handle;
+	OVERLAPPED overlapped;
+	BYTE *buffer;
+	DWORD flags, size;
+}
+dirWatch_state;
+
+typedef struct
+{
+	const wchar_t *path;
+	size_t ancestorLen;
+}
+pendingTarget_state;
+
+typedef struct
+{
+	HANDLE handle, event;
+	OVERLAPPED overlapped;
+	READ_USN_JOURNAL_DATA request;
+	BYTE *buffer;
+	wchar_t name[MAX_PATH + 1U];
+}
+journal_volume;
+
+typedef struct
+{
+	BOOL valid;
+	DWORD volume;
+	unsigned long long fileId;
+}
+file_identity;
+
+typedef struct
+{
+	int dirIdx;
+	DWORD action;
+	BOOL overflow;
+	LONGLONG received;
+	wchar_t name[MAX_PATH + 1U];
+}
+event_record;
+
+typedef struct
+{
+	volatile LONG head; /*written by the reader only*/
+	volatile LONG tail; /*written by the worker only*/
+	volatile LONG dropped, failed;
+	volatile LONG lost[MAXIMUM_DIRS];
+	LONG depthMax;
+	int dirCount;
+	HANDLE thread, dataEvent, stopEvent;
+	event_record records[EVENT_RING_SIZE];
+}
+event_ring;
+
+typedef struct
+{
+	int dirIdx, fileIdx;
+	LONGLONG time[TRACE_STAGES];
+}
+trace_sample;
+
+typedef struct
+{
+	BOOL enabled;
+	LARGE_INTEGER frequency;
+	LONGLONG origin;
+	trace_sample *samples;
+	size_t count, capacity, dropped;
+	int current;
+}
+trace_state;
+
+#define BOOLIFY(X) (!(!(X)))
+
+/* ======================================================================= */
+/* GLOBALS                                                                 */
+/* ======================================================================= */
+
+/*Globals*/
+static const wchar_t *fullPath[MAXIMUM_FILES];
+static const wchar_t *fileName[MAXIMUM_FILES];
+static BOOL directory[MAXIMUM_FILES];
+static int fileDirIdx[MAXIMUM_FILES];
+static unsigned long long lastModTs[MAXIMUM_FILES];
+static file_identity fileIdentity[MAXIMUM_FILES];
+static int dirFiles[MAXIMUM_FILES];
+static const wchar_t *dirFileNames[MAXIMUM_FILES];
+static const wchar_t* directoryPath[MAXIMUM_DIRS];
+static fileIndex_list dirToFilesMap[MAXIMUM_DIRS];
+static HANDLE notifyHandle[MAXIMUM_DIRS];
+static dirWatch_state watchState[MAXIMUM_DIRS];
+static pendingTarget_state pendingTarget[MAXIMUM_DIRS];
+static pollDirectory_state pollState[MAXIMUM_DIRS];
+static pollWorker_pool pollPool;
+static trace_state traceState;
+static event_ring eventRing;
+static journal_volume journalVolume[MAXIMUM_DIRS];
+static int journalVolumeCount = 0;
+static volatile LONG journalWarned = 0L;
+static int journalDirVolume[MAXIMUM_DIRS];
+static unsigned long long journalDirRef[MAXIMUM_DIRS];
+static statedb_entry stateEntry[MAXIMUM_FILES];
+static BOOL stateChanged[MAXIMUM_FILES];
+static DWORD notifyBufferSize = NOTIFY_BUFFER_SIZE;
+static output_buffer stdOutput;
+
+/* ======================================================================= */
+/* DIRECTORY TO FILES MAP                                                  */
+/* ======================================================================= */
+
+static const wchar_t *getFileNamePart(const wchar_t *const filePath, const wchar_t *const dirPath)
+{
+	const wchar_t *name = filePath + wcslen(dirPath);
+	while ((*name == L'\\') || (*name == L'/'))
+	{
+		name++;
+	}
+	return name;
+}
+
+static int __cdecl compareFileNames(const void *const a, const void *const b)
+{
+	return _wcsicmp(fileName[*((const int*)a)], fileName[*((const int*)b)]);
+}
+
+static void buildDirectoryMap(const int fileCount, const int dirCount)
+{
+	int fileIdx, dirIdx, offset = 0;
+
+	//Group the files by directory
+	for (dirIdx = 0; dirIdx < dirCount; ++dirIdx)
+	{
+		dirToFilesMap[dirIdx].first = offset;
+		dirToFilesMap[dirIdx].dirTarget = -1;
+		for (fileIdx = 0; fileIdx < fileCount; ++fileIdx)
+		{
+			if (fileDirIdx[fileIdx] == dirIdx)
+			{
+				dirFiles[offset++] = fileIdx;
+			}
+		}
+		dirToFilesMap[dirIdx].count = offset - dirToFilesMap[dirIdx].first;
+	}
+
+	//Sort the files of each directory by name, so that events can be looked up quickly
+	for (dirIdx = 0; dirIdx < dirCount; ++dirIdx)
+	{
+		const fileIndex_list *const list = &dirToFilesMap[dirIdx];
+		qsort(&dirFiles[list->first], list->count, sizeof(int), compareFileNames);
+		for (fileIdx = list->first; fileIdx < list->first + list->count; ++fileIdx)
+		{
+			dirFileNames[fileIdx] = fileName[dirFiles[fileIdx]];
+			if (directory[dirFiles[fileIdx]])
+			{
+				dirToFilesMap[dirIdx].dirTarget = dirFiles[fileIdx];
+			}
+		}
+	}
+}
+
+static int findFileInDirectory(const int dirIdx, const wchar_t *const name)
+{
+	int lower = dirToFilesMap[dirIdx].first, upper = dirToFilesMap[dirIdx].first + dirToFilesMap[dirIdx].count;
+	while (lower < upper)
+	{
+		const int pivot = lower + ((upper - lower) / 2);
+		const int cmp = _wcsicmp(name, dirFileNames[pivot]);
+		if (!cmp)
+		{
+			return dirFiles[pivot];
+		}
+		if (cmp < 0)
+		{
+			upper = pivot;
+		}
+		else
+		{
+			lower = pivot + 1;
+		}
+	}
+	return -1;
+}
+
+/* ======================================================================= */
+/* LATENCY TRACE                                                           */
+/* ======================================================================= */
+
+static const wchar_t *const TRACE_STAGE_NAME[TRACE_STAGES] = { L"receipt", L"filter", L"verify", L"output" };
+
+static __inline LONGLONG traceNow(void)
+{
+	LARGE_INTEGER counter;
+	return QueryPerformanceCounter(&counter) ? counter.QuadPart : 0LL;
+}
+
+static BOOL traceInitialize(void)
+{
+	memset(&traceState, 0, sizeof(trace_state));
+	traceState.current = -1;
+	if (!QueryPerformanceFrequency(&traceState.frequency))
+	{
+		return FALSE;
+	}
+	traceState.origin = traceNow();
+	return traceState.enabled = TRUE;
+}
+
+static void traceBegin(const int dirIdx, const LONGLONG received)
+{
+	trace_sample *sample;
+	traceState.current = -1;
+	if (!traceState.enabled)
+	{
+		return;
+	}
+	if (traceState.count >= traceState.capacity)
+	{
+		const size_t capacity = traceState.capacity ? (2U * traceState.capacity) : 1024U;
+		trace_sample *const samples = (capacity <= TRACE_MAXIMUM) ? (trace_sample*) realloc(traceState.samples, capacity * sizeof(trace_sample)) : NULL;
+		if (!samples)
+		{
+			traceState.dropped++;
+			return;
+		}
+		traceState.samples = samples;
+		traceState.capacity = capacity;
+	}
+	sample = &traceState.samples[traceState.count];
+	memset(sample, 0, sizeof(trace_sample));
+	sample->dirIdx = dirIdx;
+	sample->fileIdx = -1;
+	sample->time[TRACE_RECEIVED] = received;
+	traceState.current = (int) traceState.count++;
+}
+
+static void traceMark(const int stage, const int fileIdx)
+{
+	if (traceState.enabled && (traceState.current >= 0))
+	{
+		trace_sample *const sample = &traceState.samples[traceState.current];
+		if (stage == TRACE_OUTPUT)
+		{
+			outputFlush(&stdOutput); /*the output is complete only once it was written out*/
+		}
+		sample->time[stage] = traceNow();
+		if (fileIdx >= 0)
+		{
+			sample->fileIdx = fileIdx;
+		}
+	}
+}
+
+static __inline void traceEnd(void)
+{
+	traceState.current = -1;
+}
+
+static int __cdecl compareLongLong(const void *const a, const void *const b)
+{
+	const LONGLONG x = *((const LONGLONG*)a), y = *((const LONGLONG*)b);
+	return (x > y) ? 1 : ((x < y) ? (-1) : 0);
+}
+
+static __inline double traceToMicros(const LONGLONG ticks)
+{
+	return ((double)ticks) * 1000000.0 / ((double)traceState.frequency.QuadPart);
+}
+
+static void traceReport(void)
+{
+	LONGLONG *const delta = (traceState.count > 0U) ? (LONGLONG*) malloc(traceState.count * sizeof(LONGLONG)) : NULL;
+	int stage;
+
+	fwprintf(stderr, L"\nTrace: %lu samples (%lu dropped)\n", (DWORD)traceState.count, (DWORD)traceState.dropped);
+	fwprintf(stderr, L"   %-8s %8s %12s %12s %12s %12s\n", L"stage", L"count", L"p50 [us]", L"p90 [us]", L"p99 [us]", L"max [us]");
+	if (!delta)
+	{
+		wprintln(stderr, L"");
+		return;
+	}
+
+	//Compute the latency of each stage, relative to the previous one (the last row is end-to-end)
+	for (stage = TRACE_FILTERED; stage <= TRACE_STAGES; ++stage)
+	{
+		const int from = (stage < TRACE_STAGES) ? (stage - 1) : TRACE_RECEIVED, to = (stage < TRACE_STAGES) ? stage : TRACE_OUTPUT;
+		size_t count = 0U, idx;
+		for (idx = 0U; idx < traceState.count; ++idx)
+		{
+			const trace_sample *const sample = &traceState.samples[idx];
+			if (sample->time[from] && sample->time[to])
+			{
+				delta[count++] = sample->time[to] - sample->time[from];
+			}
+		}
+		if (count > 0U)
+		{
+			qsort(delta, count, sizeof(LONGLONG), compareLongLong);
+			fwprintf(stderr, L"   %-8s %8lu %12.1f %12.1f %12.1f %12.1f\n", (stage < TRACE_STAGES) ? TRACE_STAGE_NAME[stage] : L"total", (DWORD)count,
+				traceToMicros(delta[(count - 1U) * 50U / 100U]), traceToMicros(delta[(count - 1U) * 90U / 100U]), traceToMicros(delta[(count - 1U) * 99U / 100U]), traceToMicros(delta[count - 1U]));
+		}
+		else
+		{
+			fwprintf(stderr, L"   %-8s %8lu %12s %12s %12s %12s\n", (stage < TRACE_STAGES) ? TRACE_STAGE_NAME[stage] : L"total", 0UL, L"-", L"-", L"-", L"-");
+		}
+	}
+
+	wprintln(stderr, L"");
+	FREE(delta);
+}
+
+static BOOL traceWrite(const wchar_t *const outputFile)
+{
+	FILE *const file = _wfopen(outputFile, L"w");
+	size_t idx;
+	int stage;
+
+	if (!file)
+	{
+		return FALSE;
+	}
+
+	//Write one line per sample, timestamps are in microseconds since start-up
+	fwprintf(file, L"sample\tdirectory\tfile\t%s\t%s\t%s\t%s\n", TRACE_STAGE_NAME[TRACE_RECEIVED], TRACE_STAGE_NAME[TRACE_FILTERED], TRACE_STAGE_NAME[TRACE_VERIFIED], TRACE_STAGE_NAME[TRACE_OUTPUT]);
+	for (idx = 0U; idx < traceState.count; ++idx)
+	{
+		const trace_sample *const sample = &traceState.samples[idx];
+		fwprintf(file, L"%lu\t%d\t%s", (DWORD)idx, sample->dirIdx, (sample->fileIdx >= 0) ? fullPath[sample->fileIdx] : L"-");
+		for (stage = 0; stage < TRACE_STAGES; ++stage)
+		{
+			if (sample->time[stage])
+			{
+				fwprintf(file, L"\t%.1f", traceToMicros(sample->time[stage] - traceState.origin));
+			}
+			else
+			{
+				fwprintf(file, L"\t-");
+			}
+		}
+		fwprintf(file, L"\n");
+	}
+
+	return (fclose(file) == 0);
+}
+
+static void traceRelease(void)
+{
+	FREE(traceState.samples);
+	memset(&traceState, 0, sizeof(trace_state));
+	traceState.current = -1;
+}
+
+/* ======================================================================= */
+/* CHANGE NOTIFICATIONS                                                    */
+/* ======================================================================= */
+
+static BOOL watchRequest(const int watchIdx)
+{
+	dirWatch_state *const watch = &watchState[watchIdx];
+	memset(&watch->overlapped, 0, sizeof(OVERLAPPED));
+	watch->overlapped.hEvent = notifyHandle[watchIdx];
+	if (!ReadDirectoryChangesW(watch->handle, watch->buffer, watch->size, FALSE, watch->flags, NULL, &watch->overlapped, NULL))
+	{
+		if ((GetLastError() != ERROR_INVALID_PARAMETER) || (watch->size <= NOTIFY_BUFFER_NET))
+		{
+			return FALSE;
+		}
+		watch->size = NOTIFY_BUFFER_NET; /*network redirectors reject buffers larger than 64 KB*/
+		return ReadDirectoryChangesW(watch->handle, watch->buffer, watch->size, FALSE, watch->flags, NULL, &watch->overlapped, NULL);
+	}
+	return TRUE;
+}
+
+static BOOL watchInstall(const int watchIdx, const wchar_t *const path, const DWORD flags)
+{
+	dirWatch_state *const watch = &watchState[watchIdx];
+	watch->flags = flags;
+	watch->size = notifyBufferSize;
+	if (!(watch->buffer = (BYTE*) malloc(watch->size)))
+	{
+		return FALSE;
+	}
+	if (!(notifyHandle[watchIdx] = CreateEventW(NULL, TRUE, FALSE, NULL)))
+	{
+		return FALSE;
+	}
+	watch->handle = CreateFileW(path, FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+	if (watch->handle == INVALID_HANDLE_VALUE)
+	{
+		return FALSE;
+	}
+	return watchRequest(watchIdx);
+}
+
+static void watchRelease(const int watchIdx)
+{
+	dirWatch_state *const watch = &watchState[watchIdx];
+	if (watch->handle && (watch->handle != INVALID_HANDLE_VALUE))
+	{
+		if (CancelIo(watch->handle) && (!HasOverlappedIoCompleted(&watch->overlapped)))
+		{
+			DWORD bytes;
+			GetOverlappedResult(watch->handle, &watch->overlapped, &bytes, TRUE);
+		}
+		CloseHandle(watch->handle);
+	}
+	CLOSE_HANDLE(notifyHandle[watchIdx]);
+	FREE(watch->buffer);
+	memset(watch, 0, sizeof(dirWatch_state));
+	notifyHandle[watchIdx] = NULL;
+}
+
+static DWORD watchResult(const int watchIdx, const FILE_NOTIFY_INFORMATION **const info)
+{
+	DWORD bytes = 0U;
+	dirWatch_state *const watch = &watchState[watchIdx];
+	*info = NULL;
+	if (!GetOverlappedResult(watch->handle, &watch->overlapped, &bytes, FALSE))
+	{
+		return GetLastError();
+	}
+	if (bytes > 0U)
+	{
+		*info = (const FILE_NOTIFY_INFORMATION*) watch->buffer;
+	}
+	return ERROR_SUCCESS;
+}
+
+static __inline const FILE_NOTIFY_INFORMATION *nextNotification(const FILE_NOTIFY_INFORMATION *const info)
+{
+	return info->NextEntryOffset ? ((const FILE_NOTIFY_INFORMATION*)(((const BYTE*)info) + info->NextEntryOffset)) : NULL;
+}
+
+static __inline void copyEventName(wchar_t *const buffer, const wchar_t *const name, const DWORD bytes)
+{
+	const size_t length = bytes / sizeof(wchar_t);
+	const size_t count = (length < MAX_PATH) ? length : MAX_PATH;
+	wmemcpy(buffer, name, count);
+	buffer[count] = L'\0';
+}
+
+/* ======================================================================= */
+/* FILE IDENTITY                                                           */
+/* ======================================================================= */
+
+static BOOL getIdentity(const wchar_t *const path, file_identity *const identity)
+{
+	BY_HANDLE_FILE_INFORMATION info;
+	HANDLE handle;
+	BOOL success;
+
+	memset(identity, 0, sizeof(file_identity));
+	handle = CreateFileW(path, FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+	if (handle == INVALID_HANDLE_VALUE)
+	{
+		return FALSE;
+	}
+
+	if (success = GetFileInformationByHandle(handle, &info))
+	{
+		identity->volume = info.dwVolumeSerialNumber;
+		identity->fileId = (((unsigned long long)info.nFileIndexHigh) << 32) | info.nFileIndexLow;
+		identity->valid = TRUE;
+	}
+
+	CloseHandle(handle);
+	return success;
+}
+
+static __inline BOOL sameIdentity(const file_identity *const a, const file_identity *const b)
+{
+	return a->valid && b->valid && (a->volume == b->volume) && (a->fileId == b->fileId);
+}
+
+static BOOL identityChanged(const int fileIdx)
+{
+	file_identity current;
+	if (!fileIdentity[fileIdx].valid)
+	{
+		return FALSE; /*identity unknown*/
+	}
+	return (!getIdentity(fullPath[fileIdx], &current)) || (!sameIdentity(&fileIdentity[fileIdx], &current));
+}
+
+static wchar_t *makeEventPath(const wchar_t *const dirPath, const wchar_t *const name)
+{
+	const size_t dirLen = wcslen(dirPath), nameLen = wcslen(name);
+	const BOOL separator = (dirLen > 0U) && (dirPath[dirLen - 1U] != L'\\');
+	wchar_t *const buffer = (wchar_t*) malloc((dirLen + nameLen + 2U) * sizeof(wchar_t));
+	if (buffer)
+	{
+		wmemcpy(buffer, dirPath, dirLen);
+		if (separator)
+		{
+			buffer[dirLen] = L'\\';
+		}
+		wmemcpy(buffer + dirLen + (separator ? 1U : 0U), name, nameLen + 1U);
+	}
+	return buffer;
+}
+
+static int findMovedFile(const int movedFile, const int dirIdx, const wchar_t *const name, const wchar_t **const newPath)
+{
+	file_identity identity;
+	*newPath = NULL;
+	if ((movedFile < 0) || (!fileIdentity[movedFile].valid))
+	{
+		return -1;
+	}
+	if (!(*newPath = makeEventPath(directoryPath[dirIdx], name)))
+	{
+		return -1;
+	}
+	if (getIdentity(*newPath, &identity) && sameIdentity(&fileIdentity[movedFile], &identity))
+	{
+		return movedFile; /*same file, under a new name*/
+	}
+	FREE(*newPath);
+	*newPath = NULL;
+	return -1;
+}
+
+static BOOL relocateDirectory(const int dirIdx)
+{
+	const fileIndex_list *const list = &dirToFilesMap[dirIdx];
+	const wchar_t *newFullPath[MAXIMUM_FILES];
+	const wchar_t *newPath;
+	int idx;
+
+	//The watch handle follows the directory, even when it is renamed or moved
+	if ((!watchState[dirIdx].handle) || (!(newPath = getPathFromHandle(watchState[dirIdx].handle))))
+	{
+		return FALSE;
+	}
+	if (!_wcsicmp(newPath, directoryPath[dirIdx]))
+	{
+		FREE(newPath);
+		return FALSE; /*directory is still in place*/
+	}
+
+	//Build the new paths of all files in this directory first, so that a failure leaves everything untouched
+	for (idx = 0; idx < list->count; ++idx)
+	{
+		const int fileIdx = dirFiles[list->first + idx];
+		if (!(newFullPath[idx] = directory[fileIdx] ? _wcsdup(newPath) : makeEventPath(newPath, fileName[fileIdx])))
+		{
+			while (idx > 0)
+			{
+				FREE(newFullPath[--idx]);
+			}
+			FREE(newPath);
+			return FALSE;
+		}
+	}
+
+	//Update the path table of this directory only
+	for (idx = 0; idx < list->count; ++idx)
+	{
+		const int fileIdx = dirFiles[list->first + idx];
+		FREE(fullPath[fileIdx]);
+		fullPath[fileIdx] = newFullPath[idx];
+		fileName[fileIdx] = directory[fileIdx] ? L"" : getFileNamePart(newFullPath[idx], newPath);
+		dirFileNames[list->first + idx] = fileName[fileIdx];
+	}
+	FREE(directoryPath[dirIdx]);
+	directoryPath[dirIdx] = newPath;
+
+	return TRUE;
+}
+
+static DWORD getTrackedAttributes(const int fileIdx, unsigned long long *const timeStamp)
+{
+	DWORD attribs = getAttributes(fullPath[fileIdx], timeStamp);
+	if ((attribs == INVALID_FILE_ATTRIBUTES) && relocateDirectory(fileDirIdx[fileIdx]))
+	{
+		attribs = getAttributes(fullPath[fileIdx], timeStamp); /*directory has been moved*/
+	}
+	return attribs;
+}
+
+/* ======================================================================= */
+/* EVENT READER                                                            */
+/* ======================================================================= */
+
+static BOOL ringPush(const int dirIdx, const LONGLONG received, const DWORD action, const wchar_t *const name, const DWORD bytes)
+{
+	const LONG head = eventRing.head, depth = head - eventRing.tail + 1L;
+	event_record *record;
+
+	//Ring is full, the worker must resync this directory
+	if (depth > EVENT_RING_SIZE)
+	{
+		InterlockedIncrement(&eventRing.dropped);
+		InterlockedExchange(&eventRing.lost[dirIdx], 1L);
+		return FALSE;
+	}
+
+	//Fill the next free slot, it is not visible to the worker yet
+	record = &eventRing.records[head & (EVENT_RING_SIZE - 1L)];
+	record->dirIdx = dirIdx;
+	record->action = action;
+	record->received = received;
+	if (record->overflow = (!name))
+	{
+		record->name[0U] = L'\0';
+	}
+	else
+	{
+		copyEventName(record->name, name, bytes);
+	}
+
+	//Publish the slot (InterlockedExchange implies a full memory barrier)
+	InterlockedExchange(&eventRing.head, head + 1L);
+	if (depth > eventRing.depthMax)
+	{
+		eventRing.depthMax = depth;
+	}
+	return TRUE;
+}
+
+static __inline const event_record *ringPeek(void)
+{
+	const LONG tail = eventRing.tail;
+	return (tail != eventRing.head) ? (&eventRing.records[tail & (EVENT_RING_SIZE - 1L)]) : NULL;
+}
+
+static __inline void ringRelease(void)
+{
+	InterlockedExchange(&eventRing.tail, eventRing.tail + 1L);
+}
+
+static unsigned __stdcall readerThreadMain(void *const arg)
+{
+	HANDLE handles[MAXIMUM_WAIT_OBJECTS];
+	const int dirCount = eventRing.dirCount;
+
+	//The first handle is the stop event, followed by all directory watches
+	handles[0U] = eventRing.stopEvent;
+	memcpy(&handles[1U], notifyHandle, dirCount * sizeof(HANDLE));
+
+	for (;;)
+	{
+		const DWORD status = WaitForMultipleObjects(dirCount + 1, handles, FALSE, INFINITE);
+		if ((status > WAIT_OBJECT_0) && (status <= WAIT_OBJECT_0 + dirCount))
+		{
+			const int dirIdx = (int)(status - WAIT_OBJECT_0 - 1U);
+			const LONGLONG received = traceNow();
+			const FILE_NOTIFY_INFORMATION *info = NULL;
+			const DWORD error = watchResult(dirIdx, &info);
+			if ((error != ERROR_SUCCESS) && (error != ERROR_NOTIFY_ENUM_DIR))
+			{
+				break;
+			}
+
+			//Copy the events into the ring, then re-arm the watch right away
+			if (!info)
+			{
+				ringPush(dirIdx, received, 0U, NULL, 0U); /*kernel buffer has overflowed*/
+			}
+			for (; info; info = nextNotification(info))
+			{
+				ringPush(dirIdx, received, info->Action, info->FileName, info->FileNameLength);
+			}
+			if (!watchRequest(dirIdx))
+			{
+				break;
+			}
+			SetEvent(eventRing.dataEvent);
+		}
+		else
+		{
+			if (status == WAIT_OBJECT_0)
+			{
+				return 0U; /*stop requested*/
+			}
+			break;
+		}
+	}
+
+	InterlockedExchange(&eventRing.failed, 1L);
+	SetEvent(eventRing.dataEvent);
+	return 1U;
+}
+
+/* ======================================================================= */
+/* CHANGE JOURNAL                                                          */
+/* ======================================================================= */
+
+static BOOL journalRequest(const int volumeIdx)
+{
+	journal_volume *const volume = &journalVolume[volumeIdx];
+	memset(&volume->overlapped, 0, sizeof(OVERLAPPED));
+	volume->overlapped.hEvent = volume->event;
+	if (!DeviceIoControl(volume->handle, FSCTL_READ_USN_JOURNAL, &volume->request, sizeof(READ_USN_JOURNAL_DATA), volume->buffer, JOURNAL_BUFFER_SIZE, NULL, &volume->overlapped))
+	{
+		return (GetLastError() == ERROR_IO_PENDING);
+	}
+	return TRUE;
+}
+
+static BOOL journalQuery(const int volumeIdx)
+{
+	journal_volume *const volume = &journalVolume[volumeIdx];
+	USN_JOURNAL_DATA journalData;
+	DWORD bytes;
+	OVERLAPPED overlapped;
+
+	//The volume handle is overlapped, so even this short query needs an OVERLAPPED structure
+	memset(&overlapped, 0, sizeof(OVERLAPPED));
+	overlapped.hEvent = volume->event;
+	if (!DeviceIoControl(volume->handle, FSCTL_QUERY_USN_JOURNAL, NULL, 0U, &journalData, sizeof(USN_JOURNAL_DATA), NULL, &overlapped))
+	{
+		if ((GetLastError() != ERROR_IO_PENDING) || (!GetOverlappedResult(volume->handle, &overlapped, &bytes, TRUE)))
+		{
+			return FALSE; /*not NTFS, or the journal is not active*/
+		}
+	}
+
+	//Start reading at the *current* end of the journal
+	memset(&volume->request, 0, sizeof(READ_USN_JOURNAL_DATA));
+	volume->request.StartUsn = journalData.NextUsn;
+	volume->request.ReasonMask = 0xFFFFFFFFUL;
+	volume->request.BytesToWaitFor = 1ULL; /*block until there is at least one record*/
+	volume->request.UsnJournalID = journalData.UsnJournalID;
+#if defined(NTDDI_WIN8) && (NTDDI_VERSION >= NTDDI_WIN8)
+	volume->request.MinMajorVersion = 2U; /*this is the V1 request, only V2 records are understood*/
+	volume->request.MaxMajorVersion = 2U;
+#endif
+	return TRUE;
+}
+
+static int journalOpenVolume(const wchar_t *const directoryPath)
+{
+	wchar_t mountPoint[MAX_PATH + 1U], volumeName[MAX_PATH + 1U], fileSystem[MAX_PATH + 1U];
+	journal_volume *volume;
+	size_t length;
+	int volumeIdx;
+
+	//Find the volume that contains the directory
+	if ((!GetVolumePathNameW(directoryPath, mountPoint, MAX_PATH)) || (!GetVolumeNameForVolumeMountPointW(mountPoint, volumeName, MAX_PATH)))
+	{
+		return -1;
+	}
+
+	//Only NTFS writes V2 records, ReFS uses V3 records with 128-Bit file IDs
+	if ((!GetVolumeInformationW(mountPoint, NULL, 0U, NULL, NULL, NULL, fileSystem, MAX_PATH)) || _wcsicmp(fileSystem, L"NTFS"))
+	{
+		return -1;
+	}
+	if ((length = wcslen(volumeName)) && (volumeName[length - 1U] == L'\\'))
+	{
+		volumeName[length - 1U] = L'\0'; /*open the volume, not its root directory*/
+	}
+	for (volumeIdx = 0; volumeIdx < journalVolumeCount; ++volumeIdx)
+	{
+		if (!_wcsicmp(journalVolume[volumeIdx].name, volumeName))
+		{
+			return volumeIdx;
+		}
+	}
+
+	//Open the volume, this requires administrator rights
+	volume = &journalVolume[volumeIdx = journalVolumeCount++];
+	wcscpy(volume->name, volumeName);
+	if (!(volume->buffer = (BYTE*) malloc(JOURNAL_BUFFER_SIZE)))
+	{
+		return -1;
+	}
+	if (!(volume->event = CreateEventW(NULL, TRUE, FALSE, NULL)))
+	{
+		return -1;
+	}
+	volume->handle = CreateFileW(volumeName, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_FLAG_OVERLAPPED, NULL);
+	if (volume->handle == INVALID_HANDLE_VALUE)
+	{
+		volume->handle = NULL;
+		return -1;
+	}
+
+	return journalQuery(volumeIdx) ? volumeIdx : (-1);
+}
+
+static BOOL journalInstall(const int dirCount)
+{
+	int dirIdx, volumeIdx;
+
+	//Each directory is identified by its volume and its file reference number
+	for (dirIdx = 0; dirIdx < dirCount; ++dirIdx)
+	{
+		BY_HANDLE_FILE_INFORMATION info;
+		HANDLE handle;
+		if ((journalDirVolume[dirIdx] = journalOpenVolume(directoryPath[dirIdx])) < 0)
+		{
+			return FALSE;
+		}
+		handle = CreateFileW(directoryPath[dirIdx], FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+		if (handle == INVALID_HANDLE_VALUE)
+		{
+			return FALSE;
+		}
+		if (!GetFileInformationByHandle(handle, &info))
+		{
+			CloseHandle(handle);
+			return FALSE;
+		}
+		journalDirRef[dirIdx] = (((unsigned long long)info.nFileIndexHigh) << 32) | info.nFileIndexLow;
+		CloseHandle(handle);
+	}
+
+	//Request the first batch of records from each volume
+	for (volumeIdx = 0; volumeIdx < journalVolumeCount; ++volumeIdx)
+	{
+		if (!journalRequest(volumeIdx))
+		{
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+static void journalRelease(void)
+{
+	int volumeIdx;
+	for (volumeIdx = 0; volumeIdx < journalVolumeCount; ++volumeIdx)
+	{
+		journal_volume *const volume = &journalVolume[volumeIdx];
+		if (volume->handle)
+		{
+			if (CancelIo(volume->handle) && (!HasOverlappedIoCompleted(&volume->overlapped)))
+			{
+				DWORD bytes;
+				GetOverlappedResult(volume->handle, &volume->overlapped, &bytes, TRUE);
+			}
+			CloseHandle(volume->handle);
+		}
+		CLOSE_HANDLE(volume->event);
+		FREE(volume->buffer);
+		memset(volume, 0, sizeof(journal_volume));
+	}
+	journalVolumeCount = 0;
+}
+
+static DWORD journalAction(const DWORD reason)
+{
+	if (reason & USN_REASON_RENAME_OLD_NAME)
+	{
+		return FILE_ACTION_RENAMED_OLD_NAME;
+	}
+	if (reason & USN_REASON_RENAME_NEW_NAME)
+	{
+		return FILE_ACTION_RENAMED_NEW_NAME;
+	}
+	if (reason & USN_REASON_FILE_DELETE)
+	{
+		return FILE_ACTION_REMOVED;
+	}
+	return (reason & USN_REASON_FILE_CREATE) ? FILE_ACTION_ADDED : FILE_ACTION_MODIFIED;
+}
+
+static void journalDispatch(const int volumeIdx, const LONGLONG received, const BYTE *const buffer, const DWORD bytes)
+{
+	const BYTE *position = buffer + sizeof(USN);
+	int dirIdx;
+
+	//Only records whose parent is one of the watched directories are of interest
+	while (position + sizeof(USN_RECORD) <= buffer + bytes)
+	{
+		const USN_RECORD *const record = (const USN_RECORD*) position;
+		if ((record->RecordLength < sizeof(USN_RECORD)) || (position + record->RecordLength > buffer + bytes))
+		{
+			break;
+		}
+		if (record->MajorVersion != 2U)
+		{
+			if (!InterlockedExchange(&journalWarned, 1L))
+			{
+				fwprintf(stderr, L"Warning: Unsupported change journal record version %u.%u. Re-scanning instead!\n\n", record->MajorVersion, record->MinorVersion);
+			}
+			for (dirIdx = 0; dirIdx < eventRing.dirCount; ++dirIdx)
+			{
+				if (journalDirVolume[dirIdx] == volumeIdx)
+				{
+					ringPush(dirIdx, received, 0U, NULL, 0U); /*the record can not be decoded, force a resync*/
+				}
+			}
+		}
+		else
+		{
+			for (dirIdx = 0; dirIdx < eventRing.dirCount; ++dirIdx)
+			{
+				if (journalDirVolume[dirIdx] != volumeIdx)
+				{
+					continue;
+				}
+				if (record->ParentFileReferenceNumber == journalDirRef[dirIdx])
+				{
+					ringPush(dirIdx, received, journalAction(record->Reason), (const wchar_t*)(position + record->FileNameOffset), record->FileNameLength);
+				}
+				else if (record->FileReferenceNumber == journalDirRef[dirIdx])
+				{
+					ringPush(dirIdx, received, 0U, NULL, 0U); /*the directory itself has changed*/
+				}
+			}
+		}
+		position += record->RecordLength;
+	}
+}
+
+static unsigned __stdcall journalThreadMain(void *const arg)
+{
+	HANDLE handles[MAXIMUM_WAIT_OBJECTS];
+	int volumeIdx, dirIdx;
+
+	//The first handle is the stop event, followed by all volumes
+	handles[0U] = eventRing.stopEvent;
+	for (volumeIdx = 0; volumeIdx < journalVolumeCount; ++volumeIdx)
+	{
+		handles[volumeIdx + 1] = journalVolume[volumeIdx].event;
+	}
+
+	for (;;)
+	{
+		const DWORD status = WaitForMultipleObjects(journalVolumeCount + 1, handles, FALSE, INFINITE);
+		if ((status > WAIT_OBJECT_0) && (status <= WAIT_OBJECT_0 + journalVolumeCount))
+		{
+			journal_volume *const volume = &journalVolume[volumeIdx = (int)(status - WAIT_OBJECT_0 - 1U)];
+			const LONGLONG received = traceNow();
+			DWORD bytes = 0U;
+			if (GetOverlappedResult(volume->handle, &volume->overlapped, &bytes, FALSE))
+			{
+				if (bytes >= sizeof(USN))
+				{
+					journalDispatch(volumeIdx, received, volume->buffer, bytes);
+					volume->request.StartUsn = *((const USN*)volume->buffer);
+				}
+			}
+			else if ((GetLastError() == ERROR_JOURNAL_ENTRY_DELETED) && journalQuery(volumeIdx))
+			{
+				for (dirIdx = 0; dirIdx < eventRing.dirCount; ++dirIdx)
+				{
+					if (journalDirVolume[dirIdx] == volumeIdx)
+					{
+						ringPush(dirIdx, received, 0U, NULL, 0U); /*records were lost, force a resync*/
+					}
+				}
+			}
+			else
+			{
+				break;
+			}
+			if (!journalRequest(volumeIdx))
+			{
+				break;
+			}
+			SetEvent(eventRing.dataEvent);
+		}
+		else
+		{
+			if (status == WAIT_OBJECT_0)
+			{
+				return 0U; /*stop requested*/
+			}
+			break;
+		}
+	}
+
+	InterlockedExchange(&eventRing.failed, 1L);
+	SetEvent(eventRing.dataEvent);
+	return 1U;
+}
+
+/* ======================================================================= */
+/* READER THREAD                                                           */
+/* ======================================================================= */
+
+static BOOL readerStart(const int dirCount, const BOOL useJournal)
+{
+	eventRing.dirCount = dirCount;
+	if (!(eventRing.dataEvent = CreateEventW(NULL, FALSE, FALSE, NULL)))
+	{
+		return FALSE;
+	}
+	if (!(eventRing.stopEvent = CreateEventW(NULL, TRUE, FALSE, NULL)))
+	{
+		return FALSE;
+	}
+	if (!(eventRing.thread = (HANDLE) _beginthreadex(NULL, 0U, useJournal ? journalThreadMain : readerThreadMain, NULL, 0U, NULL)))
+	{
+		return FALSE;
+	}
+	SetThreadPriority(eventRing.thread, THREAD_PRIORITY_ABOVE_NORMAL);
+	return TRUE;
+}
+
+static void readerStop(void)
+{
+	if (eventRing.thread)
+	{
+		SetEvent(eventRing.stopEvent);
+		WaitForSingleObject(eventRing.thread, INFINITE);
+		CloseHandle(eventRing.thread);
+		eventRing.thread = NULL;
+	}
+	CLOSE_HANDLE(eventRing.dataEvent);
+	CLOSE_HANDLE(eventRing.stopEvent);
+	eventRing.dataEvent = eventRing.stopEvent = NULL;
+}
+
+/* ======================================================================= */
+/* PENDING TARGETS                                                         */
+/* ======================================================================= */
+
+#define IS_PATH_SEP(C) (((C) == L'\\') || ((C) == L'/'))
+
+static size_t getRootLength(const wchar_t *const path)
+{
+	size_t offset = 0U, pos;
+	BOOL unc = FALSE;
+	if ((!wcsncmp(path, L"\\\\?\\", 4U)) || (!wcsncmp(path, L"\\\\.\\", 4U)))
+	{
+		offset = 4U;
+		if (!_wcsnicmp(path + offset, L"UNC\\", 4U))
+		{
+			offset += 4U;
+			unc = TRUE;
+		}
+	}
+	else if (IS_PATH_SEP(path[0U]) && IS_PATH_SEP(path[1U]))
+	{
+		offset = 2U;
+		unc = TRUE;
+	}
+	if (!unc)
+	{
+		if (iswalpha(path[offset]) && (path[offset + 1U] == L':') && IS_PATH_SEP(path[offset + 2U]))
+		{
+			return offset + 3U; /*drive root, e.g. "C:\"*/
+		}
+		return 0U;
+	}
+	for (pos = offset; path[pos] && (!IS_PATH_SEP(path[pos])); ++pos);
+	if ((pos == offset) || (!path[pos]))
+	{
+		return 0U;
+	}
+	for (offset = ++pos; path[pos] && (!IS_PATH_SEP(path[pos])); ++pos);
+	if (pos == offset)
+	{
+		return 0U;
+	}
+	return path[pos] ? (pos + 1U) : pos; /*share root, e.g. "\\server\share\"*/
+}
+
+static int pendingWalk(pendingTarget_state *const target)
+{
+	const size_t length = wcslen(target->path), rootLen = getRootLength(target->path);
+	wchar_t *buffer;
+	size_t pos = rootLen;
+	int result = 0;
+
+	if ((!rootLen) || (!(buffer = _wcsdup(target->path))))
+	{
+		return -1;
+	}
+
+	//The root of the path must exist
+	buffer[rootLen] = L'\0';
+	if (GetFileAttributesW(buffer) == INVALID_FILE_ATTRIBUTES)
+	{
+		FREE(buffer);
+		return -1;
+	}
+
+	//Walk down, one path component at a time, until a component is missing
+	target->ancestorLen = rootLen;
+	buffer[rootLen] = target->path[rootLen];
+	while (pos < length)
+	{
+		DWORD attribs;
+		size_t next;
+		for (next = pos; (next < length) && (!IS_PATH_SEP(buffer[next])); ++next);
+		if (next == pos)
+		{
+			pos = next + 1U; /*skip duplicate separator*/
+			continue;
+		}
+		buffer[next] = L'\0';
+		attribs = GetFileAttributesW(buffer);
+		buffer[next] = target->path[next];
+		if (attribs == INVALID_FILE_ATTRIBUTES)
+		{
+			break; /*component does not exist yet*/
+		}
+		if (next >= length)
+		{
+			result = 1; /*the full path exists now*/
+			break;
+		}
+		if (!(attribs & FILE_ATTRIBUTE_DIRECTORY))
+		{
+			break; /*a file is blocking the path*/
+		}
+		target->ancestorLen = next;
+		pos = next + 1U;
+	}
+
+	FREE(buffer);
+	return result;
+}
+
+static BOOL pendingEventMatches(const pendingTarget_state *const target, const FILE_NOTIFY_INFORMATION *const info)
+{
+	const wchar_t *component = target->path + target->ancestorLen;
+	size_t length = 0U;
+	while (IS_PATH_SEP(*component))
+	{
+		component++;
+	}
+	while (component[length] && (!IS_PATH_SEP(component[length])))
+	{
+		length++;
+	}
+	return (info->FileNameLength == length * sizeof(wchar_t)) && (!_wcsnicmp(info->FileName, component, length));
+}
+
+static int pendingUpdate(const int pendingIdx, const int watchIdx)
+{
+	pendingTarget_state *const target = &pendingTarget[pendingIdx];
+	for (;;)
+	{
+		const size_t previousLen = watchState[watchIdx].handle ? target->ancestorLen : 0U;
+		const int status = pendingWalk(target);
+		wchar_t *ancestor;
+		BOOL success;
+		if (status)
+		{
+			return status;
+		}
+		if (watchState[watchIdx].handle && (target->ancestorLen == previousLen))
+		{
+			return 0; /*nearest existing ancestor is being watched*/
+		}
+		watchRelease(watchIdx);
+		if (!(ancestor = _wcsdup(target->path)))
+		{
+			return -1;
+		}
+		ancestor[target->ancestorLen] = L'\0';
+		success = watchInstall(watchIdx, ancestor, CREATE_FLAGS);
+		FREE(ancestor);
+		if (!success)
+		{
+			watchRelease(watchIdx);
+			return -1;
+		}
+		/*walk again, components may have been created before the watch was installed*/
+	}
+}
+
+/* ======================================================================= */
+/* WRITE COMPLETION                                                        */
+/* ======================================================================= */
+
+static BOOL hasOpenWriters(const wchar_t *const path)
+{
+	//Note: A reader that did *not* grant FILE_SHARE_WRITE can not be told apart from a writer here
+	const HANDLE handle = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (handle == INVALID_HANDLE_VALUE)
+	{
+		return (GetLastError() == ERROR_SHARING_VIOLATION); /*still opened for writing*/
+	}
+	CloseHandle(handle);
+	return FALSE;
+}
+
+static BOOL waitForWriters(const wchar_t *const path, const DWORD timeout, const BOOL debug)
+{
+	const DWORD startTime = GetTickCount();
+	const wchar_t *directoryPart;
+	HANDLE change = INVALID_HANDLE_VALUE, waitHandles[2U];
+	DWORD delay = CLOSE_DELAY_MIN, probes = 1U, handleCount = 0U;
+	BOOL closed = TRUE;
+
+	if (!hasOpenWriters(path))
+	{
+		return TRUE;
+	}
+
+	//Writes to the file cause directory notifications, so we can sleep until something happens
+	if (directoryPart = getDirectoryPart(path))
+	{
+		change = FindFirstChangeNotificationW(directoryPart, FALSE, FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE);
+		FREE(directoryPart);
+	}
+
+	//The interrupt is always watched, the directory only if the notification could be set up
+	waitHandles[handleCount++] = getInterruptEvent();
+	if (change != INVALID_HANDLE_VALUE)
+	{
+		waitHandles[handleCount++] = change;
+	}
+
+	//Re-probe on each notification, or after the back-off delay has expired
+	for (;;)
+	{
+		DWORD wait = delay, status;
+		if (timeout != INFINITE)
+		{
+			const DWORD elapsed = GetTickCount() - startTime;
+			if (elapsed >= timeout)
+			{
+				closed = FALSE;
+				break;
+			}
+			if (timeout - elapsed < wait)
+			{
+				wait = timeout - elapsed;
+			}
+		}
+		status = WaitForMultipleObjects(handleCount, waitHandles, FALSE, wait);
+		if (status == WAIT_OBJECT_0 + 1U)
+		{
+			FindNextChangeNotification(change);
+			delay = CLOSE_DELAY_MIN; /*writer is active*/
+			status = WaitForSingleObject(waitHandles[0U], (wait < CLOSE_DELAY_MIN) ? wait : CLOSE_DELAY_MIN); /*coalesce the notifications of a busy writer*/
+		}
+		else if (status == WAIT_TIMEOUT)
+		{
+			delay = (delay < (CLOSE_DELAY_MAX / 2U)) ? (2U * delay) : CLOSE_DELAY_MAX;
+		}
+		if (status != WAIT_TIMEOUT)
+		{
+			closed = FALSE; /*interrupted, or the wait has failed*/
+			break;
+		}
+		++probes;
+		if (!hasOpenWriters(path))
+		{
+			break;
+		}
+	}
+
+	if (debug)
+	{
+		fwprintf(stderr, L"Closed: %s [probes: %u, time: %u ms%s]\n", path, probes, GetTickCount() - startTime, closed ? L"" : L", timeout");
+	}
+
+	if (change != INVALID_HANDLE_VALUE)
+	{
+		FindCloseChangeNotification(change);
+	}
+
+	return closed;
+}
+
+/* ======================================================================= */
+/* POLLING ENGINE                                                          */
+/* ======================================================================= */
+
+static void pollScanQueue(pollDirectory_queue *const queue)
+{
+	LONG next;
+	while ((next = InterlockedIncrement(&queue->next) - 1L) < queue->count)
+	{
+		const int dirIdx = queue->dirs[next];
+		pollDirectory_state *const state = &pollState[dirIdx];
+		state->success = snapshotScan(&state->current, directoryPath[dirIdx], state->nameCount ? state->names : NULL, state->nameCount);
+	}
+}
+
+static unsigned __stdcall pollThreadMain(void *const arg)
+{
+	for (;;)
+	{
+		if ((WaitForSingleObject(pollPool.start, INFINITE) != WAIT_OBJECT_0) || pollPool.stop)
+		{
+			break;
+		}
+		pollScanQueue(pollPool.queue);
+		if (!InterlockedDecrement(&pollPool.pending))
+		{
+			SetEvent(pollPool.done); /*last worker of this round*/
+		}
+	}
+	return 0U;
+}
+
+static void pollPoolOpen(const int dirCount)
+{
+	//The worker threads are created once and then re-used for each round
+	memset(&pollPool, 0, sizeof(pollWorker_pool));
+	if (dirCount < 2)
+	{
+		return; /*the current thread does all the work*/
+	}
+	if (!((pollPool.start = CreateSemaphoreW(NULL, 0L, POLL_THREADS, NULL)) && (pollPool.done = CreateEventW(NULL, FALSE, FALSE, NULL))))
+	{
+		return;
+	}
+	while ((pollPool.threadCount < POLL_THREADS) && (pollPool.threadCount < (DWORD)(dirCount - 1)))
+	{
+		const HANDLE thread = (HANDLE) _beginthreadex(NULL, 0U, pollThreadMain, NULL, 0U, NULL);
+		if (!thread)
+		{
+			break;
+		}
+		pollPool.threads[pollPool.threadCount++] = thread;
+	}
+}
+
+static void pollPoolClose(void)
+{
+	DWORD idx;
+
+	//Wake up all worker threads, so that they can exit
+	if (pollPool.threadCount > 0U)
+	{
+		InterlockedExchange(&pollPool.stop, 1L);
+		ReleaseSemaphore(pollPool.start, (LONG)pollPool.threadCount, NULL);
+		WaitForMultipleObjects(pollPool.threadCount, pollPool.threads, TRUE, INFINITE);
+		for (idx = 0U; idx < pollPool.threadCount; ++idx)
+		{
+			CloseHandle(pollPool.threads[idx]);
+		}
+	}
+
+	CLOSE_HANDLE(pollPool.start);
+	CLOSE_HANDLE(pollPool.done);
+	memset(&pollPool, 0, sizeof(pollWorker_pool));
+}
+
+static BOOL pollRunQueue(pollDirectory_queue *const queue)
+{
+	LONG workers = 0L;
+
+	//Scan all queued directories, in parallel if there is more than one
+	queue->next = 0L;
+	if ((queue->count > 1L) && (pollPool.threadCount > 0U))
+	{
+		workers = ((LONG)pollPool.threadCount < (queue->count - 1L)) ? (LONG)pollPool.threadCount : (queue->count - 1L);
+		pollPool.queue = queue;
+		pollPool.pending = workers;
+		if (!ReleaseSemaphore(pollPool.start, workers, NULL))
+		{
+			workers = 0L;
+		}
+	}
+	pollScanQueue(queue); /*current thread helps out*/
+
+	//Wait for pending scans to complete
+	if (workers > 0L)
+	{
+		return (WaitForSingleObject(pollPool.done, INFINITE) == WAIT_OBJECT_0);
+	}
+
+	return TRUE;
+}
+
+static void pollMatchCallback(void *const context, const int action, const snapshot_entry *const entry)
+{
+	pollDirectory_match *const match = (pollDirectory_match*) context;
+	if (match->fileIdx < 0)
+	{
+		match->fileIdx = (dirToFilesMap[match->dirIdx].dirTarget >= 0) ? dirToFilesMap[match->dirIdx].dirTarget : findFileInDirectory(match->dirIdx, entry->name);
+	}
+}
+
+static BOOL pollInitialize(const int dirCount, const BOOL namesOnly)
+{
+	pollDirectory_queue queue;
+	int dirIdx, idx;
+
+	//Scan the full directory when it is watched itself, otherwise only the watched files
+	for (queue.count = 0L, dirIdx = 0; dirIdx < dirCount; ++dirIdx)
+	{
+		pollDirectory_state *const state = &pollState[dirIdx];
+		snapshotInit(&state->snapshot);
+		snapshotInit(&state->current);
+		if (dirToFilesMap[dirIdx].dirTarget < 0)
+		{
+			state->names = &dirFileNames[dirToFilesMap[dirIdx].first];
+			state->nameCount = dirToFilesMap[dirIdx].count;
+		}
+		else if (namesOnly)
+		{
+			continue; /*any event in a watched directory is reported right away*/
+		}
+		queue.dirs[queue.count++] = dirIdx;
+	}
+
+	//Take the initial snapshot of the selected directories
+	pollPoolOpen(queue.count);
+	if (!pollRunQueue(&queue))
+	{
+		return FALSE;
+	}
+	if (namesOnly)
+	{
+		pollPoolClose(); /*only needed for periodic scans*/
+	}
+	for (idx = 0; idx < queue.count; ++idx)
+	{
+		pollDirectory_state *const state = &pollState[queue.dirs[idx]];
+		if (state->success)
+		{
+			snapshotSwap(&state->snapshot, &state->current);
+			state->cost = state->nameCount ? state->nameCount : state->snapshot.count;
+			state->valid = TRUE;
+		}
+	}
+
+	return TRUE;
+}
+
+static int pollForChanges(const int dirCount, const DWORD interval, const DWORD budget, const BOOL opt_debug)
+{
+	DWORD currentInterval = interval;
+	int cursor = 0, idx;
+
+	for (;;)
+	{
+		pollDirectory_queue queue;
+		size_t cost = 0U;
+		DWORD elapsed = GetTickCount();
+
+		//Select the directories for this round, within the I/O budget
+		for (queue.count = 0L; queue.count < dirCount; ++queue.count)
+		{
+			const int dirIdx = (cursor + queue.count) % dirCount;
+			const size_t dirCost = (pollState[dirIdx].cost > 0U) ? pollState[dirIdx].cost : 1U;
+			if ((queue.count > 0L) && ((cost + dirCost) > budget))
+			{
+				break;
+			}
+			queue.dirs[queue.count] = dirIdx;
+			cost += dirCost;
+		}
+		cursor = (cursor + queue.count) % dirCount;
+
+		//Scan the selected directories
+		if (!pollRunQueue(&queue))
+		{
+			wprintln(stderr, L"System Error: Failed to wait for directory scan!\n");
+			return -1;
+		}
+		elapsed = GetTickCount() - elapsed;
+
+		//Compare against the previous snapshot
+		for (idx = 0; idx < queue.count; ++idx)
+		{
+			pollDirectory_state *const state = &pollState[queue.dirs[idx]];
+			pollDirectory_match match;
+			match.dirIdx = queue.dirs[idx];
+			match.fileIdx = -1;
+			if (!state->success)
+			{
+				return dirFiles[dirToFilesMap[match.dirIdx].first]; /*directory has become inaccessible*/
+			}
+			if (state->valid)
+			{
+				snapshotDiff(&state->snapshot, &state->current, pollMatchCallback, &match);
+			}
+			snapshotSwap(&state->snapshot, &state->current);
+			state->cost = state->nameCount ? state->nameCount : state->snapshot.count;
+			state->valid = TRUE;
+			if (match.fileIdx >= 0)
+			{
+				return match.fileIdx;
+			}
+		}
+
+		//Keep the interval at least 4x the scan duration, so that slow shares are not hammered
+		currentInterval = interval;
+		if (currentInterval < 4U * elapsed)
+		{
+			currentInterval = (4U * elapsed < POLL_INTERVAL_MAX) ? (4U * elapsed) : POLL_INTERVAL_MAX;
+		}
+
+		//Print DEBUG information
+		if (opt_debug)
+		{
+			fwprintf(stderr, L"Poll: %ld directories, %lu entries, %lu ms, next in %lu ms\n", queue.count, (DWORD)cost, elapsed, currentInterval);
+		}
+
+		//Sleep until the next round, or until interrupted
+		if (WaitForSingleObject(getInterruptEvent(), currentInterval) != WAIT_TIMEOUT)
+		{
+			return -1;
+		}
+	}
+}
+
+static int pollResync(const int dirIdx)
+{
+	pollDirectory_state *const state = &pollState[dirIdx];
+	pollDirectory_match match;
+
+	if ((!state->valid) || (!state->nameCount))
+	{
+		return -1;
+	}
+
+	//Re-scan the watched files and compare against the last known snapshot
+	match.dirIdx = dirIdx;
+	match.fileIdx = -1;
+	if (!snapshotScan(&state->current, directoryPath[dirIdx], state->names, state->nameCount))
+	{
+		return dirFiles[dirToFilesMap[dirIdx].first]; /*directory has become inaccessible*/
+	}
+	snapshotDiff(&state->snapshot, &state->current, pollMatchCallback, &match);
+	snapshotSwap(&state->snapshot, &state->current);
+
+	return match.fileIdx;
+}
+
+static void pollRelease(const int dirCount)
 {
-	switch (dwCtrlTyp)
+	int dirIdx;
+	pollPoolClose();
+	for (dirIdx = 0; dirIdx < dirCount; ++dirIdx)
 	{
-	case CTRL_C_EVENT:
-		wprintln(stderr, L"Ctrl+C: Notifywait has been interrupted !!!\n");
-		break;
-	case CTRL_BREAK_EVENT:
-		wprintln(stderr, L"Break: Notifywait has been interrupted !!!\n");
-		break;
-	default:
-		return FALSE;
+		snapshotFree(&pollState[dirIdx].snapshot);
+		snapshotFree(&pollState[dirIdx].current);
 	}
-
-	fflush(stderr);
-	_exit(2);
-	return TRUE;
 }
 
 /* ======================================================================= */
-/* HELPER MACROS AND TYPES                                                 */
+/* STATE DATABASE                                                          */
 /* ======================================================================= */
 
-#define MAXIMUM_FILES 32 /*maximum number of files*/
-#define NOTIFY_FLAGS (FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME | FILE_NOTIFY_CHANGE_ATTRIBUTES | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_CREATION)
+static int stateCompare(const wchar_t *const stateFile, const int fileCount, const BOOL withHash, BOOL *const baseline)
+{
+	statedb_t db;
+	int fileIdx, changes = 0;
 
-#define TRY_PARSE_OPTION(NAME) \
-	if (!_wcsicmp(argv[argOffset] + 2U, L#NAME)) \
-	{ \
-		opt_##NAME = TRUE; \
-		continue; \
+	//A corrupted database is rebuilt from scratch
+	if (!statedbOpen(&db, stateFile))
+	{
+		fwprintf(stderr, L"Warning: State file \"%s\" is invalid and will be rebuilt!\n\n", stateFile);
 	}
 
-#define CHECK_IF_MODFIED(IDX) do \
-{ \
-	unsigned long long _timeStamp; \
-	const DWORD _attribs = getAttributes(fullPath[(IDX)], &_timeStamp); \
-	if ((_attribs == INVALID_FILE_ATTRIBUTES) || (_attribs & FILE_ATTRIBUTE_DIRECTORY) || (_attribs & FILE_ATTRIBUTE_ARCHIVE) || (_timeStamp != lastModTs[(IDX)])) \
-	{ \
-		if (!opt_quiet) \
-		{ \
-			fwprintf(stdout, L"%s\n", fullPath[(IDX)]); /*file was modified*/ \
-		} \
-		goto success; \
-	} \
-} \
-while(0)
-
-#define APPEND_TO_MAP(IDX,VALUE) do \
-{ \
-	dirToFilesMap[(IDX)].files[dirToFilesMap[(IDX)].count++] = (VALUE); \
-} \
-while(0)
+	//Compare the current state of each file to the state of the previous run
+	*baseline = FALSE;
+	for (fileIdx = 0; fileIdx < fileCount; ++fileIdx)
+	{
+		const statedb_entry *const previous = statedbFind(&db, fullPath[fileIdx]);
+		stateChanged[fileIdx] = FALSE;
+		if (!previous)
+		{
+			*baseline = TRUE; /*not seen before*/
+			continue;
+		}
+		if ((!statedbQuery(&stateEntry[fileIdx], fullPath[fileIdx], withHash)) || (!statedbEqual(previous, &stateEntry[fileIdx])))
+		{
+			stateChanged[fileIdx] = TRUE;
+			++changes;
+		}
+	}
 
-#define CLOSE_NOTIFY_HANDLE(H) do \
-{ \
-	if ((H) && ((H) != INVALID_HANDLE_VALUE)) \
-	{ \
-		FindCloseChangeNotification((H)); \
-	} \
-} \
-while(0)
+	statedbClose(&db);
+	return changes;
+}
 
-typedef struct
+static BOOL stateUpdate(const wchar_t *const stateFile, const int fileCount, const BOOL withHash)
 {
-	int count;
-	int files[MAXIMUM_FILES];
-}
-fileIndex_list;
+	statedb_t db;
+	int fileIdx;
+	size_t count = 0U;
 
-#define BOOLIFY(X) (!(!(X)))
+	if (!statedbOpen(&db, stateFile))
+	{
+		statedbClose(&db); /*start over with an empty database*/
+	}
+
+	for (fileIdx = 0; fileIdx < fileCount; ++fileIdx)
+	{
+		if (statedbQuery(&stateEntry[count], fullPath[fileIdx], withHash))
+		{
+			++count;
+		}
+	}
+
+	return statedbCommit(&db, stateFile, stateEntry, count);
+}
 
 /* ======================================================================= */
 /* MAIN                                                                    */
 /* ======================================================================= */
 
-/*Globals*/
-static const wchar_t *fullPath[MAXIMUM_FILES];
-static BOOL directory[MAXIMUM_FILES];
-static const wchar_t* directoryPath[MAXIMUM_FILES];
-static unsigned long long lastModTs[MAXIMUM_FILES];
-static fileIndex_list dirToFilesMap[MAXIMUM_FILES];
-static HANDLE notifyHandle[MAXIMUM_FILES];
-
 int wmain(int argc, wchar_t *argv[])
 {
-	BOOL opt_clear = FALSE, opt_reset = FALSE, opt_quiet = FALSE, opt_debug = FALSE;
-	int result = EXIT_FAILURE, argOffset = 1, fileCount = 0, fileIdx = 0, dirCount = 0, dirIdx = 0;
+	BOOL opt_clear = FALSE, opt_reset = FALSE, opt_quiet = FALSE, opt_poll = FALSE, opt_create = FALSE, opt_closed = FALSE, opt_trace = FALSE, opt_hash = FALSE, opt_journal = FALSE, opt_debug = FALSE, useJournal = FALSE;
+	DWORD pollInterval = 1000U, pollBudget = POLL_BUDGET, closeTimeout = INFINITE, overflowCount = 0U;
+	const wchar_t *stateFile = NULL, *movedPath = NULL;
+	HANDLE interrupt = NULL;
+	int result = EXIT_FAILURE, argOffset = 1, fileCount = 0, fileIdx = 0, dirCount = 0, dirIdx = 0, pendingCount = 0, pendingIdx = 0, movedFile = -1;
 
 	//Initialize
 	INITIALIZE_C_RUNTIME();
+	if (!outputOpen(&stdOutput, GetStdHandle(STD_OUTPUT_HANDLE), OUTPUT_BUFFER_SIZE))
+	{
+		wprintln(stderr, L"Error: Memory allocation has failed!\n");
+		return EXIT_FAILURE;
+	}
+	stdOutput.flushMode = OUTPUT_FLUSH_LINE; /*the consumer is waiting for each change, even on a pipe*/
+	if (!(interrupt = getInterruptEvent()))
+	{
+		wprintln(stderr, L"System Error: Failed to set up the interrupt handler!\n");
+		return EXIT_FAILURE;
+	}
 
 	//Check command-line arguments
 	if ((argc < 2) || (!_wcsicmp(argv[1U], L"/?")) || (!_wcsicmp(argv[1U], L"--help")))
@@ -113,20 +1803,39 @@ int wmain(int argc, wchar_t *argv[])
 		wprintln(stderr, L"Usage:");
 		wprintln(stderr, L"   notifywait.exe [options] <name_1> [<name_2> ... <name_N>]\n");
 		wprintln(stderr, L"Options:");
-		wprintln(stderr, L"   --clear  unset the \"archive\" bit *before* monitoring for file changes");
-		wprintln(stderr, L"   --reset  unset the \"archive\" bit *after* a file change was detected");
-		wprintln(stderr, L"   --quiet  do *not* print the file name that changed to standard output");
-		wprintln(stderr, L"   --debug  turn *on* additional diagnostic output (for testing only!)\n");
+		wprintln(stderr, L"   --clear   unset the \"archive\" bit *before* monitoring for file changes");
+		wprintln(stderr, L"   --reset   unset the \"archive\" bit *after* a file change was detected");
+		wprintln(stderr, L"   --quiet   do *not* print the file name that changed to standard output");
+		wprintln(stderr, L"   --poll    detect changes by periodic scans, e.g. on network file systems");
+		wprintln(stderr, L"   --create  wait for non-existing files to be created (not with --poll)");
+		wprintln(stderr, L"   --closed  after a change, wait until all writers have closed the file");
+		wprintln(stderr, L"   --state   <file> save the file states, report changes since the last run");
+		wprintln(stderr, L"   --hash    with --state, also compare a hash of the file content");
+		wprintln(stderr, L"   --journal read the NTFS change journal instead of watching each directory");
+		wprintln(stderr, L"   --trace   measure the detection latency and print statistics on exit");
+		wprintln(stderr, L"   --debug   turn *on* additional diagnostic output (for testing only!)\n");
+		wprintln(stderr, L"Environment:");
+		wprintln(stderr, L"   NOTIFYWAIT_POLL_INTERVAL  minimum polling interval in milliseconds (default: 1000)");
+		wprintln(stderr, L"   NOTIFYWAIT_POLL_BUDGET    maximum directory entries read per polling round");
+		wprintln(stderr, L"   NOTIFYWAIT_BUFFER_SIZE    size of the change notification buffer in KB (default: 256)");
+		wprintln(stderr, L"   NOTIFYWAIT_CLOSE_TIMEOUT  maximum time to wait for writers, in milliseconds");
+		wprintln(stderr, L"   NOTIFYWAIT_RETRY_BUDGET   time to retry locked files, in milliseconds (default: 28)");
+		wprintln(stderr, L"   NOTIFYWAIT_TRACE_FILE     write the raw --trace timeline to this file\n");
 		wprintln(stderr, L"Exit status:");
 		wprintln(stderr, L"   0 - File change was detected");
 		wprintln(stderr, L"   1 - Failed with error");
-		wprintln(stderr, L"   2 - Interrupted by user\n");
+		wprintln(stderr, L"   2 - Interrupted by user");
+		wprintln(stderr, L"   3 - Writers did not close the file in time\n");
 		wprintln(stderr, L"Remarks:");
 		wprintln(stderr, L"   The operating system sets the \"archive\" bit whenever a file is changed.");
 		wprintln(stderr, L"   If a file's \"archive\" bit is already set, a change is detected right away.");
 		wprintln(stderr, L"   Either clear the \"archive\" bit beforehand, or use the --clear option!");
 		wprintln(stderr, L"   If *multiple* files are given, the program detects changes in *any* file.");
-		wprintln(stderr, L"   If a directory is given, *any* changes in that directory are detected.\n");
+		wprintln(stderr, L"   If a directory is given, *any* changes in that directory are detected.");
+		wprintln(stderr, L"   With --create, a file that does not exist yet is reported once it appears.");
+		wprintln(stderr, L"   With --state, the \"archive\" bit is neither used nor modified.");
+		wprintln(stderr, L"   With --closed, a reader that denies write sharing is counted as a writer.");
+		wprintln(stderr, L"   Files are tracked by file ID: renames are reported as moves (on stderr).\n");
 		return EXIT_FAILURE;
 	}
 
@@ -141,11 +1850,138 @@ int wmain(int argc, wchar_t *argv[])
 		TRY_PARSE_OPTION(clear)
 		TRY_PARSE_OPTION(reset)
 		TRY_PARSE_OPTION(quiet)
+		TRY_PARSE_OPTION(poll)
+		TRY_PARSE_OPTION(create)
+		TRY_PARSE_OPTION(closed)
+		TRY_PARSE_OPTION(trace)
+		TRY_PARSE_OPTION(hash)
+		TRY_PARSE_OPTION(journal)
+		if (!_wcsicmp(argv[argOffset] + 2U, L"state"))
+		{
+			if (++argOffset >= argc)
+			{
+				wprintln(stderr, L"Error: Option --state requires a file name!\n");
+				return EXIT_FAILURE;
+			}
+			stateFile = argv[argOffset];
+			continue;
+		}
 		TRY_PARSE_OPTION(debug)
 		fwprintf(stderr, L"Error: Unknown option \"%s\" encountered!\n\n", argv[argOffset]);
 		return EXIT_FAILURE;
 	}
 
+	//Check for conflicting options
+	if (opt_poll && opt_create)
+	{
+		wprintln(stderr, L"Error: Options --poll and --create are mutually exclusive!\n");
+		return EXIT_FAILURE;
+	}
+	if (stateFile && (opt_clear || opt_reset))
+	{
+		wprintln(stderr, L"Error: Option --state can not be combined with --clear or --reset!\n");
+		return EXIT_FAILURE;
+	}
+	if (opt_hash && (!stateFile))
+	{
+		wprintln(stderr, L"Error: Option --hash requires --state!\n");
+		return EXIT_FAILURE;
+	}
+
+	//Read polling environment strings
+	if (opt_poll)
+	{
+		const WCHAR *envstr = getEnvironmentString(L"NOTIFYWAIT_POLL_INTERVAL");
+		if (envstr)
+		{
+			DWORD value;
+			if (parseULong(envstr, &value) || (value < POLL_INTERVAL_MIN) || (value > POLL_INTERVAL_MAX))
+			{
+				wprintln(stderr, L"Warning: NOTIFYWAIT_POLL_INTERVAL is invalid. Using default interval!\n");
+			}
+			else
+			{
+				pollInterval = value; /*override interval*/
+			}
+			FREE(envstr);
+		}
+		if (envstr = getEnvironmentString(L"NOTIFYWAIT_POLL_BUDGET"))
+		{
+			DWORD value;
+			if (parseULong(envstr, &value) || (value < 1U))
+			{
+				wprintln(stderr, L"Warning: NOTIFYWAIT_POLL_BUDGET is invalid. Using default budget!\n");
+			}
+			else
+			{
+				pollBudget = value; /*override budget*/
+			}
+			FREE(envstr);
+		}
+	}
+
+	//Read buffer size environment string
+	if (!opt_poll)
+	{
+		const WCHAR *const envstr = getEnvironmentString(L"NOTIFYWAIT_BUFFER_SIZE");
+		if (envstr)
+		{
+			DWORD value;
+			if (parseULong(envstr, &value) || (value < NOTIFY_BUFFER_MIN / 1024U) || (value > NOTIFY_BUFFER_MAX / 1024U))
+			{
+				wprintln(stderr, L"Warning: NOTIFYWAIT_BUFFER_SIZE is invalid. Using default size!\n");
+			}
+			else
+			{
+				notifyBufferSize = value * 1024U; /*override buffer size*/
+			}
+			FREE(envstr);
+		}
+	}
+
+	//Read close timeout environment string
+	if (opt_closed)
+	{
+		const WCHAR *const envstr = getEnvironmentString(L"NOTIFYWAIT_CLOSE_TIMEOUT");
+		if (envstr)
+		{
+			DWORD value;
+			if (parseULong(envstr, &value) || (value == INFINITE))
+			{
+				wprintln(stderr, L"Warning: NOTIFYWAIT_CLOSE_TIMEOUT is invalid. Waiting without timeout!\n");
+			}
+			else
+			{
+				closeTimeout = value; /*override timeout*/
+			}
+			FREE(envstr);
+		}
+	}
+
+	//Read retry budget environment string (transient errors only, e.g. sharing violation)
+	{
+		const WCHAR *const envstr = getEnvironmentString(L"NOTIFYWAIT_RETRY_BUDGET");
+		if (envstr)
+		{
+			DWORD value;
+			if (parseULong(envstr, &value) || (value > 60000U))
+			{
+				wprintln(stderr, L"Warning: NOTIFYWAIT_RETRY_BUDGET is invalid. Using default budget!\n");
+			}
+			else
+			{
+				setAttributeOptions(value, 0U);
+			}
+			FREE(envstr);
+		}
+	}
+
+	//Start the latency trace
+	if (opt_trace && (!traceInitialize()))
+	{
+		wprintln(stderr, L"Warning: High-resolution timer is unavailable. Trace disabled!\n");
+	}
+
 	//Check remaining file count
 	if (argOffset >= argc)
 	{
@@ -192,18 +2028,57 @@ int wmain(int argc, wchar_t *argv[])
 		const DWORD attribs = getAttributes(fullPath[fileIdx], &lastModTs[fileIdx]);
 		if (attribs == INVALID_FILE_ATTRIBUTES)
 		{
+			if (opt_create && (GetLastError() != ERROR_ACCESS_DENIED))
+			{
+				if (pendingCount >= MAXIMUM_PENDING)
+				{
+					fwprintf(stderr, L"Error: Too many non-existing files! [limit: %d]\n\n", MAXIMUM_PENDING);
+					goto cleanup;
+				}
+				pendingTarget[pendingCount++].path = fullPath[fileIdx];
+				memmove(&fullPath[fileIdx], &fullPath[fileIdx + 1], (fileCount - fileIdx - 1) * sizeof(fullPath[0U]));
+				fullPath[--fileCount] = NULL;
+				--fileIdx; /*re-visit this index*/
+				continue;
+			}
 			fwprintf(stderr, L"Error: File \"%s\" not found or access denied!\n\n", fullPath[fileIdx]);
 			goto cleanup;
 		}
 		directory[fileIdx] = BOOLIFY(attribs & FILE_ATTRIBUTE_DIRECTORY);
-		if ((!directory[fileIdx]) && (!opt_clear) && (attribs & FILE_ATTRIBUTE_ARCHIVE))
+		if ((!directory[fileIdx]) && (!opt_clear) && (!stateFile) && (attribs & FILE_ATTRIBUTE_ARCHIVE))
+		{
+			REPORT_CHANGE(fileIdx);
+		}
+	}
+
+	//Remember the identity of each file, so that it can be tracked across renames
+	for (fileIdx = 0; fileIdx < fileCount; ++fileIdx)
+	{
+		if (!directory[fileIdx])
+		{
+			getIdentity(fullPath[fileIdx], &fileIdentity[fileIdx]);
+		}
+	}
+
+	//Report the files that have changed since the previous run
+	if (stateFile)
+	{
+		BOOL baseline;
+		if (stateCompare(stateFile, fileCount, opt_hash, &baseline) > 0)
 		{
-			if (!opt_quiet)
+			for (fileIdx = 0; fileIdx < fileCount; ++fileIdx)
 			{
-				fwprintf(stdout, L"%s\n", fullPath[fileIdx]); /*file was modified*/
+				if (stateChanged[fileIdx] && (!opt_quiet))
+				{
+					outputLine(&stdOutput, fullPath[fileIdx]);
+				}
 			}
 			goto success;
 		}
+		if (baseline && (!stateUpdate(stateFile, fileCount, opt_hash)))
+		{
+			fwprintf(stderr, L"Warning: State file \"%s\" could not be written!\n\n", stateFile);
+		}
 	}
 
 	//Clear the "archive" bit initially
@@ -236,21 +2111,37 @@ int wmain(int argc, wchar_t *argv[])
 			if(!wcscmp(directoryNext, directoryPath[dirIdx]))
 			{
 				duplicate = TRUE;
-				APPEND_TO_MAP(dirIdx, fileIdx);
 				break;
 			}
 		}
 		if (!duplicate)
 		{
-			APPEND_TO_MAP(dirCount, fileIdx);
+			if (dirCount >= MAXIMUM_DIRS)
+			{
+				fwprintf(stderr, L"Error: Too many distinct directories! [limit: %d]\n\n", MAXIMUM_DIRS);
+				free((void*)directoryNext);
+				goto cleanup;
+			}
 			directoryPath[dirCount++] = directoryNext;
 		}
 		else
 		{
 			free((void*)directoryNext); /*skip duplicate directory*/
 		}
+		fileDirIdx[fileIdx] = dirIdx;
+		fileName[fileIdx] = directory[fileIdx] ? L"" : getFileNamePart(fullPath[fileIdx], directoryPath[dirIdx]);
+	}
+
+	//Each non-existing file needs a watcher of its own
+	if ((dirCount + pendingCount) > MAXIMUM_DIRS)
+	{
+		fwprintf(stderr, L"Error: Too many distinct directories! [limit: %d]\n\n", MAXIMUM_DIRS);
+		goto cleanup;
 	}
 
+	//Build directory to file map
+	buildDirectoryMap(fileCount, dirCount);
+
 	//Print directory to file map (DEBUG)
 	if (opt_debug)
 	{
@@ -259,23 +2150,67 @@ int wmain(int argc, wchar_t *argv[])
 			fwprintf(stderr, L"%02d: %s\n", dirIdx, directoryPath[dirIdx]);
 			for (fileIdx = 0; fileIdx < dirToFilesMap[dirIdx].count; ++fileIdx)
 			{
-				fwprintf(stderr, L"   %02d: %s\n", fileIdx, fullPath[dirToFilesMap[dirIdx].files[fileIdx]]);
+				fwprintf(stderr, L"   %02d: %s\n", fileIdx, fullPath[dirFiles[dirToFilesMap[dirIdx].first + fileIdx]]);
 			}
 		}
+		for (pendingIdx = 0; pendingIdx < pendingCount; ++pendingIdx)
+		{
+			fwprintf(stderr, L"%02d: %s (pending)\n", dirCount + pendingIdx, pendingTarget[pendingIdx].path);
+		}
 		wprintln(stderr, L"");
 	}
 
+	//Take the initial snapshot (in event mode, it is the baseline for resync after an overflow)
+	if (!pollInitialize(dirCount, !opt_poll))
+	{
+		wprintln(stderr, L"System Error: Failed to take the initial directory snapshot!\n");
+		goto cleanup;
+	}
+
+	//Use the change journal, if requested and permitted
+	if (opt_journal && (!opt_poll))
+	{
+		if (!(useJournal = journalInstall(dirCount)))
+		{
+			journalRelease();
+			wprintln(stderr, L"Warning: Change journal is unavailable (requires NTFS and administrator rights). Using directory watches!\n");
+		}
+		else if (opt_debug)
+		{
+			fwprintf(stderr, L"Journal: %d directories on %d volume(s)\n\n", dirCount, journalVolumeCount);
+		}
+	}
+
 	//Install file system watcher
-	for (dirIdx = 0; dirIdx < dirCount; ++dirIdx)
+	for (dirIdx = 0; (!opt_poll) && (!useJournal) && (dirIdx < dirCount); ++dirIdx)
 	{
-		notifyHandle[dirIdx] = FindFirstChangeNotificationW(directoryPath[dirIdx], FALSE, NOTIFY_FLAGS);
-		if (notifyHandle[dirIdx] == INVALID_HANDLE_VALUE)
+		if (!watchInstall(dirIdx, directoryPath[dirIdx], NOTIFY_FLAGS))
 		{
 			wprintln(stderr, L"System Error: Failed to install the file watcher!\n");
 			goto cleanup;
 		}
 	}
 
+	//Start the event reader thread
+	if ((!opt_poll) && (!readerStart(dirCount, useJournal)))
+	{
+		wprintln(stderr, L"System Error: Failed to start the event reader thread!\n");
+		goto cleanup;
+	}
+
+	//Watch the nearest existing ancestor of each non-existing file
+	for (pendingIdx = 0; pendingIdx < pendingCount; ++pendingIdx)
+	{
+		switch (pendingUpdate(pendingIdx, dirCount + pendingIdx))
+		{
+		case 1:
+			REPORT_CREATED(pendingIdx);
+		case -1:
+			fwprintf(stderr, L"System Error: Failed to watch the parent directory of \"%s\"!\n\n", pendingTarget[pendingIdx].path);
+			goto cleanup;
+		}
+	}
+
 	//Has any file been modified already?
 	for (fileIdx = 0; fileIdx < fileCount; ++fileIdx)
 	{
@@ -285,34 +2220,179 @@ int wmain(int argc, wchar_t *argv[])
 		}
 	}
 
+	//Poll until a file has been modified
+	if (opt_poll)
+	{
+		if ((fileIdx = pollForChanges(dirCount, pollInterval, pollBudget, opt_debug)) < 0)
+		{
+			goto cleanup;
+		}
+		traceBegin(fileDirIdx[fileIdx], traceNow());
+		REPORT_CHANGE(fileIdx);
+	}
+
 	//Wait until a file has been modified
 	for (;;)
 	{
-		//Wait for next event
-		const DWORD status = WaitForMultipleObjects(dirCount, notifyHandle, FALSE, 29989U);
-		if ((status >= WAIT_OBJECT_0) && (status < (WAIT_OBJECT_0 + dirCount)))
+		//Wait for next event (the directories are drained by the reader thread, pending files are watched here)
+		HANDLE waitHandles[MAXIMUM_WAIT_OBJECTS];
+		DWORD status;
+		waitHandles[0U] = eventRing.dataEvent;
+		memcpy(&waitHandles[1U], &notifyHandle[dirCount], pendingCount * sizeof(HANDLE));
+		waitHandles[pendingCount + 1] = interrupt;
+		status = WaitForMultipleObjects(pendingCount + 2, waitHandles, FALSE, (movedFile >= 0) ? RENAME_GRACE : 29989U);
+		if (status == WAIT_OBJECT_0 + pendingCount + 1)
+		{
+			goto cleanup; /*interrupted by user*/
+		}
+		if ((status == WAIT_TIMEOUT) && (movedFile >= 0))
+		{
+			//A watched file was renamed, but the new name is not in any watched directory
+			fileIdx = movedFile;
+			movedFile = -1;
+			CHECK_IF_MODFIED(fileIdx);
+			continue;
+		}
+		if (status == WAIT_OBJECT_0)
+		{
+			const event_record *record;
+			BOOL resync[MAXIMUM_DIRS];
+			DWORD events = 0U;
+			memset(resync, 0, sizeof(resync));
+
+			//Check only the files that the events refer to
+			for (; (record = ringPeek()) != NULL; ringRelease(), ++events)
+			{
+				if (record->overflow)
+				{
+					++overflowCount; /*no data means the kernel buffer overflowed*/
+					resync[record->dirIdx] = TRUE;
+					continue;
+				}
+				traceBegin(record->dirIdx, record->received);
+				if (dirToFilesMap[record->dirIdx].dirTarget >= 0)
+				{
+					traceMark(TRACE_FILTERED, dirToFilesMap[record->dirIdx].dirTarget);
+					REPORT_CHANGE(dirToFilesMap[record->dirIdx].dirTarget);
+				}
+				fileIdx = findFileInDirectory(record->dirIdx, record->name);
+				traceMark(TRACE_FILTERED, fileIdx);
+				if ((record->action == FILE_ACTION_RENAMED_OLD_NAME) && (fileIdx >= 0))
+				{
+					movedFile = fileIdx; /*wait for the new name, it may arrive with the next batch*/
+				}
+				else if ((record->action == FILE_ACTION_RENAMED_NEW_NAME) && (fileIdx < 0) && (movedFile >= 0))
+				{
+					const wchar_t *newPath;
+					if (findMovedFile(movedFile, record->dirIdx, record->name, &newPath) >= 0)
+					{
+						traceMark(TRACE_VERIFIED, movedFile);
+						REPORT_MOVE(movedFile, newPath);
+					}
+					fileIdx = movedFile;
+					movedFile = -1;
+					CHECK_IF_MODFIED(fileIdx); /*renamed out of the way, and something else renamed in*/
+				}
+				else if (fileIdx >= 0)
+				{
+					if (((record->action == FILE_ACTION_ADDED) || (record->action == FILE_ACTION_RENAMED_NEW_NAME)) && identityChanged(fileIdx))
+					{
+						traceMark(TRACE_VERIFIED, fileIdx);
+						REPORT_CHANGE(fileIdx); /*replaced by a different file*/
+					}
+					CHECK_IF_MODFIED(fileIdx);
+				}
+				else if (wcschr(record->name, L'~'))
+				{
+					resync[record->dirIdx] = TRUE; /*might be a short file name*/
+				}
+				traceEnd();
+			}
+
+			//Has the reader thread failed?
+			if (eventRing.failed)
+			{
+				wprintln(stderr, L"System Error: Failed to read notification!\n");
+				goto cleanup;
+			}
+
+			//Resync the directories whose events were dropped, because the ring was full
+			for (dirIdx = 0; dirIdx < dirCount; ++dirIdx)
+			{
+				if (InterlockedExchange(&eventRing.lost[dirIdx], 0L))
+				{
+					resync[dirIdx] = TRUE;
+				}
+			}
+
+			//Print DEBUG information
+			if (opt_debug)
+			{
+				fwprintf(stderr, L"Worker: %u events [queue depth: %ld, max: %ld, dropped: %ld, overflows: %u]\n", events, eventRing.head - eventRing.tail, eventRing.depthMax, eventRing.dropped, overflowCount);
+			}
+
+			//Compare against the last known snapshot, if events were lost
+			for (dirIdx = 0; dirIdx < dirCount; ++dirIdx)
+			{
+				if (resync[dirIdx])
+				{
+					traceBegin(dirIdx, traceNow());
+					traceMark(TRACE_FILTERED, -1);
+					if ((fileIdx = pollResync(dirIdx)) >= 0)
+					{
+						traceMark(TRACE_VERIFIED, fileIdx);
+						REPORT_CHANGE(fileIdx);
+					}
+					CHECK_DIRECTORY(dirIdx);
+					traceEnd();
+				}
+			}
+		}
+		else if ((status > WAIT_OBJECT_0) && (status <= (WAIT_OBJECT_0 + pendingCount)))
 		{
-			//Compute directory index
-			const DWORD notifyIdx = status - WAIT_OBJECT_0;
-			
+			//Compute pending file index
+			const int watchIdx = dirCount + (int)(status - WAIT_OBJECT_0 - 1U);
+			const LONGLONG received = traceNow();
+			const FILE_NOTIFY_INFORMATION *info = NULL;
+			BOOL relevant = (watchResult(watchIdx, &info) != ERROR_SUCCESS) || (!info);
+			pendingIdx = watchIdx - dirCount;
+
+			//Did the next missing path component appear? (errors and overflows always force a re-walk)
+			traceBegin(watchIdx, received);
+			for (; (!relevant) && info; info = nextNotification(info))
+			{
+				relevant = pendingEventMatches(&pendingTarget[pendingIdx], info);
+			}
+			traceMark(TRACE_FILTERED, -1);
+
 			//Print DEBUG information
 			if (opt_debug)
 			{
-				fwprintf(stderr, L"Directory #%02u was notified!\n", notifyIdx);
+				fwprintf(stderr, L"Pending #%02d was notified! [%s]\n", pendingIdx, relevant ? L"re-walk" : L"ignored");
 			}
-			
-			//Has any file been modified?
-			for (fileIdx = 0; fileIdx < dirToFilesMap[notifyIdx].count; ++fileIdx)
+
+			//Walk the path again and move the watcher, if required
+			if (relevant)
 			{
-				CHECK_IF_MODFIED(dirToFilesMap[notifyIdx].files[fileIdx]);
+				int update;
+				watchRelease(watchIdx);
+				update = pendingUpdate(pendingIdx, watchIdx);
+				traceMark(TRACE_VERIFIED, -1);
+				switch (update)
+				{
+				case 1:
+					REPORT_CREATED(pendingIdx);
+				case -1:
+					fwprintf(stderr, L"System Error: Failed to watch the parent directory of \"%s\"!\n\n", pendingTarget[pendingIdx].path);
+					goto cleanup;
+				}
 			}
-			
-			//Request the *next* notification
-			if (!FindNextChangeNotification(notifyHandle[notifyIdx]))
+			else if (!watchRequest(watchIdx))
 			{
 				wprintln(stderr, L"Error: Failed to request next notification!\n");
 				goto cleanup;
 			}
+			traceEnd();
 		}
 		else if (status == WAIT_TIMEOUT)
 		{
@@ -324,6 +2404,13 @@ int wmain(int argc, wchar_t *argv[])
 					CHECK_IF_MODFIED(fileIdx);
 				}
 			}
+			for (pendingIdx = 0; pendingIdx < pendingCount; ++pendingIdx)
+			{
+				if (pendingWalk(&pendingTarget[pendingIdx]) > 0)
+				{
+					REPORT_CREATED(pendingIdx);
+				}
+			}
 		}
 		else
 		{
@@ -335,6 +2422,10 @@ int wmain(int argc, wchar_t *argv[])
 	//Completed successfully
 success:
 	result = EXIT_SUCCESS;
+	if (stateFile && (!stateUpdate(stateFile, fileCount, opt_hash)))
+	{
+		fwprintf(stderr, L"Warning: State file \"%s\" could not be written!\n\n", stateFile);
+	}
 	if (opt_reset)
 	{
 		Sleep(25); /*some extra delay*/
@@ -345,19 +2436,62 @@ success:
 				fwprintf(stderr, L"Warning: File \"%s\" could not be reset!\n\n", fullPath[fileIdx]);
 			}
 		}
+		for (pendingIdx = 0; pendingIdx < pendingCount; ++pendingIdx)
+		{
+			if (GetFileAttributesW(pendingTarget[pendingIdx].path) != INVALID_FILE_ATTRIBUTES)
+			{
+				if (!clearAttribute(pendingTarget[pendingIdx].path, FILE_ATTRIBUTE_ARCHIVE))
+				{
+					fwprintf(stderr, L"Warning: File \"%s\" could not be reset!\n\n", pendingTarget[pendingIdx].path);
+				}
+			}
+		}
 	}
 
 	//Perform final clean-up
 cleanup:
+	if (isInterrupted())
+	{
+		result = EXIT_INTERRUPTED; /*the "archive" bits and the state file are left alone*/
+	}
+	if (traceState.enabled)
+	{
+		const WCHAR *const traceFile = getEnvironmentString(L"NOTIFYWAIT_TRACE_FILE");
+		traceReport();
+		if (traceFile)
+		{
+			if (!traceWrite(traceFile))
+			{
+				fwprintf(stderr, L"Warning: Trace file \"%s\" could not be written!\n\n", traceFile);
+			}
+			FREE(traceFile);
+		}
+		traceRelease();
+	}
+	readerStop();
+	journalRelease();
+	pollRelease(dirCount);
 	for (dirIdx = 0; dirIdx < dirCount; ++dirIdx)
 	{
+		watchRelease(dirIdx);
 		FREE(directoryPath[dirIdx]);
-		CLOSE_NOTIFY_HANDLE(notifyHandle[dirIdx]);
+	}
+	for (pendingIdx = 0; pendingIdx < pendingCount; ++pendingIdx)
+	{
+		watchRelease(dirCount + pendingIdx);
+		FREE(pendingTarget[pendingIdx].path);
 	}
 	for (fileIdx = 0; fileIdx < fileCount; ++fileIdx)
 	{
 		FREE(fullPath[fileIdx]);
 	}
+	FREE(movedPath);
+	releaseAttributeCache();
+	if ((!outputClose(&stdOutput)) && (result == EXIT_SUCCESS))
+	{
+		wprintln(stderr, L"Error: Failed to write output!\n");
+		result = EXIT_FAILURE;
+	}
 
 	return result; /*exit*/
 }
@@ -8,6 +8,9 @@
  */
 
 #include "common.h"
+#include "snapshot.h"
+
+#include <process.h>
 
 /* ======================================================================= */
 /* UTILITY FUNCTIONS                                                       */
@@ -15,27 +18,15 @@
 
 static BOOL __stdcall crtlHandler(DWORD dwCtrlTyp)
 {
-	switch (dwCtrlTyp)
-	{
-	case CTRL_C_EVENT:
-		wprintln(stderr, L"Ctrl+C: Realpath has been interrupted !!!\n");
-		break;
-	case CTRL_BREAK_EVENT:
-		wprintln(stderr, L"Break: Realpath has been interrupted !!!\n");
-		break;
-	default:
-		return FALSE;
-	}
-
-	fflush(stderr);
-	_exit(2);
-	return TRUE;
+	return handleInterrupt(dwCtrlTyp, L"Realpath", 2); /*the main thread is signaled to clean up*/
 }
 
 /* ======================================================================= */
 /* HELPER MACROS AND TYPES                                                 */
 /* ======================================================================= */
 
+#define EXIT_INTERRUPTED 2 /*exit code when interrupted by user*/
+
 #define TRY_PARSE_OPTION(VAL, NAME) \
 	if (!_wcsicmp(argv[argOffset] + 2U, L#NAME)) \
 	{ \
@@ -48,6 +39,777 @@ static BOOL __stdcall crtlHandler(DWORD dwCtrlTyp)
 		continue; \
 	}
 
+/* ======================================================================= */
+/* INPUT RECORDS                                                           */
+/* ======================================================================= */
+
+#define INPUT_BUFFER_SIZE 65536U
+#define OUTPUT_BUFFER_SIZE 65536U
+#define MAXIMUM_RECORD 32767U
+
+typedef struct
+{
+	HANDLE handle;
+	char *buffer, *record;
+	size_t offset, length, recordLen;
+	BOOL eof;
+}
+input_reader;
+
+static BOOL inputOpen(input_reader *const input, const HANDLE handle)
+{
+	memset(input, 0, sizeof(input_reader));
+	input->handle = handle;
+	input->buffer = (char*) malloc(INPUT_BUFFER_SIZE);
+	input->record = (char*) malloc(3U * MAXIMUM_RECORD);
+	return (input->buffer && input->record);
+}
+
+static void inputClose(input_reader *const input)
+{
+	FREE(input->buffer);
+	FREE(input->record);
+	memset(input, 0, sizeof(input_reader));
+}
+
+/* returns 1 for the next record, 0 at the end of input or -1 on error (data is valid until the next call) */
+static int inputRead(input_reader *const input, const char delimiter, const char **const data, size_t *const length)
+{
+	DWORD bytesRead;
+	for (;;)
+	{
+		if (input->offset < input->length)
+		{
+			char *const start = input->buffer + input->offset;
+			const char *const found = (const char*) memchr(start, delimiter, input->length - input->offset);
+			const size_t chunk = found ? ((size_t)(found - start)) : (input->length - input->offset);
+			if (found && (!input->recordLen))
+			{
+				*data = start; /*record is complete within the buffer, no need to copy*/
+				*length = chunk;
+				input->offset += chunk + 1U;
+				return 1;
+			}
+			if ((input->recordLen + chunk) > (3U * MAXIMUM_RECORD))
+			{
+				return -1; /*record too long*/
+			}
+			memcpy(input->record + input->recordLen, start, chunk);
+			input->recordLen += chunk;
+			input->offset += found ? (chunk + 1U) : chunk;
+			if (found)
+			{
+				goto return_record;
+			}
+		}
+		if (input->eof)
+		{
+			if (input->recordLen)
+			{
+				goto return_record; /*final record without delimiter*/
+			}
+			return 0;
+		}
+		input->offset = input->length = 0U;
+		if (!ReadFile(input->handle, input->buffer, INPUT_BUFFER_SIZE, &bytesRead, NULL))
+		{
+			if (GetLastError() != ERROR_BROKEN_PIPE)
+			{
+				return -1;
+			}
+			bytesRead = 0U;
+		}
+		input->eof = (bytesRead < 1U);
+		input->length = bytesRead;
+	}
+
+return_record:
+	*data = input->record;
+	*length = input->recordLen;
+	input->recordLen = 0U;
+	return 1;
+}
+
+/* ======================================================================= */
+/* PATH PROCESSING                                                         */
+/* ======================================================================= */
+
+#define RESOLVE_SUCCESS       0
+#define RESOLVE_FAILED        1
+#define RESOLVE_NOT_FOUND     2
+#define RESOLVE_IS_DIRECTORY  3
+#define RESOLVE_IS_FILE       4
+
+#define FORMAT_PLAIN 0
+#define FORMAT_TSV   1
+#define FORMAT_JSON  2
+
+#define MAXIMUM_JOBS 64U
+#define WINDOW_PER_JOB 8U
+
+#define MAXIMUM_BATCH 1048576U
+#define BATCH_SCAN_MINIMUM 8U
+
+typedef struct
+{
+	DWORD checkMode;
+	BOOL lexical;
+	int format;
+	const relative_base *relativeTo;
+}
+resolve_options;
+
+typedef struct
+{
+	wchar_t *fileName;
+	const wchar_t *fullPath;
+	BY_HANDLE_FILE_INFORMATION info;
+	int status;
+	HANDLE done;
+}
+job_slot;
+
+typedef struct
+{
+	job_slot *slots;
+	ULONG capacity, head, tail;
+	volatile LONG next, stop;
+	DWORD threadCount;
+	resolve_options options;
+	HANDLE available;
+	HANDLE threads[MAXIMUM_JOBS];
+}
+job_pool;
+
+typedef struct
+{
+	wchar_t *fileName;
+	const wchar_t *fullPath;
+	size_t nameOffset;
+	int status;
+	BOOL pending;
+}
+batch_item;
+
+typedef struct
+{
+	batch_item *items;
+	batch_item **order;
+	size_t capacity, count;
+	snapshot_t snapshot;
+	path_arena arena;
+}
+path_batch;
+
+typedef struct
+{
+	resolve_options options;
+	BOOL nullMode;
+	output_buffer output;
+	path_cache cache;
+	path_arena arena;
+	job_pool *pool;
+	path_batch *batch;
+}
+path_sink;
+
+static int finishPath(const resolve_options *const options, path_arena *const arena, const wchar_t **const fullPath, const DWORD attribs)
+{
+	//Check if file exists
+	if(options->checkMode) 
+	{
+		if (attribs == INVALID_FILE_ATTRIBUTES)
+		{ 
+			return RESOLVE_NOT_FOUND;
+		}
+		switch(options->checkMode) {
+		case 2:
+			if(attribs & FILE_ATTRIBUTE_DIRECTORY)
+			{
+				return RESOLVE_IS_DIRECTORY;
+			}
+			break;
+		case 3:
+			if (!(attribs & FILE_ATTRIBUTE_DIRECTORY))
+			{
+				return RESOLVE_IS_FILE;
+			}
+			break;
+		}
+	}
+
+	//Make relative to the base directory, if requested
+	if (options->relativeTo)
+	{
+		const wchar_t *const relativePath = getRelativePath(options->relativeTo, *fullPath, arena);
+		freePath(arena, *fullPath);
+		if (!(*fullPath = relativePath))
+		{
+			return RESOLVE_FAILED;
+		}
+	}
+
+	return RESOLVE_SUCCESS;
+}
+
+static int resolvePath(const wchar_t *const fileName, const resolve_options *const options, path_cache *const cache, path_arena *const arena, const wchar_t **const fullPath, BY_HANDLE_FILE_INFORMATION *const info)
+{
+	//Convert to absoloute paths (the metadata is queried along with the path, if it is needed)
+	info->dwFileAttributes = INVALID_FILE_ATTRIBUTES;
+	if (options->lexical)
+	{
+		*fullPath = getLexicalPath(fileName, arena);
+	}
+	else
+	{
+		*fullPath = (options->checkMode || options->format) ? getCanonicalPathInfo(fileName, info, arena) : getCanonicalPathCached(cache, fileName, arena);
+	}
+	if (!(*fullPath))
+	{
+		return RESOLVE_FAILED;
+	}
+
+	return finishPath(options, arena, fullPath, info->dwFileAttributes);
+}
+
+/* ======================================================================= */
+/* OUTPUT RECORDS                                                          */
+/* ======================================================================= */
+
+static BOOL writeJsonString(output_buffer *const output, const wchar_t *const text)
+{
+	const wchar_t *run = text, *pos;
+	char escape[8U];
+
+	for (pos = text; *pos; ++pos)
+	{
+		if ((*pos == L'"') || (*pos == L'\\') || (*pos < 0x20))
+		{
+			if (!outputWrite(output, run, pos - run))
+			{
+				return FALSE;
+			}
+			if (*pos < 0x20)
+			{
+				sprintf(escape, "\\u%04x", (unsigned int)(*pos));
+			}
+			else
+			{
+				escape[0U] = '\\';
+				escape[1U] = (char)(*pos);
+				escape[2U] = '\0';
+			}
+			if (!outputBytes(output, escape, strlen(escape)))
+			{
+				return FALSE;
+			}
+			run = pos + 1U;
+		}
+	}
+
+	return outputWrite(output, run, pos - run);
+}
+
+static BOOL writeRecord(path_sink *const sink, const wchar_t *const fullPath, const BY_HANDLE_FILE_INFORMATION *const info)
+{
+	const BOOL exists = (info->dwFileAttributes != INVALID_FILE_ATTRIBUTES);
+	const wchar_t *const type = exists ? ((info->dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) ? L"directory" : L"file") : L"none";
+	wchar_t modified[32U] = L"", fileId[32U] = L"", buffer[160U];
+	ULARGE_INTEGER size;
+	SYSTEMTIME time;
+	int count;
+
+	//Format the metadata fields (empty, if the file does not exist)
+	size.QuadPart = 0ULL;
+	if (exists)
+	{
+		size.HighPart = info->nFileSizeHigh;
+		size.LowPart = info->nFileSizeLow;
+		if (FileTimeToSystemTime(&info->ftLastWriteTime, &time))
+		{
+			_snwprintf(modified, 32U, L"%04u-%02u-%02uT%02u:%02u:%02u.%03uZ", time.wYear, time.wMonth, time.wDay, time.wHour, time.wMinute, time.wSecond, time.wMilliseconds);
+		}
+		_snwprintf(fileId, 32U, L"%08lX:%08lX%08lX", info->dwVolumeSerialNumber, info->nFileIndexHigh, info->nFileIndexLow);
+	}
+
+	//Write the record
+	if (sink->options.format == FORMAT_JSON)
+	{
+		if (!(outputBytes(&sink->output, "{\"path\":\"", 9U) && writeJsonString(&sink->output, fullPath)))
+		{
+			return FALSE;
+		}
+		count = _snwprintf(buffer, 160U, L"\",\"type\":\"%s\",\"size\":%I64u,\"mtime\":%s%s%s,\"id\":%s%s%s}",
+			type, size.QuadPart, modified[0U] ? L"\"" : L"", modified[0U] ? modified : L"null", modified[0U] ? L"\"" : L"", fileId[0U] ? L"\"" : L"", fileId[0U] ? fileId : L"null", fileId[0U] ? L"\"" : L"");
+	}
+	else
+	{
+		if (!outputWrite(&sink->output, fullPath, wcslen(fullPath)))
+		{
+			return FALSE;
+		}
+		if (exists)
+		{
+			count = _snwprintf(buffer, 160U, L"\t%s\t%I64u\t%s\t%s", type, size.QuadPart, modified, fileId);
+		}
+		else
+		{
+			count = _snwprintf(buffer, 160U, L"\t%s\t\t\t", type);
+		}
+	}
+
+	return (count > 0) && outputWrite(&sink->output, buffer, count);
+}
+
+static BOOL emitResult(path_sink *const sink, const wchar_t *const fileName, const int status, const wchar_t *const fullPath, const BY_HANDLE_FILE_INFORMATION *const info)
+{
+	switch (status)
+	{
+	case RESOLVE_SUCCESS:
+		break;
+	case RESOLVE_NOT_FOUND:
+		fwprintf(stderr, L"Error: File \"%s\" not found or access denied!\n\n", fullPath);
+		return FALSE;
+	case RESOLVE_IS_DIRECTORY:
+		fwprintf(stderr, L"Error: Path \"%s\" points to a directory!\n\n", fullPath);
+		return FALSE;
+	case RESOLVE_IS_FILE:
+		fwprintf(stderr, L"Error: Path \"%s\" points to a regular file!\n\n", fullPath);
+		return FALSE;
+	default:
+		fwprintf(stderr, L"Error: Path \"%s\" could not be resolved!\n\n", fileName);
+		return FALSE;
+	}
+
+	//Append the full path (or record) to the output buffer
+	if (!((sink->options.format ? writeRecord(sink, fullPath, info) : outputWrite(&sink->output, fullPath, wcslen(fullPath))) && outputBytes(&sink->output, sink->nullMode ? "\0" : "\r\n", sink->nullMode ? 1U : 2U)))
+	{
+		wprintln(stderr, L"Error: Failed to write output!\n");
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* ======================================================================= */
+/* WORKER POOL                                                             */
+/* ======================================================================= */
+
+static unsigned __stdcall jobThreadMain(void *const arg)
+{
+	job_pool *const pool = (job_pool*) arg;
+	path_cache cache; /*each thread has its own cache*/
+
+	pathCacheInit(&cache);
+	for (;;)
+	{
+		job_slot *slot;
+		if ((WaitForSingleObject(pool->available, INFINITE) != WAIT_OBJECT_0) || pool->stop)
+		{
+			break;
+		}
+		slot = &pool->slots[((ULONG)(InterlockedIncrement(&pool->next) - 1L)) & (pool->capacity - 1U)];
+		slot->status = resolvePath(slot->fileName, &pool->options, &cache, NULL, &slot->fullPath, &slot->info);
+		SetEvent(slot->done);
+	}
+
+	pathCacheFree(&cache);
+	return 0U;
+}
+
+static void poolClose(job_pool *const pool)
+{
+	ULONG idx;
+
+	//Stop the worker threads (a thread may have to finish its current path first)
+	InterlockedExchange(&pool->stop, 1L);
+	if (pool->threadCount > 0U)
+	{
+		ReleaseSemaphore(pool->available, (LONG)pool->threadCount, NULL);
+		WaitForMultipleObjects(pool->threadCount, pool->threads, TRUE, INFINITE);
+		for (idx = 0U; idx < pool->threadCount; ++idx)
+		{
+			CloseHandle(pool->threads[idx]);
+		}
+	}
+
+	//Release all slots, including the ones that have not been written yet
+	if (pool->slots)
+	{
+		for (; pool->head != pool->tail; ++pool->head)
+		{
+			job_slot *const slot = &pool->slots[pool->head & (pool->capacity - 1U)];
+			FREE(slot->fileName);
+			FREE(slot->fullPath);
+		}
+		for (idx = 0U; idx < pool->capacity; ++idx)
+		{
+			CLOSE_HANDLE(pool->slots[idx].done);
+		}
+		free(pool->slots);
+	}
+
+	CLOSE_HANDLE(pool->available);
+	memset(pool, 0, sizeof(job_pool));
+}
+
+static BOOL poolOpen(job_pool *const pool, const ULONG jobs, const resolve_options *const options)
+{
+	ULONG idx;
+
+	memset(pool, 0, sizeof(job_pool));
+	pool->options = *options;
+
+	//The reorder window is a power of two, so that the sequence numbers may wrap around
+	for (pool->capacity = 16U; pool->capacity < (WINDOW_PER_JOB * jobs); pool->capacity <<= 1);
+	if (!(pool->slots = (job_slot*) calloc(pool->capacity, sizeof(job_slot))))
+	{
+		return FALSE;
+	}
+	for (idx = 0U; idx < pool->capacity; ++idx)
+	{
+		if (!(pool->slots[idx].done = CreateEventW(NULL, FALSE, FALSE, NULL)))
+		{
+			goto failure;
+		}
+	}
+	if (!(pool->available = CreateSemaphoreW(NULL, 0L, (LONG)(pool->capacity + MAXIMUM_JOBS), NULL)))
+	{
+		goto failure;
+	}
+
+	//Start the worker threads
+	for (idx = 0U; idx < jobs; ++idx)
+	{
+		if (!(pool->threads[pool->threadCount] = (HANDLE) _beginthreadex(NULL, 0U, jobThreadMain, pool, 0U, NULL)))
+		{
+			goto failure;
+		}
+		pool->threadCount++;
+	}
+
+	return TRUE;
+
+failure:
+	poolClose(pool);
+	return FALSE;
+}
+
+/* write completed results in input order, blocking while more than "limit" paths are outstanding */
+static BOOL poolDrain(path_sink *const sink, const ULONG limit)
+{
+	job_pool *const pool = sink->pool;
+	while (pool->head != pool->tail)
+	{
+		job_slot *const slot = &pool->slots[pool->head & (pool->capacity - 1U)];
+		BOOL success;
+		if (WaitForSingleObject(slot->done, ((pool->tail - pool->head) > limit) ? INFINITE : 0U) != WAIT_OBJECT_0)
+		{
+			break; /*the next path in order is not ready yet*/
+		}
+		success = emitResult(sink, slot->fileName, slot->status, slot->fullPath, &slot->info);
+		FREE(slot->fileName);
+		FREE(slot->fullPath);
+		slot->fileName = NULL;
+		slot->fullPath = NULL;
+		++pool->head;
+		if (!success)
+		{
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+static BOOL poolSubmit(path_sink *const sink, const wchar_t *const fileName)
+{
+	job_pool *const pool = sink->pool;
+	job_slot *slot;
+
+	//Make room in the reorder window, if it is full
+	if (!poolDrain(sink, pool->capacity - 1U))
+	{
+		return FALSE;
+	}
+
+	slot = &pool->slots[pool->tail & (pool->capacity - 1U)];
+	if (!(slot->fileName = _wcsdup(fileName)))
+	{
+		wprintln(stderr, L"Error: Memory allocation has failed!\n");
+		return FALSE;
+	}
+	slot->fullPath = NULL;
+	++pool->tail;
+	ReleaseSemaphore(pool->available, 1L, NULL);
+
+	return poolDrain(sink, pool->capacity);
+}
+
+/* ======================================================================= */
+/* BATCH CHECKS                                                            */
+/* ======================================================================= */
+
+static BOOL batchOpen(path_batch *const batch, const ULONG capacity)
+{
+	memset(batch, 0, sizeof(path_batch));
+	snapshotInit(&batch->snapshot);
+	arenaInit(&batch->arena);
+	batch->capacity = capacity;
+	batch->items = (batch_item*) calloc(capacity, sizeof(batch_item));
+	batch->order = (batch_item**) calloc(capacity, sizeof(batch_item*));
+	return (batch->items && batch->order);
+}
+
+static void batchReset(path_batch *const batch)
+{
+	//All strings of the batch live in the arena, so they are released at once
+	if (batch->count > 0U)
+	{
+		memset(batch->items, 0, sizeof(batch_item) * batch->count);
+	}
+	arenaReset(&batch->arena);
+	batch->count = 0U;
+}
+
+static void batchClose(path_batch *const batch)
+{
+	if (batch->items)
+	{
+		batchReset(batch);
+	}
+	FREE(batch->items);
+	FREE(batch->order);
+	snapshotFree(&batch->snapshot);
+	arenaFree(&batch->arena);
+	memset(batch, 0, sizeof(path_batch));
+}
+
+static int compareDirectories(const batch_item *const itemA, const batch_item *const itemB)
+{
+	if (itemA->nameOffset != itemB->nameOffset)
+	{
+		return (itemA->nameOffset < itemB->nameOffset) ? -1 : 1;
+	}
+	return itemA->nameOffset ? _wcsnicmp(itemA->fullPath, itemB->fullPath, itemA->nameOffset) : 0;
+}
+
+static int __cdecl compareBatchItems(const void *const a, const void *const b)
+{
+	const batch_item *const itemA = *((const batch_item *const *)a), *const itemB = *((const batch_item *const *)b);
+	const int cmp = compareDirectories(itemA, itemB);
+	return cmp ? cmp : ((itemA < itemB) ? -1 : ((itemA > itemB) ? 1 : 0));
+}
+
+/* a name that is missing from the listing does not exist (no short names or case folding beyond ASCII) */
+static BOOL isDefinitiveName(const wchar_t *name)
+{
+	for (; *name; ++name)
+	{
+		if ((*name < 0x20) || (*name > 0x7E) || (*name == L'~') || (*name == L'*') || (*name == L'?') || (*name == L':'))
+		{
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+static wchar_t *joinName(const wchar_t *const directory, const wchar_t *const name, path_arena *const arena)
+{
+	const size_t dirLen = wcslen(directory), nameLen = wcslen(name);
+	const size_t separator = ((dirLen > 0U) && (directory[dirLen - 1U] != L'\\')) ? 1U : 0U;
+	wchar_t *buffer;
+
+	//Long paths and names with trailing dots or spaces are left to getCanonicalPath()
+	if ((nameLen < 1U) || (name[nameLen - 1U] == L'.') || (name[nameLen - 1U] == L' ') || (((dirLen + separator + nameLen) >= MAX_PATH) && wcsncmp(directory, L"\\\\?\\", 4U)))
+	{
+		return NULL;
+	}
+
+	if (buffer = arenaAlloc(arena, dirLen + separator + nameLen + 1U))
+	{
+		wmemcpy(buffer, directory, dirLen);
+		if (separator)
+		{
+			buffer[dirLen] = L'\\';
+		}
+		wmemcpy(buffer + dirLen + separator, name, nameLen + 1U);
+	}
+
+	return buffer;
+}
+
+static void batchScanGroup(path_sink *const sink, batch_item *const *const group, const size_t count)
+{
+	path_batch *const batch = sink->batch;
+	wchar_t *const groupPath = (wchar_t*) group[0U]->fullPath;
+	const size_t nameOffset = group[0U]->nameOffset;
+	const wchar_t *directory;
+	wchar_t saved;
+	size_t idx;
+
+	//Resolve and enumerate the directory, once for all items in the group
+	saved = groupPath[nameOffset];
+	groupPath[nameOffset] = L'\0';
+	directory = getCanonicalPathCached(&sink->cache, groupPath, &batch->arena);
+	groupPath[nameOffset] = saved;
+	if (!(directory && snapshotScan(&batch->snapshot, directory, NULL, 0U)))
+	{
+		return; /*items stay pending*/
+	}
+
+	//Look up the items in the directory listing
+	for (idx = 0U; idx < count; ++idx)
+	{
+		batch_item *const item = group[idx];
+		const wchar_t *const name = item->fullPath + item->nameOffset;
+		const snapshot_entry *const entry = snapshotFind(&batch->snapshot, name);
+		const wchar_t *fullPath;
+		if (entry ? (entry->attributes & FILE_ATTRIBUTE_REPARSE_POINT) : (!isDefinitiveName(name)))
+		{
+			continue; /*resolve individually*/
+		}
+		if (fullPath = joinName(directory, entry ? entry->name : name, &batch->arena))
+		{
+			item->fullPath = fullPath;
+			item->status = entry ? finishPath(&sink->options, &batch->arena, &item->fullPath, entry->attributes) : RESOLVE_NOT_FOUND;
+			item->pending = FALSE;
+		}
+	}
+}
+
+static BOOL batchFlush(path_sink *const sink)
+{
+	path_batch *const batch = sink->batch;
+	size_t idx, first, groupSize;
+	BOOL success = TRUE;
+	BY_HANDLE_FILE_INFORMATION info;
+
+	//Make all paths absolute (lexically), so that they can be grouped by directory
+	for (idx = 0U; idx < batch->count; ++idx)
+	{
+		batch_item *const item = &batch->items[idx];
+		const wchar_t *separator;
+		item->pending = TRUE;
+		if ((item->fullPath = getLexicalPath(item->fileName, &batch->arena)) && (separator = wcsrchr(item->fullPath, L'\\')) && separator[1U])
+		{
+			item->nameOffset = (separator - item->fullPath) + 1U;
+		}
+		batch->order[idx] = item;
+	}
+	qsort(batch->order, batch->count, sizeof(batch_item*), compareBatchItems);
+
+	//Enumerate each directory with enough look-ups only once
+	for (first = 0U; first < batch->count; first += groupSize)
+	{
+		for (groupSize = 1U; ((first + groupSize) < batch->count) && (!compareDirectories(batch->order[first], batch->order[first + groupSize])); ++groupSize);
+		if ((groupSize >= BATCH_SCAN_MINIMUM) && batch->order[first]->nameOffset)
+		{
+			batchScanGroup(sink, batch->order + first, groupSize);
+		}
+	}
+
+	//Resolve the remaining paths individually, then write all results in input order
+	for (idx = 0U; (idx < batch->count) && success; ++idx)
+	{
+		batch_item *const item = &batch->items[idx];
+		info.dwFileAttributes = INVALID_FILE_ATTRIBUTES;
+		if (item->pending)
+		{
+			item->fullPath = NULL;
+			item->status = resolvePath(item->fileName, &sink->options, &sink->cache, &batch->arena, &item->fullPath, &info);
+		}
+		success = emitResult(sink, item->fileName, item->status, item->fullPath, &info);
+	}
+
+	batchReset(batch);
+	return success;
+}
+
+static BOOL batchSubmit(path_sink *const sink, const wchar_t *const fileName)
+{
+	path_batch *const batch = sink->batch;
+	if (!(batch->items[batch->count].fileName = arenaDup(&batch->arena, fileName)))
+	{
+		wprintln(stderr, L"Error: Memory allocation has failed!\n");
+		return FALSE;
+	}
+	return (++batch->count < batch->capacity) || batchFlush(sink);
+}
+
+/* ======================================================================= */
+/* INPUT PROCESSING                                                        */
+/* ======================================================================= */
+
+static BOOL submitPath(path_sink *const sink, const wchar_t *const fileName)
+{
+	const wchar_t *fullPath = NULL;
+	BY_HANDLE_FILE_INFORMATION info;
+	BOOL success;
+
+	if (isInterrupted())
+	{
+		return FALSE; /*stop, but still write out what has been resolved so far*/
+	}
+	if (sink->pool)
+	{
+		return poolSubmit(sink, fileName);
+	}
+	if (sink->batch)
+	{
+		return batchSubmit(sink, fileName);
+	}
+
+	//The result buffers are re-used for the next path
+	success = emitResult(sink, fileName, resolvePath(fileName, &sink->options, &sink->cache, &sink->arena, &fullPath, &info), fullPath, &info);
+	arenaReset(&sink->arena);
+	return success;
+}
+
+static BOOL processInput(input_reader *const input, path_sink *const sink)
+{
+	const char *data;
+	size_t length;
+	int status, count;
+	BOOL firstRecord = TRUE;
+	wchar_t fileName[MAXIMUM_RECORD + 1U];
+
+	while ((status = inputRead(input, sink->nullMode ? '\0' : '\n', &data, &length)) > 0)
+	{
+		if (firstRecord && (length >= 3U) && (!memcmp(data, "\xEF\xBB\xBF", 3U)))
+		{
+			data += 3U; /*skip UTF-8 BOM*/
+			length -= 3U;
+		}
+		firstRecord = FALSE;
+		if ((!sink->nullMode) && (length > 0U) && (data[length - 1U] == '\r'))
+		{
+			--length;
+		}
+		if (length < 1U)
+		{
+			continue; /*skip empty records*/
+		}
+		if ((count = MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, data, (int)length, fileName, MAXIMUM_RECORD)) < 1)
+		{
+			wprintln(stderr, L"Error: Input contains an invalid UTF-8 sequence!\n");
+			return FALSE;
+		}
+		fileName[count] = L'\0';
+		if (!submitPath(sink, fileName))
+		{
+			return FALSE;
+		}
+	}
+
+	if (status < 0)
+	{
+		wprintln(stderr, L"Error: Failed to read input or input record is too long!\n");
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
 /* ======================================================================= */
 /* MAIN                                                                    */
 /* ======================================================================= */
@@ -55,11 +817,26 @@ static BOOL __stdcall crtlHandler(DWORD dwCtrlTyp)
 int wmain(int argc, wchar_t *argv[])
 {
 	int result = EXIT_FAILURE, argOffset = 1;
-	const wchar_t *fullPath = NULL;
-	DWORD attribs = 0UL, check_mode = 0UL;
+	DWORD check_mode = 0UL;
+	ULONG jobs = 1U, batchSize = 0U;
+	int format = FORMAT_PLAIN;
+	const wchar_t *relativeTo = NULL, *basePath = NULL;
+	relative_base base;
+	BOOL opt_stdin = FALSE, opt_null = FALSE, opt_lexical = FALSE;
+	path_sink sink;
+	job_pool pool;
+	path_batch batch;
+	input_reader input;
 
 	//Initialize
 	INITIALIZE_C_RUNTIME();
+	memset(&sink, 0, sizeof(path_sink));
+	pathCacheInit(&sink.cache);
+	arenaInit(&sink.arena);
+	memset(&pool, 0, sizeof(job_pool));
+	memset(&batch, 0, sizeof(path_batch));
+	memset(&input, 0, sizeof(input_reader));
+	memset(&base, 0, sizeof(relative_base));
 
 	//Check command-line arguments
 	if ((argc < 2) || (!_wcsicmp(argv[1U], L"/?")) || (!_wcsicmp(argv[1U], L"--help")))
@@ -67,21 +844,37 @@ int wmain(int argc, wchar_t *argv[])
 		fwprintf(stderr, L"realpath %s\n", PROGRAM_VERSION);
 		wprintln(stderr, L"Convert file name or relative path into fully qualified \"canonical\" path.\n");
 		wprintln(stderr, L"Usage:");
-		wprintln(stderr, L"   realpath.exe [options] <filename_1> [<filename_2> ... <filename_N>]\n");
+		wprintln(stderr, L"   realpath.exe [options] <filename_1> [<filename_2> ... <filename_N>]");
+		wprintln(stderr, L"   realpath.exe [options] --stdin\n");
 		wprintln(stderr, L"Options:");
 		wprintln(stderr, L"   --exists     requires the target file system object to exist");
 		wprintln(stderr, L"   --file       requires the target path to point to a regular file");
-		wprintln(stderr, L"   --directory  requires the target path to point to a directory\n");
+		wprintln(stderr, L"   --directory  requires the target path to point to a directory");
+		wprintln(stderr, L"   --stdin      read the file names from stdin, one per line (UTF-8)");
+		wprintln(stderr, L"   -0, --null   input and output records are terminated by NUL, not newline");
+		wprintln(stderr, L"   --jobs <N>   resolve up to N paths in parallel (output order is preserved)");
+		wprintln(stderr, L"   --lexical    only normalize the path, without accessing the file system");
+		wprintln(stderr, L"   --format <F> output format: \"plain\" (default), \"tsv\" or \"json\"");
+		wprintln(stderr, L"   --relative-to <D>  print the paths relative to the directory D");
+		wprintln(stderr, L"   --batch <N>  check up to N paths at once, listing shared directories once\n");
 		wprintln(stderr, L"Exit status:");
 		wprintln(stderr, L"   0 - Path converted successfully");
 		wprintln(stderr, L"   1 - Failed with error");
 		wprintln(stderr, L"   2 - Interrupted by user\n");
+		wprintln(stderr, L"Remarks:");
+		wprintln(stderr, L"   With --format, each record holds the path, the type (\"file\", \"directory\"");
+		wprintln(stderr, L"   or \"none\"), the size, the last modified time (UTC) and the file ID.\n");
 		return EXIT_FAILURE;
 	}
 
 	//Parse command-line options
-	for (; (argOffset < argc) && (!wcsncmp(argv[argOffset], L"--", 2)); ++argOffset)
+	for (; (argOffset < argc) && ((!wcsncmp(argv[argOffset], L"--", 2)) || (!wcscmp(argv[argOffset], L"-0"))); ++argOffset)
 	{
+		if (!wcscmp(argv[argOffset], L"-0"))
+		{
+			opt_null = TRUE;
+			continue;
+		}
 		if(!argv[argOffset][2U])
 		{
 			++argOffset;
@@ -90,56 +883,165 @@ int wmain(int argc, wchar_t *argv[])
 		TRY_PARSE_OPTION(1, exists)
 		TRY_PARSE_OPTION(2, file)
 		TRY_PARSE_OPTION(3, directory)
+		if (!_wcsicmp(argv[argOffset] + 2U, L"stdin"))
+		{
+			opt_stdin = TRUE;
+			continue;
+		}
+		if (!_wcsicmp(argv[argOffset] + 2U, L"null"))
+		{
+			opt_null = TRUE;
+			continue;
+		}
+		if (!_wcsicmp(argv[argOffset] + 2U, L"lexical"))
+		{
+			opt_lexical = TRUE;
+			continue;
+		}
+		if (!_wcsicmp(argv[argOffset] + 2U, L"format"))
+		{
+			if ((++argOffset < argc) && ((!_wcsicmp(argv[argOffset], L"plain")) || (!_wcsicmp(argv[argOffset], L"tsv")) || (!_wcsicmp(argv[argOffset], L"json"))))
+			{
+				format = (!_wcsicmp(argv[argOffset], L"json")) ? FORMAT_JSON : ((!_wcsicmp(argv[argOffset], L"tsv")) ? FORMAT_TSV : FORMAT_PLAIN);
+				continue;
+			}
+			wprintln(stderr, L"Error: Option --format requires \"plain\", \"tsv\" or \"json\"!\n");
+			return EXIT_FAILURE;
+		}
+		if (!_wcsicmp(argv[argOffset] + 2U, L"relative-to"))
+		{
+			if (++argOffset >= argc)
+			{
+				wprintln(stderr, L"Error: Option --relative-to requires a directory!\n");
+				return EXIT_FAILURE;
+			}
+			relativeTo = argv[argOffset];
+			continue;
+		}
+		if (!_wcsicmp(argv[argOffset] + 2U, L"batch"))
+		{
+			if ((++argOffset >= argc) || parseULong(argv[argOffset], &batchSize) || (batchSize < 1U) || (batchSize > MAXIMUM_BATCH))
+			{
+				fwprintf(stderr, L"Error: Option --batch requires a number between 1 and %u!\n\n", MAXIMUM_BATCH);
+				return EXIT_FAILURE;
+			}
+			continue;
+		}
+		if (!_wcsicmp(argv[argOffset] + 2U, L"jobs"))
+		{
+			if ((++argOffset >= argc) || parseULong(argv[argOffset], &jobs) || (jobs < 1U) || (jobs > MAXIMUM_JOBS))
+			{
+				fwprintf(stderr, L"Error: Option --jobs requires a number between 1 and %u!\n\n", MAXIMUM_JOBS);
+				return EXIT_FAILURE;
+			}
+			continue;
+		}
 		fwprintf(stderr, L"Error: Unknown option \"%s\" encountered!\n\n", argv[argOffset]);
 		return EXIT_FAILURE;
 	}
 
+	//Check for conflicting options
+	if (opt_lexical && (check_mode || format))
+	{
+		wprintln(stderr, L"Error: Option --lexical can not be combined with --exists, --file, --directory or --format!\n");
+		return EXIT_FAILURE;
+	}
+
+	if (batchSize && ((!check_mode) || format || (jobs > 1U)))
+	{
+		wprintln(stderr, L"Error: Option --batch requires --exists, --file or --directory, and can not be combined with --format or --jobs!\n");
+		return EXIT_FAILURE;
+	}
+
 	//Check remaining file count
-	if (argOffset >= argc)
+	if (opt_stdin ? (argOffset < argc) : (argOffset >= argc))
 	{
-		wprintln(stderr, L"Error: No file name specified. Nothing to do!\n");
+		wprintln(stderr, opt_stdin ? L"Error: File names can not be combined with --stdin!\n" : L"Error: No file name specified. Nothing to do!\n");
 		return EXIT_FAILURE;
 	}
 
-	//Process all files
-	for (; argOffset < argc; ++argOffset)
+	//Set up buffered output (anything still pending in the CRT stream goes first)
+	fflush(stdout);
+	sink.options.checkMode = check_mode;
+	sink.options.lexical = opt_lexical;
+	sink.options.format = format;
+	sink.nullMode = opt_null;
+
+	//Resolve the base directory, once for all paths
+	if (relativeTo)
+	{
+		if (!(basePath = opt_lexical ? getLexicalPath(relativeTo, NULL) : getCanonicalPath(relativeTo)))
+		{
+			fwprintf(stderr, L"Error: Path \"%s\" could not be resolved!\n\n", relativeTo);
+			goto cleanup;
+		}
+		if (!relativeBaseInit(&base, basePath))
+		{
+			fwprintf(stderr, L"Error: Path \"%s\" can not be used as base directory!\n\n", basePath);
+			goto cleanup;
+		}
+		sink.options.relativeTo = &base;
+	}
+	if (!outputOpen(&sink.output, GetStdHandle(STD_OUTPUT_HANDLE), OUTPUT_BUFFER_SIZE))
+	{
+		wprintln(stderr, L"Error: Memory allocation has failed!\n");
+		goto cleanup;
+	}
+
+	//Start the worker threads
+	if (jobs > 1U)
+	{
+		if (!poolOpen(&pool, jobs, &sink.options))
+		{
+			wprintln(stderr, L"Error: Failed to create the worker threads!\n");
+			goto cleanup;
+		}
+		sink.pool = &pool;
+	}
+
+	//Set up the batch buffer
+	if (batchSize)
 	{
-		//Convert to absoloute paths
-		fullPath = getCanonicalPath(argv[argOffset]);
-		if (!fullPath)
+		if (!batchOpen(&batch, batchSize))
 		{
-			fwprintf(stderr, L"Error: Path \"%s\" could not be resolved!\n\n", argv[argOffset]);
+			wprintln(stderr, L"Error: Memory allocation has failed!\n");
 			goto cleanup;
 		}
+		sink.batch = &batch;
+	}
 
-		//Check if file exists
-		if(check_mode) 
+	//Process all files
+	if (opt_stdin)
+	{
+		if (!inputOpen(&input, GetStdHandle(STD_INPUT_HANDLE)))
 		{
-			if ((attribs = getAttributes(fullPath, NULL)) == INVALID_FILE_ATTRIBUTES) \
-			{ 
-				fwprintf(stderr, L"Error: File \"%s\" not found or access denied!\n\n", fullPath);
+			wprintln(stderr, L"Error: Memory allocation has failed!\n");
+			goto cleanup;
+		}
+		if (!processInput(&input, &sink))
+		{
+			goto cleanup;
+		}
+	}
+	else
+	{
+		for (; argOffset < argc; ++argOffset)
+		{
+			if (!submitPath(&sink, argv[argOffset]))
+			{
 				goto cleanup;
 			}
-			switch(check_mode) {
-			case 2:
-				if(attribs & FILE_ATTRIBUTE_DIRECTORY)
-				{
-					fwprintf(stderr, L"Error: Path \"%s\" points to a directory!\n\n", fullPath); \
-					goto cleanup;
-				}
-				break;
-			case 3:
-				if (!(attribs & FILE_ATTRIBUTE_DIRECTORY))
-				{
-					fwprintf(stderr, L"Error: Path \"%s\" points to a regular file!\n\n", fullPath); \
-					goto cleanup;
-				}
-				break;
-			}
 		}
+	}
 
-		//Print the full path to stdout
-		_putws(fullPath);
+	//Wait for the outstanding paths
+	if (sink.pool && (!poolDrain(&sink, 0U)))
+	{
+		goto cleanup;
+	}
+	if (sink.batch && (!batchFlush(&sink)))
+	{
+		goto cleanup;
 	}
 
 	//Completed
@@ -147,6 +1049,24 @@ int wmain(int argc, wchar_t *argv[])
 
 	//Perform final clean-up
 cleanup:
-	FREE(fullPath);
+	if (isInterrupted())
+	{
+		result = EXIT_INTERRUPTED;
+	}
+	if (sink.pool)
+	{
+		poolClose(sink.pool);
+	}
+	batchClose(&batch);
+	inputClose(&input);
+	pathCacheFree(&sink.cache);
+	arenaFree(&sink.arena);
+	relativeBaseFree(&base);
+	FREE(basePath);
+	if ((!outputClose(&sink.output)) && (result == EXIT_SUCCESS))
+	{
+		wprintln(stderr, L"Error: Failed to write output!\n");
+		result = EXIT_FAILURE;
+	}
 	return result; /*exit*/
 }
@@ -0,0 +1,465 @@
+/*
+ * Directory snapshot functions
+ * Created by LoRd_MuldeR <mulder2@gmx.de>.
+ *
+ * This work is licensed under the CC0 1.0 Universal License.
+ * To view a copy of the license, visit:
+ * https://creativecommons.org/publicdomain/zero/1.0/legalcode
+ */
+
+#define _CRT_SECURE_NO_WARNINGS
+#include "snapshot.h"
+
+#include <stdlib.h>
+#include <wchar.h>
+
+#define NAME_BLOCK_SIZE 32768U /*characters per name block*/
+#define DIR_BUFFER_SIZE 65536U /*bytes per directory query*/
+
+/* ======================================================================= */
+/* INITIALIZATION                                                          */
+/* ======================================================================= */
+
+static void freeNameBlocks(snapshot_block *block)
+{
+	while (block)
+	{
+		snapshot_block *const next = block->next;
+		free(block);
+		block = next;
+	}
+}
+
+void snapshotInit(snapshot_t *const snapshot)
+{
+	memset(snapshot, 0, sizeof(snapshot_t));
+}
+
+void snapshotFree(snapshot_t *const snapshot)
+{
+	FREE(snapshot->entries);
+	freeNameBlocks(snapshot->names);
+	snapshotInit(snapshot);
+}
+
+void snapshotSwap(snapshot_t *const a, snapshot_t *const b)
+{
+	const snapshot_t temp = *a;
+	*a = *b;
+	*b = temp;
+}
+
+/* ======================================================================= */
+/* ENTRY HANDLING                                                          */
+/* ======================================================================= */
+
+static __inline unsigned long long makeULongLong(const DWORD high, const DWORD low)
+{
+	ULARGE_INTEGER tmp;
+	tmp.HighPart = high;
+	tmp.LowPart = low;
+	return tmp.QuadPart;
+}
+
+static __inline BOOL isDotEntry(const wchar_t *const name, const size_t length)
+{
+	return ((length == 1U) && (name[0U] == L'.')) || ((length == 2U) && (name[0U] == L'.') && (name[1U] == L'.'));
+}
+
+static const wchar_t *storeName(snapshot_t *const snapshot, const wchar_t *const name, const size_t length)
+{
+	wchar_t *buffer;
+	snapshot_block *block = snapshot->names;
+
+	//Allocate new block, if current block is exhausted
+	if ((!block) || ((block->used + length + 1U) > NAME_BLOCK_SIZE))
+	{
+		const size_t capacity = ((length + 1U) > NAME_BLOCK_SIZE) ? (length + 1U) : NAME_BLOCK_SIZE;
+		if (!(block = (snapshot_block*) malloc(sizeof(snapshot_block) + (sizeof(wchar_t) * capacity))))
+		{
+			return NULL; /*allocation failed*/
+		}
+		block->next = snapshot->names;
+		block->used = 0U;
+		snapshot->names = block;
+	}
+
+	//Copy the name into the current block
+	buffer = block->data + block->used;
+	wmemcpy(buffer, name, length);
+	buffer[length] = L'\0';
+	block->used += length + 1U;
+
+	return buffer;
+}
+
+static BOOL appendEntry(snapshot_t *const snapshot, const wchar_t *const name, const size_t length, const DWORD attributes, const unsigned long long size, const unsigned long long mtime, const unsigned long long fileId)
+{
+	snapshot_entry *entry;
+
+	//Increase capacity as needed
+	if (snapshot->count >= snapshot->capacity)
+	{
+		const size_t capacity = snapshot->capacity ? (snapshot->capacity * 2U) : 64U;
+		snapshot_entry *const entries = (snapshot_entry*) realloc(snapshot->entries, sizeof(snapshot_entry) * capacity);
+		if (!entries)
+		{
+			return FALSE; /*allocation failed*/
+		}
+		snapshot->entries = entries;
+		snapshot->capacity = capacity;
+	}
+
+	//Append the new entry
+	entry = &snapshot->entries[snapshot->count];
+	if (!(entry->name = storeName(snapshot, name, length)))
+	{
+		return FALSE;
+	}
+	entry->attributes = attributes;
+	entry->size = size;
+	entry->mtime = mtime;
+	entry->fileId = fileId;
+	snapshot->count++;
+
+	return TRUE;
+}
+
+static int __cdecl compareEntries(const void *const a, const void *const b)
+{
+	return _wcsicmp(((const snapshot_entry*)a)->name, ((const snapshot_entry*)b)->name);
+}
+
+/* ======================================================================= */
+/* DIRECTORY SCANNING                                                      */
+/* ======================================================================= */
+
+//GetFileInformationByHandleEx support
+typedef BOOL (WINAPI *PGETFILEINFORMATIONBYHANDLEEX)(HANDLE hFile, FILE_INFO_BY_HANDLE_CLASS FileInformationClass, LPVOID lpFileInformation, DWORD dwBufferSize);
+static volatile LONG getFileInformationInit = 0L;
+static PGETFILEINFORMATIONBYHANDLEEX getFileInformationPtr = NULL;
+
+static BOOL initFileInformation(void)
+{
+	LONG state = 0L;
+
+	//Initialize on first call
+	while ((state = InterlockedCompareExchange(&getFileInformationInit, -1L, 0L)) != 1L)
+	{
+		if(!state) /*first thread initializes*/
+		{
+			getFileInformationPtr = (PGETFILEINFORMATIONBYHANDLEEX) GetProcAddress(GetModuleHandleW(L"kernel32.dll"), "GetFileInformationByHandleEx");
+			InterlockedExchange(&getFileInformationInit, 1L);
+		}
+		else
+		{
+			Sleep(0U); /*wait for initialized*/
+		}
+	}
+
+	return (getFileInformationPtr != NULL);
+}
+
+static BOOL scanDirectoryEx(snapshot_t *const snapshot, const wchar_t *const directoryPath, BOOL *const fallback)
+{
+	BOOL success = FALSE, restart = TRUE;
+	BYTE *buffer = NULL;
+	HANDLE handle = INVALID_HANDLE_VALUE;
+
+	//Is available?
+	*fallback = TRUE;
+	if (!initFileInformation())
+	{
+		return FALSE; /*GetFileInformationByHandleEx unavailable!*/
+	}
+
+	//Open the directory
+	handle = CreateFileW(directoryPath, FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+	if (handle == INVALID_HANDLE_VALUE)
+	{
+		*fallback = FALSE;
+		return FALSE;
+	}
+
+	//Allocate buffer
+	if (!(buffer = (BYTE*) malloc(DIR_BUFFER_SIZE)))
+	{
+		*fallback = FALSE;
+		goto cleanup;
+	}
+
+	//Read directory entries, one large batch at a time
+	for (;;)
+	{
+		const FILE_ID_BOTH_DIR_INFO *info = (const FILE_ID_BOTH_DIR_INFO*) buffer;
+		if (!getFileInformationPtr(handle, restart ? FileIdBothDirectoryRestartInfo : FileIdBothDirectoryInfo, buffer, DIR_BUFFER_SIZE))
+		{
+			const DWORD error = GetLastError();
+			if (error == ERROR_NO_MORE_FILES)
+			{
+				*fallback = FALSE;
+				success = TRUE;
+			}
+			else if ((!restart) || ((error != ERROR_INVALID_PARAMETER) && (error != ERROR_INVALID_FUNCTION) && (error != ERROR_NOT_SUPPORTED)))
+			{
+				*fallback = FALSE; /*not a capability problem*/
+			}
+			break;
+		}
+		restart = *fallback = FALSE;
+		for (;;)
+		{
+			const size_t length = info->FileNameLength / sizeof(wchar_t);
+			if (!isDotEntry(info->FileName, length))
+			{
+				if (!appendEntry(snapshot, info->FileName, length, info->FileAttributes, info->EndOfFile.QuadPart, info->LastWriteTime.QuadPart, info->FileId.QuadPart))
+				{
+					goto cleanup;
+				}
+			}
+			if (!info->NextEntryOffset)
+			{
+				break;
+			}
+			info = (const FILE_ID_BOTH_DIR_INFO*) (((const BYTE*)info) + info->NextEntryOffset);
+		}
+	}
+
+cleanup:
+	FREE(buffer);
+	CLOSE_HANDLE(handle);
+	return success;
+}
+
+static wchar_t *makeFindPath(const wchar_t *const directoryPath, const wchar_t *const name)
+{
+	const size_t dirLen = wcslen(directoryPath), nameLen = wcslen(name);
+	const BOOL separator = (dirLen > 0U) && (directoryPath[dirLen - 1U] != L'\\') && (directoryPath[dirLen - 1U] != L'/');
+	wchar_t *const buffer = (wchar_t*) malloc(sizeof(wchar_t) * (dirLen + nameLen + 2U));
+	if (buffer)
+	{
+		wmemcpy(buffer, directoryPath, dirLen);
+		if (separator)
+		{
+			buffer[dirLen] = L'\\';
+		}
+		wmemcpy(buffer + dirLen + (separator ? 1U : 0U), name, nameLen + 1U);
+	}
+	return buffer;
+}
+
+static BOOL appendFindData(snapshot_t *const snapshot, const WIN32_FIND_DATAW *const findData)
+{
+	const size_t length = wcslen(findData->cFileName);
+	if (isDotEntry(findData->cFileName, length))
+	{
+		return TRUE; /*skip*/
+	}
+	return appendEntry(snapshot, findData->cFileName, length, findData->dwFileAttributes,
+		makeULongLong(findData->nFileSizeHigh, findData->nFileSizeLow),
+		makeULongLong(findData->ftLastWriteTime.dwHighDateTime, findData->ftLastWriteTime.dwLowDateTime), 0ULL);
+}
+
+static BOOL scanDirectory(snapshot_t *const snapshot, const wchar_t *const directoryPath)
+{
+	BOOL success = FALSE;
+	WIN32_FIND_DATAW findData;
+	HANDLE handle = INVALID_HANDLE_VALUE;
+
+	//Build the search pattern
+	const wchar_t *const pattern = makeFindPath(directoryPath, L"*");
+	if (!pattern)
+	{
+		return FALSE;
+	}
+
+	//Enumerate all entries
+	if ((handle = FindFirstFileW(pattern, &findData)) != INVALID_HANDLE_VALUE)
+	{
+		do
+		{
+			if (!appendFindData(snapshot, &findData))
+			{
+				goto cleanup;
+			}
+		}
+		while (FindNextFileW(handle, &findData));
+		success = (GetLastError() == ERROR_NO_MORE_FILES);
+	}
+
+cleanup:
+	if (handle != INVALID_HANDLE_VALUE)
+	{
+		FindClose(handle);
+	}
+	FREE(pattern);
+	return success;
+}
+
+static BOOL appendFileInfo(snapshot_t *const snapshot, const wchar_t *const filePath, const wchar_t *const name, BOOL *const exists)
+{
+	BY_HANDLE_FILE_INFORMATION info;
+	BOOL success = FALSE;
+
+	//Open the file itself, so that the file ID is recorded, too
+	const HANDLE handle = CreateFileW(filePath, FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+	if (handle == INVALID_HANDLE_VALUE)
+	{
+		const DWORD error = GetLastError();
+		*exists = (error != ERROR_FILE_NOT_FOUND) && (error != ERROR_PATH_NOT_FOUND);
+		return FALSE;
+	}
+
+	*exists = TRUE;
+	if (GetFileInformationByHandle(handle, &info))
+	{
+		success = appendEntry(snapshot, name, wcslen(name), info.dwFileAttributes,
+			makeULongLong(info.nFileSizeHigh, info.nFileSizeLow),
+			makeULongLong(info.ftLastWriteTime.dwHighDateTime, info.ftLastWriteTime.dwLowDateTime),
+			makeULongLong(info.nFileIndexHigh, info.nFileIndexLow));
+	}
+
+	CloseHandle(handle);
+	return success;
+}
+
+static BOOL scanNames(snapshot_t *const snapshot, const wchar_t *const directoryPath, const wchar_t *const *const names, const size_t nameCount)
+{
+	size_t idx;
+	WIN32_FIND_DATAW findData;
+
+	for (idx = 0U; idx < nameCount; ++idx)
+	{
+		HANDLE handle;
+		BOOL exists = FALSE;
+		const size_t count = snapshot->count;
+		const wchar_t *const filePath = makeFindPath(directoryPath, names[idx]);
+		if (!filePath)
+		{
+			return FALSE;
+		}
+		if ((!appendFileInfo(snapshot, filePath, names[idx], &exists)) && exists && (snapshot->count == count))
+		{
+			//File can not be opened (e.g. access denied), so fall back to the directory entry, without file ID
+			if ((handle = FindFirstFileW(filePath, &findData)) != INVALID_HANDLE_VALUE)
+			{
+				FindClose(handle);
+				if (!appendFindData(snapshot, &findData))
+				{
+					FREE(filePath);
+					return FALSE;
+				}
+			}
+		}
+		FREE(filePath); /*missing files are simply not recorded*/
+	}
+
+	return TRUE;
+}
+
+BOOL snapshotScan(snapshot_t *const snapshot, const wchar_t *const directoryPath, const wchar_t *const *const names, const size_t nameCount)
+{
+	BOOL success = FALSE, fallback = FALSE;
+
+	//Reset, but keep the entry buffer for re-use
+	freeNameBlocks(snapshot->names);
+	snapshot->names = NULL;
+	snapshot->count = 0U;
+
+	//Scan either the selected names or the whole directory
+	if (names)
+	{
+		success = scanNames(snapshot, directoryPath, names, nameCount);
+	}
+	else if (!(success = scanDirectoryEx(snapshot, directoryPath, &fallback)))
+	{
+		if (fallback)
+		{
+			snapshot->count = 0U;
+			success = scanDirectory(snapshot, directoryPath);
+		}
+	}
+
+	//Sort by name, so that look-ups and comparisons are cheap
+	if (success && (snapshot->count > 1U))
+	{
+		qsort(snapshot->entries, snapshot->count, sizeof(snapshot_entry), compareEntries);
+	}
+
+	return success;
+}
+
+/* ======================================================================= */
+/* LOOK-UP AND COMPARISON                                                  */
+/* ======================================================================= */
+
+const snapshot_entry *snapshotFind(const snapshot_t *const snapshot, const wchar_t *const name)
+{
+	size_t lower = 0U, upper = snapshot->count;
+	while (lower < upper)
+	{
+		const size_t pivot = lower + ((upper - lower) / 2U);
+		const int cmp = _wcsicmp(name, snapshot->entries[pivot].name);
+		if (!cmp)
+		{
+			return &snapshot->entries[pivot];
+		}
+		if (cmp < 0)
+		{
+			upper = pivot;
+		}
+		else
+		{
+			lower = pivot + 1U;
+		}
+	}
+	return NULL;
+}
+
+static __inline BOOL entryDiffers(const snapshot_entry *const a, const snapshot_entry *const b)
+{
+	return (a->attributes != b->attributes) || (a->size != b->size) || (a->mtime != b->mtime) || (a->fileId && b->fileId && (a->fileId != b->fileId));
+}
+
+size_t snapshotDiff(const snapshot_t *const prev, const snapshot_t *const next, const snapshot_callback callback, void *const context)
+{
+	size_t prevIdx = 0U, nextIdx = 0U, changes = 0U;
+
+	while ((prevIdx < prev->count) || (nextIdx < next->count))
+	{
+		const int cmp = (prevIdx >= prev->count) ? 1 : ((nextIdx >= next->count) ? -1 : _wcsicmp(prev->entries[prevIdx].name, next->entries[nextIdx].name));
+		if (cmp < 0)
+		{
+			++changes;
+			if (callback)
+			{
+				callback(context, SNAPSHOT_REMOVED, &prev->entries[prevIdx]);
+			}
+			++prevIdx;
+		}
+		else if (cmp > 0)
+		{
+			++changes;
+			if (callback)
+			{
+				callback(context, SNAPSHOT_ADDED, &next->entries[nextIdx]);
+			}
+			++nextIdx;
+		}
+		else
+		{
+			if (entryDiffers(&prev->entries[prevIdx], &next->entries[nextIdx]))
+			{
+				++changes;
+				if (callback)
+				{
+					callback(context, SNAPSHOT_MODIFIED, &next->entries[nextIdx]);
+				}
+			}
+			++prevIdx;
+			++nextIdx;
+		}
+	}
+
+	return changes;
+}
@@ -0,0 +1,52 @@
+/*
+ * Directory snapshot functions
+ * Created by LoRd_MuldeR <mulder2@gmx.de>.
+ *
+ * This work is licensed under the CC0 1.0 Universal License.
+ * To view a copy of the license, visit:
+ * https://creativecommons.org/publicdomain/zero/1.0/legalcode
+ */
+
+#pragma once
+
+#include "common.h"
+
+#define SNAPSHOT_ADDED    1
+#define SNAPSHOT_REMOVED  2
+#define SNAPSHOT_MODIFIED 3
+
+typedef struct
+{
+	const wchar_t *name;
+	DWORD attributes;
+	unsigned long long size;
+	unsigned long long mtime;
+	unsigned long long fileId;
+}
+snapshot_entry;
+
+typedef struct _snapshot_block
+{
+	struct _snapshot_block *next;
+	size_t used;
+	wchar_t data[1];
+}
+snapshot_block;
+
+typedef struct
+{
+	snapshot_entry *entries;
+	size_t count, capacity;
+	snapshot_block *names;
+}
+snapshot_t;
+
+typedef void (*snapshot_callback)(void *const context, const int action, const snapshot_entry *const entry);
+
+void snapshotInit(snapshot_t *const snapshot);
+void snapshotFree(snapshot_t *const snapshot);
+void snapshotSwap(snapshot_t *const a, snapshot_t *const b);
+
+BOOL snapshotScan(snapshot_t *const snapshot, const wchar_t *const directoryPath, const wchar_t *const *const names, const size_t nameCount);
+const snapshot_entry *snapshotFind(const snapshot_t *const snapshot, const wchar_t *const name);
+size_t snapshotDiff(const snapshot_t *const prev, const snapshot_t *const next, const snapshot_callback callback, void *const context);
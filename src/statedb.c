@@ -0,0 +1,354 @@
+/*
+ * Persistent file state database
+ * Created by LoRd_MuldeR <mulder2@gmx.de>.
+ *
+ * This work is licensed under the CC0 1.0 Universal License.
+ * To view a copy of the license, visit:
+ * https://creativecommons.org/publicdomain/zero/1.0/legalcode
+ */
+
+#define _CRT_SECURE_NO_WARNINGS
+#include "statedb.h"
+
+#include <stdlib.h>
+#include <wchar.h>
+
+#define STATEDB_MAGIC 0x4244574EUL /*"NWDB"*/
+#define STATEDB_VERSION 1UL
+#define HASH_BUFFER_SIZE 65536U /*bytes per read, when computing the content hash*/
+
+/*
+ * File layout (little-endian):
+ *   header: magic, version, record count, reserved (4 x DWORD)
+ *   record: size, mtime, file id, hash (4 x ULONGLONG), attributes, path length (2 x DWORD), path (incl. NUL), padded to 8 bytes
+ * The records are sorted by path, case-insensitive.
+ */
+
+typedef struct
+{
+	DWORD magic, version, count, reserved;
+}
+statedb_header;
+
+typedef struct
+{
+	unsigned long long size, mtime, fileId, hash;
+	DWORD attributes, length;
+}
+statedb_record;
+
+#define RECORD_SIZE(LEN) ((sizeof(statedb_record) + ((LEN) * sizeof(wchar_t)) + 7U) & (~((size_t)7U)))
+
+/* ======================================================================= */
+/* OPEN AND CLOSE                                                          */
+/* ======================================================================= */
+
+static int __cdecl compareEntries(const void *const a, const void *const b)
+{
+	return _wcsicmp(((const statedb_entry*)a)->path, ((const statedb_entry*)b)->path);
+}
+
+static BOOL parseRecords(statedb_t *const db, const size_t viewSize)
+{
+	const statedb_header *const header = (const statedb_header*) db->view;
+	size_t offset = sizeof(statedb_header), idx;
+
+	if ((viewSize < sizeof(statedb_header)) || (header->magic != STATEDB_MAGIC) || (header->version != STATEDB_VERSION) || (header->count > (viewSize / sizeof(statedb_record))))
+	{
+		return FALSE;
+	}
+	if ((header->count > 0U) && (!(db->entries = (statedb_entry*) calloc(header->count, sizeof(statedb_entry)))))
+	{
+		return FALSE;
+	}
+
+	//The paths are used in-place, straight from the mapped view
+	for (idx = 0U; idx < header->count; ++idx)
+	{
+		const statedb_record *record;
+		statedb_entry *const entry = &db->entries[idx];
+		if ((viewSize - offset) < sizeof(statedb_record))
+		{
+			return FALSE;
+		}
+		record = (const statedb_record*) (db->view + offset);
+		if ((record->length < 1U) || (((viewSize - offset) - sizeof(statedb_record)) / sizeof(wchar_t) < record->length))
+		{
+			return FALSE;
+		}
+		entry->path = (const wchar_t*) (db->view + offset + sizeof(statedb_record));
+		if (entry->path[record->length - 1U])
+		{
+			return FALSE; /*path must be terminated*/
+		}
+		entry->attributes = record->attributes;
+		entry->size = record->size;
+		entry->mtime = record->mtime;
+		entry->fileId = record->fileId;
+		entry->hash = record->hash;
+		offset += RECORD_SIZE(record->length);
+		if (offset > viewSize)
+		{
+			offset = viewSize; /*last record may be unpadded*/
+		}
+	}
+
+	db->count = header->count;
+	qsort(db->entries, db->count, sizeof(statedb_entry), compareEntries);
+	return TRUE;
+}
+
+BOOL statedbOpen(statedb_t *const db, const wchar_t *const fileName)
+{
+	LARGE_INTEGER fileSize;
+	memset(db, 0, sizeof(statedb_t));
+
+	//A missing database is an empty database
+	db->file = CreateFileW(fileName, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (db->file == INVALID_HANDLE_VALUE)
+	{
+		db->file = NULL;
+		return (GetLastError() == ERROR_FILE_NOT_FOUND);
+	}
+	if ((!GetFileSizeEx(db->file, &fileSize)) || (fileSize.HighPart != 0) || (fileSize.LowPart < sizeof(statedb_header)))
+	{
+		statedbClose(db);
+		return FALSE;
+	}
+
+	//Map the whole database into memory
+	if (!(db->mapping = CreateFileMappingW(db->file, NULL, PAGE_READONLY, 0U, 0U, NULL)))
+	{
+		statedbClose(db);
+		return FALSE;
+	}
+	if (!(db->view = (const BYTE*) MapViewOfFile(db->mapping, FILE_MAP_READ, 0U, 0U, 0U)))
+	{
+		statedbClose(db);
+		return FALSE;
+	}
+	if (!parseRecords(db, fileSize.LowPart))
+	{
+		statedbClose(db);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+void statedbClose(statedb_t *const db)
+{
+	FREE(db->entries);
+	if (db->view)
+	{
+		UnmapViewOfFile(db->view);
+	}
+	CLOSE_HANDLE(db->mapping);
+	CLOSE_HANDLE(db->file);
+	memset(db, 0, sizeof(statedb_t));
+}
+
+/* ======================================================================= */
+/* QUERY                                                                   */
+/* ======================================================================= */
+
+const statedb_entry *statedbFind(const statedb_t *const db, const wchar_t *const path)
+{
+	size_t lower = 0U, upper = db->count;
+	while (lower < upper)
+	{
+		const size_t pivot = lower + ((upper - lower) / 2U);
+		const int cmp = _wcsicmp(path, db->entries[pivot].path);
+		if (!cmp)
+		{
+			return &db->entries[pivot];
+		}
+		if (cmp < 0)
+		{
+			upper = pivot;
+		}
+		else
+		{
+			lower = pivot + 1U;
+		}
+	}
+	return NULL;
+}
+
+static BOOL computeHash(const HANDLE handle, unsigned long long *const hash)
+{
+	BYTE *const buffer = (BYTE*) malloc(HASH_BUFFER_SIZE);
+	unsigned long long value = 14695981039346656037ULL; /*FNV-1a offset basis*/
+	DWORD bytesRead, idx;
+	BOOL success;
+
+	if (!buffer)
+	{
+		return FALSE;
+	}
+
+	//A successful read of zero bytes marks the end of the file
+	while ((success = ReadFile(handle, buffer, HASH_BUFFER_SIZE, &bytesRead, NULL)) && (bytesRead > 0U))
+	{
+		for (idx = 0U; idx < bytesRead; ++idx)
+		{
+			value = (value ^ buffer[idx]) * 1099511628211ULL; /*FNV-1a prime*/
+		}
+	}
+
+	FREE(buffer);
+	*hash = value;
+	return success;
+}
+
+BOOL statedbQuery(statedb_entry *const entry, const wchar_t *const path, const BOOL withHash)
+{
+	BY_HANDLE_FILE_INFORMATION info;
+	HANDLE handle;
+	BOOL success = FALSE;
+
+	memset(entry, 0, sizeof(statedb_entry));
+	entry->path = path;
+
+	//Opening with FILE_READ_ATTRIBUTES only does not conflict with any writer
+	handle = CreateFileW(path, withHash ? GENERIC_READ : FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | (withHash ? FILE_FLAG_SEQUENTIAL_SCAN : 0U), NULL);
+	if (handle == INVALID_HANDLE_VALUE)
+	{
+		return FALSE;
+	}
+
+	if (GetFileInformationByHandle(handle, &info))
+	{
+		entry->attributes = info.dwFileAttributes;
+		entry->size = (((unsigned long long)info.nFileSizeHigh) << 32) | info.nFileSizeLow;
+		entry->mtime = (((unsigned long long)info.ftLastWriteTime.dwHighDateTime) << 32) | info.ftLastWriteTime.dwLowDateTime;
+		entry->fileId = (((unsigned long long)info.nFileIndexHigh) << 32) | info.nFileIndexLow;
+		success = TRUE;
+		if (withHash && (!(info.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)))
+		{
+			SetLastError(ERROR_SUCCESS);
+			success = computeHash(handle, &entry->hash);
+		}
+	}
+
+	CloseHandle(handle);
+	return success;
+}
+
+BOOL statedbEqual(const statedb_entry *const a, const statedb_entry *const b)
+{
+	/*attributes are informational only, so that the "archive" bit does not matter*/
+	return (a->size == b->size) && (a->mtime == b->mtime) && (a->fileId == b->fileId) && ((!a->hash) || (!b->hash) || (a->hash == b->hash));
+}
+
+/* ======================================================================= */
+/* COMMIT                                                                  */
+/* ======================================================================= */
+
+static BYTE *writeRecord(BYTE *const position, const statedb_entry *const entry)
+{
+	const DWORD length = (DWORD) wcslen(entry->path) + 1U;
+	statedb_record *const record = (statedb_record*) position;
+	record->size = entry->size;
+	record->mtime = entry->mtime;
+	record->fileId = entry->fileId;
+	record->hash = entry->hash;
+	record->attributes = entry->attributes;
+	record->length = length;
+	memcpy(position + sizeof(statedb_record), entry->path, length * sizeof(wchar_t));
+	return position + RECORD_SIZE(length);
+}
+
+static BOOL writeDatabase(const wchar_t *const fileName, const statedb_t *const db, const statedb_entry *const updates, const size_t updateCount)
+{
+	const HANDLE file = CreateFileW(fileName, GENERIC_READ | GENERIC_WRITE, 0U, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	HANDLE mapping = NULL;
+	BYTE *view = NULL, *position;
+	size_t totalSize = sizeof(statedb_header), dbIdx = 0U, updateIdx = 0U, count = 0U;
+	BOOL success = FALSE;
+
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return FALSE;
+	}
+
+	//Compute the size of the merged database (updates replace existing records of the same path)
+	while ((dbIdx < db->count) || (updateIdx < updateCount))
+	{
+		const int cmp = (dbIdx >= db->count) ? 1 : ((updateIdx >= updateCount) ? -1 : _wcsicmp(db->entries[dbIdx].path, updates[updateIdx].path));
+		const statedb_entry *const entry = (cmp < 0) ? (&db->entries[dbIdx++]) : (&updates[updateIdx++]);
+		if (!cmp)
+		{
+			++dbIdx;
+		}
+		totalSize += RECORD_SIZE(wcslen(entry->path) + 1U);
+		++count;
+	}
+
+	//Write the merged records through a mapped view
+	if ((mapping = CreateFileMappingW(file, NULL, PAGE_READWRITE, 0U, (DWORD) totalSize, NULL)) && (view = (BYTE*) MapViewOfFile(mapping, FILE_MAP_WRITE, 0U, 0U, 0U)))
+	{
+		statedb_header *const header = (statedb_header*) view;
+		header->magic = STATEDB_MAGIC;
+		header->version = STATEDB_VERSION;
+		header->count = (DWORD) count;
+		header->reserved = 0U;
+		position = view + sizeof(statedb_header);
+		dbIdx = updateIdx = 0U;
+		while ((dbIdx < db->count) || (updateIdx < updateCount))
+		{
+			const int cmp = (dbIdx >= db->count) ? 1 : ((updateIdx >= updateCount) ? -1 : _wcsicmp(db->entries[dbIdx].path, updates[updateIdx].path));
+			const statedb_entry *const entry = (cmp < 0) ? (&db->entries[dbIdx++]) : (&updates[updateIdx++]);
+			if (!cmp)
+			{
+				++dbIdx;
+			}
+			position = writeRecord(position, entry);
+		}
+		success = FlushViewOfFile(view, 0U);
+	}
+
+	if (view)
+	{
+		UnmapViewOfFile(view);
+	}
+	CLOSE_HANDLE(mapping);
+	if (success)
+	{
+		success = FlushFileBuffers(file);
+	}
+	CloseHandle(file);
+	return success;
+}
+
+BOOL statedbCommit(statedb_t *const db, const wchar_t *const fileName, statedb_entry *const updates, const size_t updateCount)
+{
+	const size_t size = wcslen(fileName) + 16U;
+	wchar_t *const tempName = (wchar_t*) malloc(size * sizeof(wchar_t));
+	BOOL success = FALSE;
+
+	if (!tempName)
+	{
+		statedbClose(db);
+		return FALSE;
+	}
+
+	//Write to a temporary file first, then atomically replace the database (the temporary name is unique per process)
+	_snwprintf(tempName, size, L"%s.%08lX.tmp", fileName, GetCurrentProcessId());
+	tempName[size - 1U] = L'\0';
+	qsort(updates, updateCount, sizeof(statedb_entry), compareEntries);
+	if (writeDatabase(tempName, db, updates, updateCount))
+	{
+		statedbClose(db); /*the mapped view prevents the replacement*/
+		success = MoveFileExW(tempName, fileName, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+	}
+
+	if (!success)
+	{
+		statedbClose(db);
+		DeleteFileW(tempName);
+	}
+
+	FREE(tempName);
+	return success;
+}
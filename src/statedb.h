@@ -0,0 +1,40 @@
+/*
+ * Persistent file state database
+ * Created by LoRd_MuldeR <mulder2@gmx.de>.
+ *
+ * This work is licensed under the CC0 1.0 Universal License.
+ * To view a copy of the license, visit:
+ * https://creativecommons.org/publicdomain/zero/1.0/legalcode
+ */
+
+#pragma once
+
+#include "common.h"
+
+typedef struct
+{
+	const wchar_t *path;
+	DWORD attributes;
+	unsigned long long size;
+	unsigned long long mtime;
+	unsigned long long fileId;
+	unsigned long long hash;
+}
+statedb_entry;
+
+typedef struct
+{
+	HANDLE file, mapping;
+	const BYTE *view;
+	statedb_entry *entries;
+	size_t count;
+}
+statedb_t;
+
+BOOL statedbOpen(statedb_t *const db, const wchar_t *const fileName);
+void statedbClose(statedb_t *const db);
+
+const statedb_entry *statedbFind(const statedb_t *const db, const wchar_t *const path);
+BOOL statedbQuery(statedb_entry *const entry, const wchar_t *const path, const BOOL withHash);
+BOOL statedbEqual(const statedb_entry *const a, const statedb_entry *const b);
+BOOL statedbCommit(statedb_t *const db, const wchar_t *const fileName, statedb_entry *const updates, const size_t updateCount);
@@ -0,0 +1,310 @@
+/*
+ * waitany for Win32
+ * Created by LoRd_MuldeR <mulder2@gmx.de>.
+ * 
+ * This work is licensed under the CC0 1.0 Universal License.
+ * To view a copy of the license, visit:
+ * https://creativecommons.org/publicdomain/zero/1.0/legalcode
+ */
+
+#include "common.h"
+
+/* ======================================================================= */
+/* UTILITY FUNCTIONS                                                       */
+/* ======================================================================= */
+
+static BOOL __stdcall crtlHandler(DWORD dwCtrlTyp)
+{
+	return handleInterrupt(dwCtrlTyp, L"Waitany", 2); /*the main thread is signaled to clean up*/
+}
+
+/* ======================================================================= */
+/* HELPER MACROS AND TYPES                                                 */
+/* ======================================================================= */
+
+#define EXIT_INTERRUPTED 2 /*exit code when interrupted by user*/
+#define MAXIMUM_CONDITIONS (REACTOR_MAXIMUM - 1) /*one wait slot is reserved for the interrupt*/
+#define TAG_INTERRUPT MAXIMUM_CONDITIONS
+
+#define CONDITION_PROCESS 0
+#define CONDITION_FILE    1
+#define CONDITION_TIMEOUT 2
+
+#define CHANGE_FILTER (FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE)
+
+#define TRY_PARSE_OPTION(NAME) \
+	if (!_wcsicmp(argv[argOffset] + 2U, L#NAME)) \
+	{ \
+		opt_##NAME = TRUE; \
+		continue; \
+	}
+
+#define TRY_PARSE_PREFIX(PREFIX, TYPE) \
+	if (!_wcsnicmp(argv[argOffset], PREFIX, wcslen(PREFIX))) \
+	{ \
+		condition->type = (TYPE); \
+		value = argv[argOffset] + wcslen(PREFIX); \
+	}
+
+typedef struct
+{
+	int type;
+	const wchar_t *spec;
+	const wchar_t *path;
+	HANDLE handle;
+	BOOL directory, exists;
+	WIN32_FILE_ATTRIBUTE_DATA state;
+}
+condition_t;
+
+/* ======================================================================= */
+/* FILE CONDITIONS                                                         */
+/* ======================================================================= */
+
+static BOOL getFileState(const wchar_t *const path, WIN32_FILE_ATTRIBUTE_DATA *const state)
+{
+	if (!GetFileAttributesExW(path, GetFileExInfoStandard, state))
+	{
+		memset(state, 0, sizeof(WIN32_FILE_ATTRIBUTE_DATA));
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static BOOL fileChanged(condition_t *const condition)
+{
+	WIN32_FILE_ATTRIBUTE_DATA state;
+	const BOOL exists = getFileState(condition->path, &state);
+
+	//Files are compared by existence, size and last write time
+	if (exists != condition->exists)
+	{
+		return TRUE;
+	}
+	return exists && ((state.nFileSizeHigh != condition->state.nFileSizeHigh) || (state.nFileSizeLow != condition->state.nFileSizeLow) || CompareFileTime(&state.ftLastWriteTime, &condition->state.ftLastWriteTime));
+}
+
+static BOOL fileWatch(condition_t *const condition, const wchar_t *const fileName)
+{
+	const wchar_t *directory = NULL;
+	BOOL success = FALSE;
+
+	if (!(condition->path = getCanonicalPath(fileName)))
+	{
+		return FALSE;
+	}
+
+	//A directory is watched itself, a file is watched through its parent directory
+	condition->directory = getFileState(condition->path, &condition->state) && (condition->state.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY);
+	if (condition->directory)
+	{
+		condition->handle = FindFirstChangeNotificationW(condition->path, FALSE, CHANGE_FILTER);
+	}
+	else if (directory = getDirectoryPart(condition->path))
+	{
+		condition->handle = FindFirstChangeNotificationW(directory, FALSE, CHANGE_FILTER);
+	}
+
+	success = (condition->handle != INVALID_HANDLE_VALUE) && (condition->handle != NULL);
+	if (!success)
+	{
+		condition->handle = NULL;
+	}
+
+	//The baseline is taken *after* the notification has been armed, so that no change can slip through
+	condition->exists = getFileState(condition->path, &condition->state);
+
+	FREE(directory);
+	return success;
+}
+
+/* ======================================================================= */
+/* MAIN                                                                    */
+/* ======================================================================= */
+
+/*Globals*/
+static condition_t conditions[MAXIMUM_CONDITIONS];
+
+int wmain(int argc, wchar_t *argv[])
+{
+	int result = EXIT_FAILURE, argOffset = 1, tag, terminated = -1;
+	BOOL opt_quiet = FALSE;
+	DWORD idx, conditionCount = 0U;
+	reactor_t reactor;
+
+	//Initialize
+	INITIALIZE_C_RUNTIME();
+	reactorInit(&reactor);
+
+	//Check command-line arguments
+	if ((argc < 2) || (!_wcsicmp(argv[1U], L"/?")) || (!_wcsicmp(argv[1U], L"--help")))
+	{
+		fwprintf(stderr, L"waitany %s\n", PROGRAM_VERSION);
+		wprintln(stderr, L"Wait (sleep) until the first of the specified conditions is met.\n");
+		wprintln(stderr, L"Usage:");
+		wprintln(stderr, L"   waitany.exe [options] <condition_1> [<condition_2> ... <condition_N>]\n");
+		wprintln(stderr, L"Conditions:");
+		wprintln(stderr, L"   pid:<PID>      the process with the given ID has terminated");
+		wprintln(stderr, L"   file:<name>    the file is created, deleted or modified (any change in a directory)");
+		wprintln(stderr, L"   timeout:<T>    the timeout has expired, in milliseconds (or with unit, e.g. 30s)\n");
+		wprintln(stderr, L"Options:");
+		wprintln(stderr, L"   --quiet  do *not* print the condition that was met to standard output\n");
+		wprintln(stderr, L"Exit status:");
+		wprintln(stderr, L"   0 - A condition was met");
+		wprintln(stderr, L"   1 - Failed with error");
+		wprintln(stderr, L"   2 - Interrupted by user\n");
+		wprintln(stderr, L"Remarks:");
+		wprintln(stderr, L"   The condition that was met first is printed, exactly as it was given.");
+		wprintln(stderr, L"   A process that does not exist (anymore) is considered to be terminated.\n");
+		return EXIT_FAILURE;
+	}
+
+	//Parse command-line options
+	for (; (argOffset < argc) && (!wcsncmp(argv[argOffset], L"--", 2)); ++argOffset)
+	{
+		if (!argv[argOffset][2U])
+		{
+			++argOffset;
+			break; /*stop option parsing*/
+		}
+		TRY_PARSE_OPTION(quiet)
+		fwprintf(stderr, L"Error: Unknown option \"%s\" encountered!\n\n", argv[argOffset]);
+		return EXIT_FAILURE;
+	}
+
+	//Check remaining argument count
+	if (argOffset >= argc)
+	{
+		wprintln(stderr, L"Error: No condition(s) specified. Nothing to do!\n");
+		return EXIT_FAILURE;
+	}
+	if ((argc - argOffset) > MAXIMUM_CONDITIONS)
+	{
+		fwprintf(stderr, L"Error: Too many conditions specified! [limit: %d]\n\n", MAXIMUM_CONDITIONS);
+		return EXIT_FAILURE;
+	}
+
+	//Parse the conditions and register them with the reactor
+	for (; argOffset < argc; ++argOffset)
+	{
+		const int current = (int) conditionCount++;
+		condition_t *const condition = &conditions[current];
+		const wchar_t *value = NULL;
+		ULONG number;
+		condition->spec = argv[argOffset];
+		TRY_PARSE_PREFIX(L"pid:", CONDITION_PROCESS)
+		TRY_PARSE_PREFIX(L"file:", CONDITION_FILE)
+		TRY_PARSE_PREFIX(L"timeout:", CONDITION_TIMEOUT)
+		if ((!value) || (!value[0U]))
+		{
+			fwprintf(stderr, L"Error: Condition \"%s\" is invalid!\n\n", argv[argOffset]);
+			goto cleanup;
+		}
+		switch (condition->type)
+		{
+		case CONDITION_PROCESS:
+			if (parseULong(value, &number))
+			{
+				fwprintf(stderr, L"Error: Specified PID \"%s\" is invalid!\n\n", value);
+				goto cleanup;
+			}
+			if (!(condition->handle = OpenProcess(SYNCHRONIZE, FALSE, number)))
+			{
+				if (GetLastError() == ERROR_INVALID_PARAMETER)
+				{
+					if (terminated < 0)
+					{
+						terminated = current; /*no such process, reported once all conditions are valid*/
+					}
+					break;
+				}
+				fwprintf(stderr, L"Error: Failed to open process #%lu! [error: %lu]\n\n", number, GetLastError());
+				goto cleanup;
+			}
+			reactorAddHandle(&reactor, condition->handle, current);
+			break;
+		case CONDITION_FILE:
+			if (!fileWatch(condition, value))
+			{
+				fwprintf(stderr, L"Error: File \"%s\" can not be watched!\n\n", value);
+				goto cleanup;
+			}
+			reactorAddHandle(&reactor, condition->handle, current);
+			break;
+		case CONDITION_TIMEOUT:
+			if (parseDuration(value, &number) || (number == INFINITE))
+			{
+				fwprintf(stderr, L"Error: Specified timeout \"%s\" is invalid!\n\n", value);
+				goto cleanup;
+			}
+			if (!reactorAddTimer(&reactor, number, current))
+			{
+				fwprintf(stderr, L"Error: Too many timeouts specified! [limit: %u]\n\n", REACTOR_TIMERS);
+				goto cleanup;
+			}
+			break;
+		}
+	}
+	if (terminated >= 0)
+	{
+		tag = terminated;
+		goto finished; /*a process has terminated already*/
+	}
+	if (!reactorAddInterrupt(&reactor, TAG_INTERRUPT))
+	{
+		wprintln(stderr, L"System Error: Failed to set up the interrupt handler!\n");
+		goto cleanup;
+	}
+
+	//Wait for the first condition to be met (directory notifications for a file are verified first)
+	for (;;)
+	{
+		if ((tag = reactorWait(&reactor)) == REACTOR_FAILED)
+		{
+			fwprintf(stderr, L"System Error: Failed to wait for conditions! [error: %lu]\n\n", GetLastError());
+			goto cleanup;
+		}
+		if (tag == TAG_INTERRUPT)
+		{
+			result = EXIT_INTERRUPTED;
+			goto cleanup;
+		}
+		if ((conditions[tag].type != CONDITION_FILE) || conditions[tag].directory || fileChanged(&conditions[tag]))
+		{
+			break;
+		}
+		if (!FindNextChangeNotification(conditions[tag].handle))
+		{
+			wprintln(stderr, L"System Error: Failed to wait for notification!\n");
+			goto cleanup;
+		}
+	}
+
+	//Report the condition that was met
+finished:
+	if (!opt_quiet)
+	{
+		fwprintf(stdout, L"%s\n", conditions[tag].spec);
+	}
+	result = EXIT_SUCCESS;
+
+	//Perform final clean-up
+cleanup:
+	for (idx = 0U; idx < conditionCount; ++idx)
+	{
+		if (conditions[idx].handle)
+		{
+			if (conditions[idx].type == CONDITION_FILE)
+			{
+				FindCloseChangeNotification(conditions[idx].handle);
+			}
+			else
+			{
+				CloseHandle(conditions[idx].handle);
+			}
+		}
+		FREE(conditions[idx].path);
+	}
+
+	return result; /*exit*/
+}
@@ -0,0 +1,353 @@
+/*
+ * waitlock for Win32
+ * Created by LoRd_MuldeR <mulder2@gmx.de>.
+ * 
+ * This work is licensed under the CC0 1.0 Universal License.
+ * To view a copy of the license, visit:
+ * https://creativecommons.org/publicdomain/zero/1.0/legalcode
+ */
+
+#include "common.h"
+
+/* ======================================================================= */
+/* UTILITY FUNCTIONS                                                       */
+/* ======================================================================= */
+
+static volatile LONG childRunning = 0L;
+
+static BOOL __stdcall crtlHandler(DWORD dwCtrlTyp)
+{
+	if (childRunning && ((dwCtrlTyp == CTRL_C_EVENT) || (dwCtrlTyp == CTRL_BREAK_EVENT)))
+	{
+		return TRUE; /*the child gets the interrupt as well, so keep holding the lock until it has exited*/
+	}
+	return handleInterrupt(dwCtrlTyp, L"Waitlock", 3); /*the main thread is signaled to clean up*/
+}
+
+/* ======================================================================= */
+/* HELPER MACROS AND TYPES                                                 */
+/* ======================================================================= */
+
+#define EXIT_TIMEOUT 2 /*exit code when timeout occrus*/
+#define EXIT_INTERRUPTED 3 /*exit code when interrupted by user*/
+
+#define TAG_LOCK 0
+#define TAG_TIMEOUT 1
+#define TAG_INTERRUPT 2
+
+#define TRY_PARSE_OPTION(NAME) \
+	if (!_wcsicmp(argv[argOffset] + 2U, L#NAME)) \
+	{ \
+		opt_##NAME = TRUE; \
+		continue; \
+	}
+
+/* ======================================================================= */
+/* COMMAND LINE                                                            */
+/* ======================================================================= */
+
+static wchar_t *appendArgument(wchar_t *output, const wchar_t *const arg)
+{
+	const wchar_t *ptr;
+	size_t backslashes = 0U;
+
+	//Arguments without white-space or quotes are passed as-is
+	if (arg[0U] && (!wcspbrk(arg, L" \t\n\v\"")))
+	{
+		const size_t length = wcslen(arg);
+		memcpy(output, arg, length * sizeof(wchar_t));
+		return output + length;
+	}
+
+	//Otherwise, quote the argument, so that CommandLineToArgvW() will restore it
+	*output++ = L'"';
+	for (ptr = arg; *ptr; ++ptr)
+	{
+		if (*ptr == L'\\')
+		{
+			++backslashes;
+		}
+		else
+		{
+			if (*ptr == L'"')
+			{
+				for (++backslashes; backslashes > 0U; --backslashes)
+				{
+					*output++ = L'\\'; /*escape the preceding backslashes as well as the quote*/
+				}
+			}
+			backslashes = 0U;
+		}
+		*output++ = *ptr;
+	}
+	for (; backslashes > 0U; --backslashes)
+	{
+		*output++ = L'\\'; /*escape trailing backslashes, before the closing quote*/
+	}
+	*output++ = L'"';
+	return output;
+}
+
+static wchar_t *buildCommandLine(const int argc, wchar_t *const argv[])
+{
+	wchar_t *commandLine, *output;
+	size_t capacity = 1U;
+	int idx;
+
+	for (idx = 0; idx < argc; ++idx)
+	{
+		capacity += (2U * wcslen(argv[idx])) + 3U;
+	}
+
+	if (!(output = commandLine = (wchar_t*) malloc(capacity * sizeof(wchar_t))))
+	{
+		return NULL;
+	}
+
+	for (idx = 0; idx < argc; ++idx)
+	{
+		if (idx > 0)
+		{
+			*output++ = L' ';
+		}
+		output = appendArgument(output, argv[idx]);
+	}
+
+	*output = L'\0';
+	return commandLine;
+}
+
+/* ======================================================================= */
+/* FILE LOCKING                                                            */
+/* ======================================================================= */
+
+static int acquireLock(const HANDLE file, OVERLAPPED *const overlapped, const BOOL shared, const DWORD timeout, const BOOL quiet, const wchar_t *const fileName)
+{
+	reactor_t reactor;
+	DWORD transferred;
+	int tag;
+
+	//Try to lock the whole file; this either succeeds at once, or completes asynchronously
+	if (LockFileEx(file, shared ? 0U : LOCKFILE_EXCLUSIVE_LOCK, 0U, MAXDWORD, MAXDWORD, overlapped))
+	{
+		return TAG_LOCK;
+	}
+	if (GetLastError() != ERROR_IO_PENDING)
+	{
+		return REACTOR_FAILED;
+	}
+
+	//Print status
+	if (!quiet)
+	{
+		fwprintf(stderr, L"Waiting for the lock on \"%s\"...\n", fileName);
+	}
+
+	//Wait for the lock to be granted, the timeout or an interrupt
+	reactorInit(&reactor);
+	if (!(reactorAddHandle(&reactor, overlapped->hEvent, TAG_LOCK) && reactorAddTimer(&reactor, timeout, TAG_TIMEOUT) && reactorAddInterrupt(&reactor, TAG_INTERRUPT)))
+	{
+		tag = REACTOR_FAILED;
+	}
+	else
+	{
+		tag = reactorWait(&reactor);
+	}
+
+	//Cancel the pending lock request, unless it has been granted
+	if (tag != TAG_LOCK)
+	{
+		CancelIo(file);
+	}
+	if (GetOverlappedResult(file, overlapped, &transferred, TRUE))
+	{
+		if (tag != TAG_LOCK)
+		{
+			UnlockFileEx(file, 0U, MAXDWORD, MAXDWORD, overlapped); /*granted before the cancellation took effect*/
+		}
+	}
+	else if (tag == TAG_LOCK)
+	{
+		tag = REACTOR_FAILED;
+	}
+
+	return tag;
+}
+
+static DWORD runCommand(wchar_t *const commandLine, const BOOL quiet)
+{
+	STARTUPINFOW startupInfo;
+	PROCESS_INFORMATION processInfo;
+	DWORD exitCode = EXIT_FAILURE;
+
+	memset(&startupInfo, 0, sizeof(STARTUPINFOW));
+	memset(&processInfo, 0, sizeof(PROCESS_INFORMATION));
+	startupInfo.cb = sizeof(STARTUPINFOW);
+
+	//Create the child process; the lock file handle is *not* inheritable
+	if (!CreateProcessW(NULL, commandLine, NULL, NULL, TRUE, 0U, NULL, NULL, &startupInfo, &processInfo))
+	{
+		fwprintf(stderr, L"Error: Failed to create the process! [error: %lu]\n\n", GetLastError());
+		return EXIT_FAILURE;
+	}
+
+	//Print status
+	if (!quiet)
+	{
+		fwprintf(stderr, L"Running process #%lu while holding the lock...\n\n", processInfo.dwProcessId);
+	}
+
+	//Wait for the child process; an interrupt is left to the child, which shares our console, without a deadline
+	if ((WaitForSingleObject(processInfo.hProcess, INFINITE) != WAIT_OBJECT_0) || (!GetExitCodeProcess(processInfo.hProcess, &exitCode)))
+	{
+		fwprintf(stderr, L"Error: Failed to wait for the process! [error: %lu]\n\n", GetLastError());
+		exitCode = EXIT_FAILURE;
+	}
+
+	CloseHandle(processInfo.hThread);
+	CloseHandle(processInfo.hProcess);
+	return exitCode;
+}
+
+/* ======================================================================= */
+/* MAIN                                                                    */
+/* ======================================================================= */
+
+int wmain(int argc, wchar_t *argv[])
+{
+	int result = EXIT_FAILURE, argOffset = 1, tag;
+	BOOL opt_shared = FALSE, opt_quiet = FALSE;
+	DWORD timeout = INFINITE;
+	HANDLE file = INVALID_HANDLE_VALUE;
+	OVERLAPPED overlapped;
+	const wchar_t *fileName = NULL;
+	wchar_t *commandLine = NULL;
+
+	//Initialize
+	INITIALIZE_C_RUNTIME();
+	memset(&overlapped, 0, sizeof(OVERLAPPED));
+
+	//Check command-line arguments
+	if ((argc < 2) || (!_wcsicmp(argv[1U], L"/?")) || (!_wcsicmp(argv[1U], L"--help")))
+	{
+		fwprintf(stderr, L"waitlock %s\n", PROGRAM_VERSION);
+		wprintln(stderr, L"Wait (sleep) until the lock on the specified file can be acquired.\n");
+		wprintln(stderr, L"Usage:");
+		wprintln(stderr, L"   waitlock.exe [options] <lock_file> [<command> [<argument_1> ... <argument_N>]]\n");
+		wprintln(stderr, L"Options:");
+		wprintln(stderr, L"   --timeout <T>  exit as soon as the timeout has expired, in milliseconds (or with unit, e.g. 30s)");
+		wprintln(stderr, L"   --shared       acquire a shared lock, which can be held by multiple processes at the same time");
+		wprintln(stderr, L"   --quiet        do *not* print any diagnostic messages; errors are shown anyway\n");
+		wprintln(stderr, L"Exit status:");
+		wprintln(stderr, L"   0 - Lock was acquired (and released)");
+		wprintln(stderr, L"   1 - Failed with error");
+		wprintln(stderr, L"   2 - Aborted because the timeout has expired");
+		wprintln(stderr, L"   3 - Interrupted by user\n");
+		wprintln(stderr, L"Remarks:");
+		wprintln(stderr, L"   If a command is given, the lock is held while the command is running.");
+		wprintln(stderr, L"   In that case, the exit status of the command is returned, once it has finished.");
+		wprintln(stderr, L"   Ctrl+C is left to the command, the lock is held until the command has exited.");
+		wprintln(stderr, L"   The lock file is created, if it does not exist yet. It is never deleted.\n");
+		return EXIT_FAILURE;
+	}
+
+	//Parse command-line options
+	for (; (argOffset < argc) && (!wcsncmp(argv[argOffset], L"--", 2)); ++argOffset)
+	{
+		if (!argv[argOffset][2U])
+		{
+			++argOffset;
+			break; /*stop option parsing*/
+		}
+		if (!_wcsicmp(argv[argOffset] + 2U, L"timeout"))
+		{
+			if ((++argOffset >= argc) || parseDuration(argv[argOffset], &timeout) || (timeout == INFINITE))
+			{
+				wprintln(stderr, L"Error: Option --timeout requires a valid timeout!\n");
+				return EXIT_FAILURE;
+			}
+			continue;
+		}
+		TRY_PARSE_OPTION(shared)
+		TRY_PARSE_OPTION(quiet)
+		fwprintf(stderr, L"Error: Unknown option \"%s\" encountered!\n\n", argv[argOffset]);
+		return EXIT_FAILURE;
+	}
+
+	//Check remaining argument count
+	if (argOffset >= argc)
+	{
+		wprintln(stderr, L"Error: No lock file specified. Nothing to do!\n");
+		return EXIT_FAILURE;
+	}
+
+	//Build the command line of the child process
+	fileName = argv[argOffset++];
+	if ((argOffset < argc) && (!(commandLine = buildCommandLine(argc - argOffset, argv + argOffset))))
+	{
+		wprintln(stderr, L"Error: Memory allocation has failed!\n");
+		return EXIT_FAILURE;
+	}
+
+	//Open or create the lock file
+	file = CreateFileW(fileName, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		fwprintf(stderr, L"Error: Failed to open the lock file \"%s\"! [error: %lu]\n\n", fileName, GetLastError());
+		goto cleanup;
+	}
+	if (!(overlapped.hEvent = CreateEventW(NULL, TRUE, FALSE, NULL)))
+	{
+		wprintln(stderr, L"System Error: Failed to create event object!\n");
+		goto cleanup;
+	}
+
+	//Acquire the lock
+	tag = acquireLock(file, &overlapped, opt_shared, timeout, opt_quiet, fileName);
+	if (tag == TAG_TIMEOUT)
+	{
+		if (!opt_quiet)
+		{
+			wprintln(stderr, L"Timeout has expired.\n");
+		}
+		result = EXIT_TIMEOUT;
+		goto cleanup;
+	}
+	else if (tag == TAG_INTERRUPT)
+	{
+		result = EXIT_INTERRUPTED;
+		goto cleanup;
+	}
+	else if (tag != TAG_LOCK)
+	{
+		fwprintf(stderr, L"Error: Failed to lock the file \"%s\"! [error: %lu]\n\n", fileName, GetLastError());
+		goto cleanup;
+	}
+
+	//Run the command, while holding the lock
+	if (commandLine)
+	{
+		InterlockedExchange(&childRunning, 1L);
+		result = isInterrupted() ? EXIT_INTERRUPTED : ((int) runCommand(commandLine, opt_quiet));
+		InterlockedExchange(&childRunning, 0L);
+	}
+	else
+	{
+		if (!opt_quiet)
+		{
+			wprintln(stderr, L"Lock acquired.\n");
+		}
+		result = EXIT_SUCCESS;
+	}
+
+	//Release the lock
+	UnlockFileEx(file, 0U, MAXDWORD, MAXDWORD, &overlapped);
+
+	//Perform final clean-up
+cleanup:
+	CLOSE_HANDLE(overlapped.hEvent);
+	CLOSE_HANDLE(file);
+	FREE(commandLine);
+
+	return result; /*exit*/
+}
@@ -15,21 +15,7 @@
 
 static BOOL __stdcall crtlHandler(DWORD dwCtrlTyp)
 {
-	switch (dwCtrlTyp)
-	{
-	case CTRL_C_EVENT:
-		wprintln(stderr, L"Ctrl+C: Waitpid has been interrupted !!!\n");
-		break;
-	case CTRL_BREAK_EVENT:
-		wprintln(stderr, L"Break: Waitpid has been interrupted !!!\n");
-		break;
-	default:
-		return FALSE;
-	}
-
-	fflush(stderr);
-	_exit(3);
-	return TRUE;
+	return handleInterrupt(dwCtrlTyp, L"Waitpid", 3); /*the main thread is signaled to clean up*/
 }
 
 /* ======================================================================= */
@@ -37,6 +23,10 @@ static BOOL __stdcall crtlHandler(DWORD dwCtrlTyp)
 /* ======================================================================= */
 
 #define EXIT_TIMEOUT 2 /*exit code when timeout occrus*/
+#define EXIT_INTERRUPTED 3 /*exit code when interrupted by user*/
+#define MAXIMUM_PIDS (REACTOR_MAXIMUM - 1) /*one wait slot is reserved for the interrupt*/
+#define TAG_INTERRUPT MAXIMUM_PIDS
+#define TAG_TIMEOUT (MAXIMUM_PIDS + 1)
 #define PID_MASK (~((DWORD)0x3))
 #define SHUTDOWN_REASON (SHTDN_REASON_MAJOR_OTHER | SHTDN_REASON_MINOR_OTHER | SHUTDOWN_POWEROFF | SHTDN_REASON_FLAG_PLANNED)
 
@@ -57,9 +47,10 @@ static HANDLE procHandles[MAXIMUM_WAIT_OBJECTS];
 
 int wmain(int argc, wchar_t *argv[])
 {
-	int result = EXIT_FAILURE, argOffset = 1;
+	int result = EXIT_FAILURE, argOffset = 1, tag = REACTOR_FAILED;
 	BOOL opt_shutdown = FALSE, opt_waitone = FALSE, opt_pedantic = FALSE, opt_timeout = FALSE, opt_quiet = FALSE;
-	DWORD idx, error, pidCount = 0U, procCount = 0U, timeout = 30000U, waitStatus = MAXDWORD;
+	DWORD idx, error, pidCount = 0U, procCount = 0U, timeout = 30000U, remaining;
+	reactor_t reactor;
 
 	//Initialize
 	INITIALIZE_C_RUNTIME();
@@ -78,7 +69,7 @@ int wmain(int argc, wchar_t *argv[])
 		wprintln(stderr, L"   --pedantic  abort with error, if a specified process can *not* be opened");
 		wprintln(stderr, L"   --quiet     do *not* print any diagnostic messages; errors are shown anyway\n");
 		wprintln(stderr, L"Environment:");
-		wprintln(stderr, L"   WAITPID_TIMEOUT  timeout in millisonds, only if `--timeout` is specified\n");
+		wprintln(stderr, L"   WAITPID_TIMEOUT  timeout in milliseconds (or with unit, e.g. 90s), only if `--timeout` is specified\n");
 		wprintln(stderr, L"Exit status:");
 		wprintln(stderr, L"   0 - Processes have terminated normally");
 		wprintln(stderr, L"   1 - Failed with error");
@@ -111,7 +102,7 @@ int wmain(int argc, wchar_t *argv[])
 		if (envstr)
 		{
 			DWORD value;
-			if (parseULong(envstr, &value) || (value < 1U) || (value == INFINITE))
+			if (parseDuration(envstr, &value) || (value < 1U) || (value == INFINITE))
 			{
 				wprintln(stderr, L"Warning: WAITPID_TIMEOUT is invalid. Using default timeout!\n");
 			}
@@ -129,9 +120,9 @@ int wmain(int argc, wchar_t *argv[])
 		wprintln(stderr, L"Error: No PID(s) specified. Nothing to do!\n");
 		return EXIT_FAILURE;
 	}
-	if ((argc - argOffset) > MAXIMUM_WAIT_OBJECTS)
+	if ((argc - argOffset) > MAXIMUM_PIDS)
 	{
-		fwprintf(stderr, L"Error: Too many PID(s) specified! [limit: %d]\n\n", MAXIMUM_WAIT_OBJECTS);
+		fwprintf(stderr, L"Error: Too many PID(s) specified! [limit: %d]\n\n", MAXIMUM_PIDS);
 		return EXIT_FAILURE;
 	}
 
@@ -207,18 +198,28 @@ int wmain(int argc, wchar_t *argv[])
 		fwprintf(stderr, L"Waiting for %lu unique process(es) to terminate...\n", procCount);
 	}
 
-	//Wait for processes to terminate
-	if (procCount > 1U)
+	//Wait for processes to terminate, the timeout or an interrupt
+	reactorInit(&reactor);
+	for (idx = 0U; idx < procCount; ++idx)
 	{
-		waitStatus = WaitForMultipleObjects(procCount, procHandles, !opt_waitone, opt_timeout ? timeout : INFINITE);
+		reactorAddHandle(&reactor, procHandles[idx], (int) idx);
 	}
-	else
+	if (!(reactorAddInterrupt(&reactor, TAG_INTERRUPT) && reactorAddTimer(&reactor, opt_timeout ? timeout : INFINITE, TAG_TIMEOUT)))
 	{
-		waitStatus = WaitForSingleObject(procHandles[0U], opt_timeout ? timeout : INFINITE);
+		wprintln(stderr, L"System Error: Failed to set up the interrupt handler!\n");
+		goto cleanup;
+	}
+	for (remaining = procCount; remaining > 0U; --remaining)
+	{
+		if (((tag = reactorWait(&reactor)) < 0) || (tag >= (int)procCount) || opt_waitone)
+		{
+			break;
+		}
+		reactorRemove(&reactor, tag); /*keep waiting for the others*/
 	}
 
 	//Check the resulting wait status
-	if (waitStatus < procCount)
+	if ((tag >= 0) && (tag < (int)procCount))
 	{
 		result = EXIT_SUCCESS;
 		if (!opt_quiet)
@@ -226,22 +227,24 @@ int wmain(int argc, wchar_t *argv[])
 			wprintln(stderr, L"Terminated.\n");
 		}
 	}
-	else
+	else if (tag == TAG_TIMEOUT)
 	{
-		if (waitStatus == WAIT_TIMEOUT)
-		{
-			result = EXIT_TIMEOUT;
-			if (!opt_quiet)
-			{
-				wprintln(stderr, L"Timeout has expired.\n");
-			}
-		}
-		else
+		result = EXIT_TIMEOUT;
+		if (!opt_quiet)
 		{
-			fwprintf(stderr, L"Failed to wait for processes! [error: %lu]\n\n", GetLastError());
-			goto cleanup;
+			wprintln(stderr, L"Timeout has expired.\n");
 		}
 	}
+	else if (tag == TAG_INTERRUPT)
+	{
+		result = EXIT_INTERRUPTED;
+		goto cleanup; /*no shutdown*/
+	}
+	else
+	{
+		fwprintf(stderr, L"Failed to wait for processes! [error: %lu]\n\n", GetLastError());
+		goto cleanup;
+	}
 
 success:
 	if (opt_shutdown)